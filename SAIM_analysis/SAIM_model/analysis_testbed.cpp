@@ -35,6 +35,7 @@
 #include "saim_model_gpu.h"
 #include <stdio.h>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include <opencv2\core\core.hpp>
@@ -52,6 +53,8 @@ int main(int argc, char **argv)
       std::cout << "Need to include a file name";
       return 1;
    }
+   //--cpu evaluates the grains on the host instead of the GPU
+   bool cpuBackend = argc > 2 && std::string(argv[2]) == "--cpu";
 
    std::vector<cv::Mat> imstack;
    cv::imreadmulti(argv[1], imstack, CV_LOAD_IMAGE_ANYDEPTH);
@@ -72,8 +75,13 @@ int main(int argc, char **argv)
 
    gpumodel::GPUModel model;
    model.RegisterImages(imstack);
-   model.SetGrainSize(128);
-   model.InitializeBuffers();
+   if (cpuBackend)
+      model.SetBackend(gpumodel::FitBackend::BACKEND_CPU);
+   if (model.InitializeBuffers())
+   {
+      delete[] angles;
+      return 1;
+   }
    model.CalculateConstants(560.0, 1915.167, 1.34, 1.463, 4.3638, angles);
    model.RunFit();
    model.ReleaseBuffers();
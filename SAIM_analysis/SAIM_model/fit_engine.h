@@ -0,0 +1,104 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#ifndef FIT_ENGINE_H
+#define FIT_ENGINE_H
+
+namespace saim_model_gpu
+{
+   /**Hardware a FitEngine evaluates the grains on*/
+   enum class FitBackend
+   {
+      BACKEND_CPU,
+      BACKEND_CUDA
+   };
+
+   /****************************************************************************
+   * @brief Model and Jacobian evaluation for the grain-batched fit.
+   *
+   * A grain is grainSize pixels fit side by side, each pixel its own 3
+   * variable (A, B, H) problem, so the engine evaluates many small problems
+   * per call. The engine owns the buffers of one grain, which the solver
+   * reads and writes directly:
+   *    Data  - the grain's frames, pixel-major, grainSize x frames
+   *    XVec  - A, B, H of each pixel
+   *    FVec  - residuals model - data, pixel-major
+   *    JVec  - the diagonal blocks of the Jacobian, grainSize x frames x 3,
+   *            dA, dB, dH of each residual. A pixel's residuals depend only
+   *            on its own variables, so the rest of the grain's Jacobian is
+   *            zero and never stored.
+   * Function and Jacobian fill FVec and JVec at the current XVec. Backends
+   * differ only in where the buffers live and what runs the evaluation.
+   ****************************************************************************/
+   class FitEngine
+   {
+   public:
+      virtual ~FitEngine() {}
+
+      virtual const char *Name(void) const = 0;
+
+      /*************************************************************************
+      * @brief Allocates the buffers of a grain
+      *************************************************************************/
+      virtual int Initialize(int grainSize, int frames) = 0;
+      virtual int Release(void) = 0;
+
+      /*************************************************************************
+      * @brief Copies the fit constants (Re r, Im r, phi per frame)
+      *************************************************************************/
+      virtual int SetConstants(const double *constvec) = 0;
+
+      virtual unsigned short *Data(void) = 0;
+      virtual double *XVec(void) = 0;
+      virtual double *FVec(void) = 0;
+      virtual double *JVec(void) = 0;
+
+      virtual int Function(void) = 0;
+      virtual int Jacobian(void) = 0;
+   };
+
+   /*************************************************************************
+   * @brief A new engine of the backend, nullptr if this build does not have
+   * it. device selects the CUDA device.
+   *************************************************************************/
+   FitEngine *CreateFitEngine(FitBackend backend, int device = 0);
+
+#ifdef SAIM_WITH_CUDA
+   /**Defined with the kernels in saim_kernel.cu*/
+   FitEngine *CreateCudaFitEngine(int device);
+#endif
+}
+
+#endif //FIT_ENGINE_H
@@ -0,0 +1,130 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#include "fit_engine_cpu.h"
+
+#include <cmath>
+#include <cstring>
+#include <mkl.h>
+
+namespace saim_model_gpu
+{
+   CpuFitEngine::CpuFitEngine() {}
+
+   CpuFitEngine::~CpuFitEngine()
+   {
+      Release();
+   }
+
+   int CpuFitEngine::Initialize(int grainSize, int frames)
+   {
+      Release();
+      if (grainSize < 1 || frames < 1)
+         return 1;
+      _grainSize = grainSize;
+      _frames = frames;
+      size_t points = (size_t)grainSize * frames;
+      _data = (unsigned short *)MKL_malloc(points * sizeof(unsigned short), 64);
+      _xvec = (double *)MKL_malloc(grainSize * 3 * sizeof(double), 64);
+      _fvec = (double *)MKL_malloc(points * sizeof(double), 64);
+      _jvec = (double *)MKL_malloc(points * 3 * sizeof(double), 64);
+      _constvec = (double *)MKL_malloc(frames * 3 * sizeof(double), 64);
+      if (_data == nullptr || _xvec == nullptr || _fvec == nullptr || _jvec == nullptr || _constvec == nullptr)
+      {
+         Release();
+         return 1;
+      }
+      return 0;
+   }
+
+   int CpuFitEngine::Release(void)
+   {
+      mkl_free(_data);
+      mkl_free(_xvec);
+      mkl_free(_fvec);
+      mkl_free(_jvec);
+      mkl_free(_constvec);
+      _data = nullptr;
+      _xvec = _fvec = _jvec = _constvec = nullptr;
+      _grainSize = _frames = 0;
+      return 0;
+   }
+
+   int CpuFitEngine::SetConstants(const double *constvec)
+   {
+      if (_constvec == nullptr)
+         return 1;
+      memcpy(_constvec, constvec, _frames * 3 * sizeof(double));
+      return 0;
+   }
+
+   int CpuFitEngine::Function(void)
+   {
+      const int n = _frames;
+#pragma omp parallel for schedule(static)
+      for (int pixel = 0; pixel < _grainSize; pixel++)
+      {
+         double A{ _xvec[pixel * 3] }, B{ _xvec[pixel * 3 + 1] }, H{ _xvec[pixel * 3 + 2] };
+         const unsigned short *data = _data + (size_t)pixel * n;
+         double *fvec = _fvec + (size_t)pixel * n;
+         for (int frame = 0; frame < n; frame++)
+         {
+            double c{ _constvec[frame * 3] }, d{ _constvec[frame * 3 + 1] }, phi{ _constvec[frame * 3 + 2] };
+            double fval = A * (1 + 2 * c * cos(phi * H) - 2 * d * sin(phi * H) + c * c + d * d) + B;
+            fvec[frame] = fval - data[frame];
+         }
+      }
+      return 0;
+   }
+
+   int CpuFitEngine::Jacobian(void)
+   {
+      const int n = _frames;
+#pragma omp parallel for schedule(static)
+      for (int pixel = 0; pixel < _grainSize; pixel++)
+      {
+         double A{ _xvec[pixel * 3] }, H{ _xvec[pixel * 3 + 2] };
+         double *jvec = _jvec + (size_t)pixel * n * 3;
+         for (int frame = 0; frame < n; frame++)
+         {
+            double c{ _constvec[frame * 3] }, d{ _constvec[frame * 3 + 1] }, phi{ _constvec[frame * 3 + 2] };
+            jvec[frame * 3] = 1 + 2 * c * cos(phi * H) - 2 * d * sin(phi * H) + c * c + d * d;
+            jvec[frame * 3 + 1] = 1;
+            jvec[frame * 3 + 2] = -2 * A * phi * (c * sin(phi * H) + d * cos(phi * H));
+         }
+      }
+      return 0;
+   }
+}
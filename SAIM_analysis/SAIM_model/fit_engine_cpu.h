@@ -0,0 +1,78 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#ifndef FIT_ENGINE_CPU_H
+#define FIT_ENGINE_CPU_H
+
+#include "fit_engine.h"
+
+namespace saim_model_gpu
+{
+   /****************************************************************************
+   * @brief Reference backend: the grain's model and Jacobian evaluated on the
+   * host with OpenMP, one pixel per iteration of the parallel loop. Needs no
+   * GPU, so the batched fit runs and can be checked anywhere.
+   ****************************************************************************/
+   class CpuFitEngine : public FitEngine
+   {
+   public:
+      CpuFitEngine();
+      ~CpuFitEngine();
+
+      const char *Name(void) const { return "cpu"; }
+
+      int Initialize(int grainSize, int frames);
+      int Release(void);
+      int SetConstants(const double *constvec);
+
+      unsigned short *Data(void) { return _data; }
+      double *XVec(void) { return _xvec; }
+      double *FVec(void) { return _fvec; }
+      double *JVec(void) { return _jvec; }
+
+      int Function(void);
+      int Jacobian(void);
+
+   private:
+      CpuFitEngine(const CpuFitEngine &) = delete;
+      CpuFitEngine &operator=(const CpuFitEngine &) = delete;
+
+      int _grainSize{ 0 }, _frames{ 0 };
+      unsigned short *_data{ nullptr };
+      double *_xvec{ nullptr }, *_fvec{ nullptr }, *_jvec{ nullptr }, *_constvec{ nullptr };
+   };
+}
+
+#endif //FIT_ENGINE_CPU_H
@@ -0,0 +1,191 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#include "grain_lm_solver.h"
+#include "../analysis_testbed/lm_step.h"
+
+namespace saim_model_gpu
+{
+   GrainLMSolver::GrainLMSolver(int grainSize, int frames) : _grainSize(grainSize), _n(frames)
+   {
+      _pixels = new PixelState[_grainSize];
+   }
+
+   GrainLMSolver::~GrainLMSolver()
+   {
+      delete[] _pixels;
+   }
+
+   void GrainLMSolver::SetTolerances(const double *eps, int iterations)
+   {
+      for (int i = 0; i < 6; i++)
+         _eps[i] = eps[i];
+      _maxIterations = iterations;
+   }
+
+   void GrainLMSolver::Accumulate(const double *fvec, const double *jvec, bool trial)
+   {
+      const int n = _n;
+#pragma omp parallel for schedule(static)
+      for (int p = 0; p < _grainSize; p++)
+      {
+         PixelState &px = _pixels[p];
+         if (trial && !px.active)
+            continue;
+         const double *f = fvec + (size_t)p * n;
+         const double *j = jvec + (size_t)p * n * 3;
+         double c{ 0 }, g0{ 0 }, g1{ 0 }, g2{ 0 }, m00{ 0 }, m01{ 0 }, m02{ 0 }, m11{ 0 }, m12{ 0 }, m22{ 0 };
+         for (int i = 0; i < n; i++)
+         {
+            double r{ f[i] }, jA{ j[i * 3] }, jB{ j[i * 3 + 1] }, jH{ j[i * 3 + 2] };
+            c += r * r;
+            g0 += jA * r;
+            g1 += jB * r;
+            g2 += jH * r;
+            m00 += jA * jA;
+            m01 += jA * jB;
+            m02 += jA * jH;
+            m11 += jB * jB;
+            m12 += jB * jH;
+            m22 += jH * jH;
+         }
+         double *grad = trial ? px.trialGrad : px.grad;
+         double *hess = trial ? px.trialHess : px.hess;
+         (trial ? px.trialCost : px.cost) = c;
+         grad[0] = g0;
+         grad[1] = g1;
+         grad[2] = g2;
+         hess[0] = m00;
+         hess[1] = m01;
+         hess[2] = m02;
+         hess[3] = m11;
+         hess[4] = m12;
+         hess[5] = m22;
+      }
+   }
+
+   int GrainLMSolver::Solve(FitEngine *engine, int *stopCrit, int *iterations)
+   {
+      double *xvec = engine->XVec();
+      const double *fvec = engine->FVec(), *jvec = engine->JVec();
+      if (engine->Function() || engine->Jacobian())
+         return 1;
+      for (int p = 0; p < _grainSize; p++)
+      {
+         PixelState &px = _pixels[p];
+         for (int k = 0; k < 3; k++)
+            px.x[k] = xvec[p * 3 + k];
+         px.lambda = 0.001;
+         px.nu = 2.0;
+         px.stop = 0;
+         px.iterations = 0;
+         px.active = true;
+      }
+      Accumulate(fvec, jvec, false);
+      for (int p = 0; p < _grainSize; p++)
+      {
+         PixelState &px = _pixels[p];
+         px.stop = cpu_model::LMStartStop(px.cost, px.hess, 1, _eps);
+         px.active = px.stop == 0;
+      }
+
+      for (int iter = 0; iter < _maxIterations; iter++)
+      {
+         int running = 0;
+#pragma omp parallel for schedule(static) reduction(+:running)
+         for (int p = 0; p < _grainSize; p++)
+         {
+            PixelState &px = _pixels[p];
+            if (!px.active)
+               continue;
+            px.iterations++;
+            //A broken down factorization evaluates x again and rejects it
+            double step[3];
+            if (cpu_model::LMStep(px.grad, px.hess, 1, px.lambda, step, &px.pred))
+               px.stop = cpu_model::LMStepStop(step, px.cost, px.pred, _eps);
+            px.active = px.stop == 0;
+            if (!px.active)
+               continue;
+            xvec[p * 3] = px.x[0] + step[0];
+            xvec[p * 3 + 1] = px.x[1] + step[1];
+            xvec[p * 3 + 2] = px.x[2] + step[2];
+            running++;
+         }
+         if (running == 0)
+            break;
+
+         //Every pixel is evaluated, the stopped ones at their final point
+         if (engine->Function() || engine->Jacobian())
+            return 1;
+         Accumulate(fvec, jvec, true);
+#pragma omp parallel for schedule(static)
+         for (int p = 0; p < _grainSize; p++)
+         {
+            PixelState &px = _pixels[p];
+            if (!px.active)
+               continue;
+            if (cpu_model::LMAccept(px.cost, px.trialCost, px.pred, _eps, &px.lambda, &px.nu, &px.stop))
+            {
+               for (int k = 0; k < 3; k++)
+               {
+                  px.x[k] = xvec[p * 3 + k];
+                  px.grad[k] = px.trialGrad[k];
+               }
+               for (int k = 0; k < 6; k++)
+                  px.hess[k] = px.trialHess[k];
+               px.cost = px.trialCost;
+            }
+            else
+            {
+               for (int k = 0; k < 3; k++)
+                  xvec[p * 3 + k] = px.x[k];
+            }
+            px.active = px.stop == 0;
+         }
+      }
+
+      for (int p = 0; p < _grainSize; p++)
+      {
+         PixelState &px = _pixels[p];
+         for (int k = 0; k < 3; k++)
+            xvec[p * 3 + k] = px.x[k];
+         if (stopCrit != nullptr)
+            stopCrit[p] = px.stop == 0 ? 1 : px.stop;
+         if (iterations != nullptr)
+            iterations[p] = px.iterations;
+      }
+      return 0;
+   }
+}
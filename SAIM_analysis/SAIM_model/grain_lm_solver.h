@@ -0,0 +1,103 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#ifndef GRAIN_LM_SOLVER_H
+#define GRAIN_LM_SOLVER_H
+
+#include "fit_engine.h"
+
+namespace saim_model_gpu
+{
+   /****************************************************************************
+   * @brief Levenberg-Marquardt over the pixels of a grain, with the model and
+   * its block-diagonal Jacobian evaluated by a FitEngine.
+   *
+   * Each pixel keeps its own damping and stop state, its step solved from its
+   * own 3x3 normal equations J'J + lambda * diag(J'J), which is all the
+   * grain's normal matrix contains. Pixels that have stopped keep their
+   * parameters while the rest of the grain iterates. Stop criteria use the
+   * dtrnlsp_get codes, as BatchLMSolver does:
+   *    1 - iteration limit reached
+   *    2 - damping grew past 1 / eps[0]
+   *    3 - ||F(x)|| < eps[1]
+   *    4 - a Jacobian column norm < eps[2]
+   *    5 - ||s|| < eps[3]
+   *    6 - ||F(x)|| - ||F(x) + J(x)s|| < eps[4]
+   ****************************************************************************/
+   class GrainLMSolver
+   {
+   public:
+      GrainLMSolver(int grainSize, int frames);
+      ~GrainLMSolver();
+
+      /*************************************************************************
+      * @brief Sets the stop tolerances (6 values, same order as dtrnlsp) and
+      * the iteration limit
+      *************************************************************************/
+      void SetTolerances(const double *eps, int iterations);
+
+      /*************************************************************************
+      * @brief Fits the grain in the engine's buffers, starting from and
+      * leaving the result in its XVec
+      * @param stopCrit Out: stop criterion of each pixel, may be nullptr
+      * @param iterations Out: iterations used by each pixel, may be nullptr
+      *************************************************************************/
+      int Solve(FitEngine *engine, int *stopCrit, int *iterations);
+
+   private:
+      GrainLMSolver(const GrainLMSolver &) = delete;
+      GrainLMSolver &operator=(const GrainLMSolver &) = delete;
+
+      struct PixelState
+      {
+         double x[3], cost, grad[3], hess[6];        //accepted point
+         double trialCost, trialGrad[3], trialHess[6];
+         double lambda, nu, pred;
+         int stop, iterations;
+         bool active;
+      };
+
+      //||F||^2, J'F and J'J (upper triangle) of each pixel from the engine's
+      //buffers, into the accepted or the trial fields
+      void Accumulate(const double *fvec, const double *jvec, bool trial);
+
+      int _grainSize, _n;
+      int _maxIterations{ 1000 };
+      double _eps[6]{ 0.00001, 0.00001, 0.00001, 0.00001, 0.00001, 0.00001 };
+      PixelState *_pixels;
+   };
+}
+
+#endif //GRAIN_LM_SOLVER_H
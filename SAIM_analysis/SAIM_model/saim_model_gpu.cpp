@@ -32,4 +32,204 @@
 //  project, the Paszek Research Group, or Cornell University.                //
 //////////////////////////////////////////////////////////////////////////////*/
 
+
 #include "saim_model_gpu.h"
+#include "grain_lm_solver.h"
+#include "../analysis_testbed/grid_initializer.h"
+#include "../analysis_testbed/height_basis.h"
+#include "../analysis_testbed/optical_model.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace saim_model_gpu
+{
+   GPUModel::GPUModel()
+   {
+      _initialized = false;
+   }
+
+   GPUModel::~GPUModel()
+   {
+      if (_initialized)
+         ReleaseBuffers();
+   }
+
+   int GPUModel::RegisterImages(std::vector<cv::Mat> &input)
+   {
+      _rawImgs = input;
+      _outputImgs.clear();
+      for (int i = 0; i < 3; i++)
+      {
+         _outputImgs.push_back(cv::Mat(_rawImgs[0].rows, _rawImgs[0].cols, CV_64F));
+      }
+      return 0;
+   }
+
+   int GPUModel::SetGrainSize(int val)
+   {
+      if (_initialized || val < 1)
+         return 1;
+      _grainSize = val;
+      return 0;
+   }
+
+   int GPUModel::SetBackend(FitBackend backend, int device)
+   {
+      if (_initialized)
+         return 1;
+      _backend = backend;
+      _device = device;
+      return 0;
+   }
+
+   int GPUModel::SetHeightRange(double hMin, double hMax, double hStep)
+   {
+      if (hStep <= 0.0 || hMax < hMin)
+         return 1;
+      _heightRange[0] = hMin;
+      _heightRange[1] = hMax;
+      _heightRange[2] = hStep;
+      return 0;
+   }
+
+   int GPUModel::SetGridStart(bool enable)
+   {
+      _gridStart = enable;
+      return 0;
+   }
+
+   int GPUModel::InitializeBuffers()
+   {
+      if (_rawImgs.empty())
+         return 1;
+      _m = _rawImgs[0].rows * _rawImgs[0].cols;
+      _n = _rawImgs.size();
+      //Buffer sizes
+      _datasz = _m * _n;
+      _xsz = _grainSize * 3;
+      _fnsz = _grainSize * _n;
+      _ngrains = _m % _grainSize == 0 ? _m / _grainSize : _m / _grainSize + 1;
+      _emptyPixels = _ngrains * _grainSize - _m;
+
+      _engine = CreateFitEngine(_backend, _device);
+      if (_engine == nullptr)
+      {
+         std::cerr << "The fit backend is not available in this build" << std::endl;
+         return 1;
+      }
+      //The host keeps the whole stack, pixel-major, for the grid search and
+      //copies each grain into the engine's buffer
+      _data = (unsigned short *)MKL_malloc(_datasz * sizeof(unsigned short), 64);
+      _constvec = (double *)MKL_malloc(3 * _n * sizeof(double), 64);
+      if (_data == nullptr || _constvec == nullptr || _engine->Initialize(_grainSize, _n))
+      {
+         std::cerr << "Could not allocate the fit buffers" << std::endl;
+         _initialized = true;
+         ReleaseBuffers();
+         return 1;
+      }
+      _solver = new GrainLMSolver(_grainSize, _n);
+      _solver->SetTolerances(_eps, _iterations);
+
+      for (int i = 0; i < _rawImgs.size(); i++)
+      {
+         unsigned short *ptr = _rawImgs[i].ptr<unsigned short>();
+         for (int j = 0; j < _m; j++)
+         {
+            _data[j * _n + i] = ptr[j];
+         }
+      }
+
+      _initialized = true;
+      return 0;
+   }
+
+   int GPUModel::ReleaseBuffers(void)
+   {
+      mkl_free(_data);
+      mkl_free(_constvec);
+      _data = nullptr;
+      _constvec = nullptr;
+      delete _solver;
+      _solver = nullptr;
+      delete _engine;
+      _engine = nullptr;
+      delete _basis;
+      _basis = nullptr;
+      _initialized = false;
+      return 0;
+   }
+
+   int GPUModel::CalculateConstants(double wavelength, double dOx, double nB, double nOx, double nSi, double *angles)
+   {
+      return CalculateConstants(cpu_model::SingleOxideStack(wavelength, dOx, nB, nOx, nSi), angles);
+   }
+
+   int GPUModel::CalculateConstants(const cpu_model::OpticalStack &stack, const double *angles)
+   {
+      if (!_initialized || cpu_model::CalculateOpticalConstants(stack, angles, _n, _constvec) ||
+         _engine->SetConstants(_constvec))
+         return 1;
+      delete _basis;
+      _basis = new cpu_model::HeightBasis(_n, _constvec, _heightRange[0], _heightRange[1], _heightRange[2]);
+      return 0;
+   }
+
+   int GPUModel::RunFit(void)
+   {
+      if (!_initialized)
+         return 1;
+      std::chrono::high_resolution_clock::time_point earlier, later;
+      std::chrono::duration<double> timeTaken;
+      cpu_model::GridInitializer *init = _gridStart && _basis != nullptr ? new cpu_model::GridInitializer(_basis) : nullptr;
+      unsigned short *grainData = _engine->Data();
+      double *xvec = _engine->XVec();
+      //Run the solver on each grain
+      for (int i = 0; i < _ngrains; i++)
+      {
+         earlier = std::chrono::high_resolution_clock::now();
+         int first = i * _grainSize;
+         int grainPixels = _m - first < _grainSize ? _m - first : _grainSize;
+         memcpy(grainData, _data + (size_t)first * _n, (size_t)grainPixels * _n * sizeof(unsigned short));
+         //Padding pixels repeat the last one, a pixel without data would give
+         //the solver zero Jacobian columns and stop the whole grain
+         for (int p = grainPixels; p < _grainSize; p++)
+            memcpy(grainData + (size_t)p * _n, _data + (size_t)(first + grainPixels - 1) * _n, _n * sizeof(unsigned short));
+         for (int p = 0; p < _grainSize; p++)
+         {
+            xvec[p * 3] = 200;
+            xvec[p * 3 + 1] = 100;
+            xvec[p * 3 + 2] = 6.5;
+         }
+         if (init != nullptr)
+            init->Initialize(grainData, _grainSize, xvec);
+
+         if (_solver->Solve(_engine, nullptr, nullptr))
+         {
+            std::cerr << "Error evaluating grain " << i << std::endl;
+            delete init;
+            return 1;
+         }
+
+         double *aptr, *bptr, *hptr;
+         aptr = _outputImgs[0].ptr<double>() + first;
+         bptr = _outputImgs[1].ptr<double>() + first;
+         hptr = _outputImgs[2].ptr<double>() + first;
+         for (int j = 0; j < grainPixels; j++)
+         {
+            int xidx = j * 3;
+            aptr[j] = xvec[xidx];
+            bptr[j] = xvec[xidx + 1];
+            hptr[j] = xvec[xidx + 2];
+         }
+         later = std::chrono::high_resolution_clock::now();
+         timeTaken = later - earlier;
+         std::cout << "Grain " << i << " of " << _ngrains << " (" << _engine->Name() << ") finished in " <<
+            std::chrono::duration_cast<std::chrono::milliseconds>(timeTaken).count() << " milliseconds." << std::endl;
+      }
+      delete init;
+
+      return 0;
+   }
+}
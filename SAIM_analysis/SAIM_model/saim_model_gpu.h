@@ -40,9 +40,18 @@
 #include <vector>
 #include <opencv2/core/core.hpp>
 
+#include "fit_engine.h"
+
+namespace cpu_model
+{
+   class HeightBasis;
+   struct OpticalStack;
+}
 
 namespace saim_model_gpu
 {
+   class GrainLMSolver;
+
    class GPUModel
    {
    public:
@@ -55,10 +64,32 @@ namespace saim_model_gpu
       int RegisterImages(std::vector<cv::Mat> &input);
 
       /*************************************************************************
-      * @brief Set the size of the fit grain in pixels
+      * @brief Set the size of the fit grain in pixels. A grain needs 34
+      * bytes per pixel and frame.
       *************************************************************************/
       int SetGrainSize(int);
 
+      /*************************************************************************
+      * @brief Selects the backend the grains are evaluated on, and the CUDA
+      * device. Must be set before InitializeBuffers. CUDA is the default in
+      * builds that have it, otherwise the CPU backend.
+      *************************************************************************/
+      int SetBackend(FitBackend backend, int device = 0);
+
+      FitBackend GetBackend(void) const { return _backend; }
+
+      /*************************************************************************
+      * @brief Sets the height grid (nm) used to pick starting points, takes
+      * effect at the next CalculateConstants
+      *************************************************************************/
+      int SetHeightRange(double hMin, double hMax, double hStep);
+
+      /*************************************************************************
+      * @brief Seeds each grain from a search of the height grid (default) or
+      * from fixed starting values
+      *************************************************************************/
+      int SetGridStart(bool);
+
       /*************************************************************************
       * @brief Allocates and initializes the buffers
       *************************************************************************/
@@ -75,42 +106,44 @@ namespace saim_model_gpu
       int CalculateConstants(double wavelength, double dOx, double nb, double nox, double nsi, double *angles);
 
       /*************************************************************************
-      * @brief Runs the fitting algorithm
+      * @brief Fit constants of any layer stack and polarization from the
+      * optical model shared with CPUModel, one angle (radians) per frame
       *************************************************************************/
-      int RunFit(void);
-
-   private:
-      std::vector<cv::Mat> _rawImgs, _outputImgs, _residualImgs;
-      int _m, _n, _blocksPerGrid, _emptyThreads, _emptyPixels, _ngrains, _grainSize{ 256 };
-      bool _initialized;
-      size_t _datasz, _fnsz, _xsz, _jacsz;
-      unsigned short *_h_data, *_d_data;
-      double *_h_xvec, *_d_xvec, *_h_fvec, *_d_fvec, *_h_jvec, *_d_jvec, *_h_constvec, *_d_constvec;
-      _TRNSP_HANDLE_t _solverHandle;
-      MKL_INT _nVars{ 0 };
-      MKL_INT _mPoints{ 0 };
-      MKL_INT _iterations{ 1000 };
-      MKL_INT _stepIterations{ 100 };
-      double _initialStep{ 0.0 };
-      MKL_INT _rciRequest{ 0 };
-      MKL_INT _successful{ 0 };
-      MKL_INT _actualIterations{ 0 };
-      MKL_INT _stopCrit{ 0 };
-      double _initialRes{ 0 }, _finalRes{ 0 };
-      MKL_INT _counter{ 0 };
-      MKL_INT _fitInfo[6];
-      double _eps[6] = { 0.00001, 0.00001, 0.00001, 0.00001, 0.00001, 0.00001 };
+      int CalculateConstants(const cpu_model::OpticalStack &stack, const double *angles);
 
       /*************************************************************************
-      * @brief Calculates the function value at the current xvec
+      * @brief Fits the image grain by grain, the pixels of a grain solved
+      * side by side with their models and Jacobians evaluated by the
+      * backend in one call. The last grain is padded with copies of its last
+      * pixel.
       *************************************************************************/
-      int CalculateFunction(int, int);
+      int RunFit(void);
 
       /*************************************************************************
-      * @brief Calculates the Jacobian value at the current xvec
+      * @brief A, B and H maps (CV_64F) of the last fit
       *************************************************************************/
-      int CalculateJacobian(int, int);
+      std::vector<cv::Mat> GetImages(void) { return _outputImgs; }
 
+   private:
+      std::vector<cv::Mat> _rawImgs, _outputImgs, _residualImgs;
+      int _m, _n, _emptyPixels, _ngrains, _grainSize{ 4096 };
+      bool _initialized;
+      size_t _datasz, _fnsz, _xsz;
+      unsigned short *_data{ nullptr };
+      double *_constvec{ nullptr };
+#ifdef SAIM_WITH_CUDA
+      FitBackend _backend{ FitBackend::BACKEND_CUDA };
+#else
+      FitBackend _backend{ FitBackend::BACKEND_CPU };
+#endif
+      int _device{ 0 };
+      FitEngine *_engine{ nullptr };
+      GrainLMSolver *_solver{ nullptr };
+      int _iterations{ 1000 };
+      double _eps[6] = { 0.00001, 0.00001, 0.00001, 0.00001, 0.00001, 0.00001 };
+      double _heightRange[3]{ 0.0, 300.0, 2.0 };
+      bool _gridStart{ true };
+      cpu_model::HeightBasis *_basis{ nullptr };
    };
 }
 
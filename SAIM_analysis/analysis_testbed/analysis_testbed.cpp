@@ -41,10 +41,51 @@
 #include <opencv2\highgui\highgui.hpp>
 #include <opencv2\imgcodecs\imgcodecs.hpp>
 
+#include "batch_fit.h"
+#include "raw_stack.h"
+#include "run_config.h"
 #include "saim_model_cpu.h"
+#include "stream_fit.h"
+#include "tiff_stack_reader.h"
+#include "tiff_32F_writer.h"
 
 namespace fs = boost::filesystem;
 
+//Pages of the output TIFF, in the order of CPUModel::GetImages
+static const std::vector<std::string> OutputNames{ "A", "B", "H", "stopCrit", "R2", "d", "SNR" };
+
+//Removes flag from anywhere after the file name, the remaining arguments
+//keep their positions
+static bool TakeFlag(int &argc, char **argv, const char *flag)
+{
+   for (int i = 2; i < argc; i++)
+   {
+      if (std::string(argv[i]) != flag)
+         continue;
+      for (int j = i; j < argc - 1; j++)
+         argv[j] = argv[j + 1];
+      argc--;
+      return true;
+   }
+   return false;
+}
+
+//Removes flag and the value after it, like TakeFlag
+static bool TakeOption(int &argc, char **argv, const char *flag, std::string &value)
+{
+   for (int i = 2; i < argc - 1; i++)
+   {
+      if (std::string(argv[i]) != flag)
+         continue;
+      value = argv[i + 1];
+      for (int j = i; j < argc - 2; j++)
+         argv[j] = argv[j + 2];
+      argc -= 2;
+      return true;
+   }
+   return false;
+}
+
 int main(int argc, char **argv)
 {
    if (argc < 2)
@@ -55,140 +96,260 @@ int main(int argc, char **argv)
 
    fs::path inputPath = argv[1];
 
-   std::vector<cv::Mat> imstack;
-   cv::imreadmulti(inputPath.string(), imstack, CV_LOAD_IMAGE_ANYDEPTH);
-
-   int imHeight = imstack[0].rows;
-   int imWidth = imstack[0].cols;
-   int samples = imstack.size();
-   int pixelCount = imHeight * imWidth;
-   unsigned short *data;
-   double *x, *fn, *jac;
-   /*
-   double *angles = new double[samples];
-<<<<<<< HEAD
-   double step = 45.0 / 31.0;
-   double firstAngle = 0;
-
-=======
-   double step = 0.952380952;
-   double firstAngle = step;
-   */
-
-   double linangles[31] = { -39.911025,
--37.25029,
--34.589555,
--31.92882,
--29.268085,
--26.60735,
--23.946615,
--21.28588,
--18.625145,
--15.96441,
--13.303675,
--10.64294,
--7.982205,
--5.32147,
--2.660735,
-0.0,
-2.660735,
-5.32147,
-7.982205,
-10.64294,
-13.303675,
-15.96441,
-18.625145,
-21.28588,
-23.946615,
-26.60735,
-29.268085,
-31.92882,
-34.589555,
-37.25029,
-39.911025,
-   };
-   
-   double angles[31] =
-   { -43.81494106,
-   - 39.98737856,
-   - 36.28932555,
-   - 32.72078203,
-   - 29.281748,
-   - 25.97222346,
-   - 22.79220841,
-   - 19.74170285,
-   - 16.82070678,
-   - 14.02922019,
-   - 11.3672431,
-   - 8.834775503,
-   - 6.431817392,
-   - 4.158368772,
-   - 2.014429641,
-   0.0,
-   2.014429641,
-   4.158368772,
-   6.431817392,
-   8.834775503,
-   11.3672431,
-   14.02922019,
-   16.82070678,
-   19.74170285,
-   22.79220841,
-   25.97222346,
-   29.281748,
-   32.72078203,
-   36.28932555,
-   39.98737856,
-   43.81494106 };
-
-   for (int i = 0; i < 31; i++)
-      linangles[i] = linangles[i] * 2.0 * CV_PI / 360.0;
-
-   /*
->>>>>>> 3519e08061486c7d7904e57dd88568bdbaa23dfd
-   double start = firstAngle * 2.0 * CV_PI / 360.0;
-   for (int i = 0; i < samples; i++)
-      angles[i] = start + i * step * 2.0 * CV_PI / 360.0;
-   */
+   //"--config run.cfg" loads the protocol: angles, optics and solver settings.
+   //Repeat it to layer files, e.g. the control panel's settings for the DAC
+   //calibration under a protocol holding the scan's dac codes
+   cpu_model::RunConfig config;
+   std::string configPath;
+   while (TakeOption(argc, argv, "--config", configPath))
+   {
+      if (config.Load(configPath))
+         return 1;
+   }
 
+   fs::path outputPath = inputPath.parent_path() /= inputPath.stem();
    cpu_model::CPUModel model;
 
-   model.RegisterImages(imstack);
-   model.SetGrainSize(1);
-   model.InitializeBuffers();
-   model.CalculateConstants(560.0, 1910.5, 1.34, 1.463, 4.3638, linangles);
-   model.ParforRunFit();
+   //"--diagnostics" traces every pixel's solve, "--fast-sincos" evaluates the
+   //model with the polynomial sincos kernel, "--auto-grain" times a sample of
+   //the stack at a range of grain sizes before the fit and keeps the fastest
+   bool diagnostics = TakeFlag(argc, argv, "--diagnostics");
+   bool autoGrain = TakeFlag(argc, argv, "--auto-grain");
+   model.SetFastSinCos(TakeFlag(argc, argv, "--fast-sincos"));
+   model.Diagnostics().SetEnabled(diagnostics);
+   model.Diagnostics().SetMaps(diagnostics);
+   if (config.Apply(&model))
+   {
+      std::cerr << "Invalid solver settings in " << configPath;
+      return 1;
+   }
+
+   //"--batch dir|manifest [seconds]" fits many stacks with one model, reading
+   //and writing in the background; with seconds the directory is watched for
+   //new stacks until the process is ended
+   if (std::string(argv[1]) == "--batch" && argc > 2)
+   {
+      cpu_model::BatchFit batch(&model);
+      batch.SetConstants(config.optics, config.angles.data(), config.Frames());
+      int pollSeconds = argc > 3 ? atoi(argv[3]) : 0;
+      int status = fs::is_directory(argv[2]) ? batch.WatchDirectory(argv[2], pollSeconds) :
+         fs::path(argv[2]).extension() == ".txt" ? batch.AddManifest(argv[2]) : batch.AddFile(argv[2]);
+      if (status)
+      {
+         std::cerr << "Could not queue " << argv[2];
+         return 1;
+      }
+      model.SetGrainSize(1);
+      int result = batch.Run();
+      int done, failed;
+      double rate;
+      batch.GetCounts(&done, &failed, &rate);
+      std::cout << done << " stacks fit, " << failed << " failed, " << rate << " stacks/hour" << std::endl;
+      if (diagnostics)
+         model.Diagnostics().Report(std::cout);
+      return result;
+   }
+
+   //"--raw" after a TIFF converts it to a pixel-major stack for quick re-fits
+   if (argc > 2 && std::string(argv[2]) == "--raw")
+   {
+      //The raw header holds a single transparent oxide layer
+      const cpu_model::OpticalStack &optics = config.optics;
+      if (optics.layers.size() != 1 || optics.layers[0].index.imag() != 0.0 || optics.nSubstrate.imag() != 0.0 ||
+         optics.polarization != cpu_model::Polarization::POLARIZATION_TE)
+      {
+         std::cerr << "A raw stack can only carry one transparent oxide layer on a transparent substrate with TE excitation";
+         return 1;
+      }
+      cpu_model::TiffStackReader reader;
+      if (reader.Open(inputPath.string()))
+      {
+         std::cerr << "Could not open " << inputPath.string() << " as a 16 bit stack";
+         return 1;
+      }
+      if (config.CheckFrames(reader.Frames()))
+         return 1;
+      reader.Close();
+      cpu_model::RawStackHeader header{};
+      header.wavelength = optics.wavelength;
+      header.dOx = optics.layers[0].thickness;
+      header.nB = optics.nSample;
+      header.nOx = optics.layers[0].index.real();
+      header.nSi = optics.nSubstrate.real();
+      return cpu_model::RawStack::Convert(inputPath.string(), outputPath.string() + ".sraw", header, config.angles.data());
+   }
+
+   //"--series" fits a looped acquisition timepoint by timepoint into one
+   //(T, param, Y, X) hyperstack, refitting only the pixels that changed
+   if (argc > 2 && std::string(argv[2]) == "--series")
+   {
+      cpu_model::TiffStackReader reader;
+      if (reader.Open(inputPath.string()))
+      {
+         std::cerr << "Could not open " << inputPath.string() << " as a 16 bit stack";
+         return 1;
+      }
+      cpu_model::SeriesFit series(&model, &reader);
+      if (series.SetFramesPerTimepoint(config.Frames()))
+      {
+         std::cerr << "The stack does not hold a whole number of " << config.Frames() << " frame timepoints";
+         return 1;
+      }
+      if (argc > 3)
+         series.SetChangeThreshold(atof(argv[3]));
+      series.SetConstants(config.optics, config.angles.data());
+      tw32f::Tiff32FWriter writer;
+      if (writer.Open(outputPath.string() + "_series.tif", reader.Cols(), reader.Rows(), 7 * series.Timepoints()))
+      {
+         std::cerr << "Could not create " << outputPath.string() << "_series.tif";
+         return 1;
+      }
+      std::vector<std::string> names;
+      for (int t = 0; t < series.Timepoints(); t++)
+      {
+         for (const std::string &name : OutputNames)
+            names.push_back(name + " t" + std::to_string(t));
+      }
+      writer.SetPageNames(names);
+      writer.SetHyperstack(7, series.Timepoints());
+      writer.StartThread();
+      model.SetGrainSize(1);
+      int result = series.Run([&writer, &model](int t, std::vector<cv::Mat> &outputs)
+      {
+         int fit, background, saturated, unchanged;
+         model.GetPixelClasses(&fit, &background, &saturated, &unchanged);
+         std::cout << "Timepoint " << t << ": " << fit << " pixels fit, " << unchanged << " unchanged" << std::endl;
+         return writer.WritePages(7 * t, outputs);
+      });
+      if (diagnostics)
+         model.Diagnostics().Report(std::cout);
+      return writer.Close() || result;
+   }
+
+   //"--stats fit.tif" recomputes R2, d and SNR for the A, B and H pages of an
+   //earlier fit of the stack instead of fitting it
+   bool recompute = argc > 3 && std::string(argv[2]) == "--stats";
+
+   //A band height after the file name streams the stack band by band
+   if (argc > 2 && !recompute)
+   {
+      cpu_model::TiffStackReader reader;
+      if (reader.Open(inputPath.string()))
+      {
+         std::cerr << "Could not open " << inputPath.string() << " as a 16 bit stack";
+         return 1;
+      }
+      if (config.CheckFrames(reader.Frames()))
+         return 1;
+      //Finished bands are written on the writer's thread while the next band fits
+      tw32f::Tiff32FWriter writer;
+      if (writer.Open(outputPath.string() + "_fit.tif", reader.Cols(), reader.Rows(), 7))
+      {
+         std::cerr << "Could not create " << outputPath.string() << "_fit.tif";
+         return 1;
+      }
+      writer.SetPageNames(OutputNames);
+      writer.StartThread();
+      cpu_model::StreamingFit stream(&model, &reader);
+      stream.SetBandRows(atoi(argv[2]));
+      stream.SetConstants(config.optics, config.angles.data());
+      model.SetGrainSize(1);
+      int result = stream.Run([&writer](int firstRow, std::vector<cv::Mat> &band)
+      {
+         return writer.WriteBand(firstRow, band);
+      });
+      if (diagnostics)
+         model.Diagnostics().Report(std::cout);
+      return writer.Close() || result;
+   }
+
+   std::vector<cv::Mat> imstack;
+   cpu_model::RawStack rawStack;
+   if (inputPath.extension() == ".sraw")
+   {
+      //Mapped stacks carry their own angles and constants and are fit in place
+      if (rawStack.Open(inputPath.string()))
+      {
+         std::cerr << "Could not map " << inputPath.string();
+         return 1;
+      }
+      const cpu_model::RawStackHeader &header = rawStack.Header();
+      std::vector<double> angles(rawStack.Angles(), rawStack.Angles() + rawStack.Frames());
+      model.RegisterPixelMajor(rawStack.Data(), rawStack.Rows(), rawStack.Cols(), rawStack.Frames());
+      model.SetGrainSize(1);
+      model.InitializeBuffers();
+      model.CalculateConstants(header.wavelength, header.dOx, header.nB, header.nOx, header.nSi, angles.data());
+   }
+   else
+   {
+      cv::imreadmulti(inputPath.string(), imstack, CV_LOAD_IMAGE_ANYDEPTH);
+      if (imstack.empty() || config.CheckFrames((int)imstack.size()))
+         return 1;
+      model.RegisterImages(imstack);
+      model.SetGrainSize(1);
+      model.InitializeBuffers();
+      model.CalculateConstants(config.optics, config.angles.data());
+   }
+   if (recompute)
+   {
+      std::vector<cv::Mat> fit, stats;
+      if (!cv::imreadmulti(argv[3], fit, CV_LOAD_IMAGE_ANYDEPTH) || fit.size() < 3 ||
+         model.RecomputeStatistics(fit[0], fit[1], fit[2], stats))
+      {
+         std::cerr << "Could not recompute the statistics of " << argv[3];
+         return 1;
+      }
+      tw32f::Tiff32FWriter writer;
+      if (writer.Open(outputPath.string() + "_stats.tif", stats[0].cols, stats[0].rows, 3) ||
+         writer.SetPageNames({ "R2", "d", "SNR" }) || writer.WriteBand(0, stats) || writer.Close())
+      {
+         std::cerr << "Could not write " << outputPath.string() << "_stats.tif";
+         return 1;
+      }
+      return 0;
+   }
+   if (autoGrain)
+   {
+#ifdef SAIM_WITH_TBB
+      double rate;
+      if (model.AutoTuneGrainSize(&rate))
+      {
+         std::cerr << "Could not tune the grain size";
+         return 1;
+      }
+      std::cout << "Grain size " << model.GetGrainSize() << ": " << (int)rate << " pixels/s" << std::endl;
+#else
+      std::cerr << "--auto-grain tunes the TBB fit, this build has none";
+      return 1;
+#endif
+   }
+   model.ParallelRunFit();
    //model.RunFit();
    std::vector<cv::Mat> outputs = model.GetImages();
    model.ReleaseBuffers();
 
-   //Fit A
-   outputs[0].convertTo(outputs[0], CV_16UC1);
-   //Fit B
-   outputs[1].convertTo(outputs[1], CV_16UC1);
-   //Multiply H by 100 to get 2 decimals
-   outputs[2] *= 100;
-   outputs[2].convertTo(outputs[2], CV_16UC1);
-   //Fit stop criteria
-   outputs[3].convertTo(outputs[3], CV_16UC1);
-   //Multiply R2 by 1000 to get 3 decimals
-   outputs[4] *= 1000;
-   outputs[4].convertTo(outputs[4], CV_16UC1);
-   //Multiply d by 1000 to get 3 decimals
-   outputs[5] *= 1000;
-   outputs[5].convertTo(outputs[5], CV_16UC1);
-   //Multiply S/N by 100 to get 2 decimals
-   outputs[6] *= 100;
-   outputs[6].convertTo(outputs[6], CV_16UC1);
+   //All seven maps go into one float32 TIFF at full precision
+   tw32f::Tiff32FWriter writer;
+   if (writer.Open(outputPath.string() + "_fit.tif", outputs[0].cols, outputs[0].rows, 7) ||
+      writer.SetPageNames(OutputNames) || writer.WriteBand(0, outputs) || writer.Close())
+   {
+      std::cerr << "Could not write " << outputPath.string() << "_fit.tif";
+      return 1;
+   }
 
-   fs::path outputPath = inputPath.parent_path() /= inputPath.stem();
-   cv::imwrite(outputPath.string() + "_A.png", outputs[0]);
-   cv::imwrite(outputPath.string() + "_B.png", outputs[1]);
-   cv::imwrite(outputPath.string() + "_H.png", outputs[2]);
-   cv::imwrite(outputPath.string() + "_stopCrit.png", outputs[3]);
-   cv::imwrite(outputPath.string() + "_R2.png", outputs[4]);
-   cv::imwrite(outputPath.string() + "_d.png", outputs[5]);
-   cv::imwrite(outputPath.string() + "_snr.png", outputs[6]);
+   if (diagnostics)
+   {
+      model.Diagnostics().Report(std::cout);
+      std::vector<cv::Mat> maps(2);
+      tw32f::Tiff32FWriter mapWriter;
+      if (model.Diagnostics().GetMaps(maps[0], maps[1]) ||
+         mapWriter.Open(outputPath.string() + "_diagnostics.tif", maps[0].cols, maps[0].rows, 2) ||
+         mapWriter.SetPageNames({ "iterations", "microseconds" }) || mapWriter.WriteBand(0, maps) || mapWriter.Close())
+      {
+         std::cerr << "Could not write " << outputPath.string() << "_diagnostics.tif";
+         return 1;
+      }
+   }
 
    //delete[] angles;
    return 0;
@@ -0,0 +1,385 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#include "batch_fit.h"
+
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+#include <opencv2/core/core.hpp>
+
+#include "tiff_stack_reader.h"
+#include "tiff_32F_writer.h"
+
+namespace fs = boost::filesystem;
+
+namespace cpu_model
+{
+   //Pages of the output TIFF, in the order of CPUModel::GetImages
+   static const std::vector<std::string> MapNames{ "A", "B", "H", "stopCrit", "R2", "d", "SNR" };
+
+   //Suffixes of the files the testbed writes next to a stack
+   static const std::vector<std::string> OutputSuffixes{ "_fit", "_stats", "_series", "_diagnostics" };
+
+   BatchFit::BatchFit(CPUModel *model) :
+      _model(model), _modelReady(false), _pollSeconds(0), _stopping(false),
+      _readerDone(false), _fitDone(false), _done(0), _failed(0) {}
+
+   BatchFit::~BatchFit() {}
+
+   int BatchFit::SetConstants(double wavelength, double dOx, double nB, double nOx, double nSi, const double *angles, int frames)
+   {
+      return SetConstants(SingleOxideStack(wavelength, dOx, nB, nOx, nSi), angles, frames);
+   }
+
+   int BatchFit::SetConstants(const OpticalStack &stack, const double *angles, int frames)
+   {
+      if (frames < 1)
+         return 1;
+      _optics = stack;
+      _angles.assign(angles, angles + frames);
+      return 0;
+   }
+
+   int BatchFit::SetOutputDirectory(const std::string &dir)
+   {
+      boost::system::error_code error;
+      if (!dir.empty() && !fs::is_directory(dir, error))
+         return 1;
+      _outputDir = dir;
+      return 0;
+   }
+
+   int BatchFit::AddFile(const std::string &path)
+   {
+      std::lock_guard<std::mutex> lock(_fileLock);
+      if (!_seen.insert(path).second)
+         return 0;
+      _files.push_back(path);
+      _fileQueued.notify_all();
+      return 0;
+   }
+
+   int BatchFit::AddManifest(const std::string &path)
+   {
+      std::ifstream manifest(path);
+      if (!manifest)
+         return 1;
+      fs::path base = fs::path(path).parent_path();
+      std::string line;
+      while (std::getline(manifest, line))
+      {
+         //Trailing whitespace and Windows line ends
+         size_t end = line.find_last_not_of(" \t\r");
+         if (end == std::string::npos || line[0] == '#')
+            continue;
+         fs::path file = line.substr(0, end + 1);
+         if (file.is_relative())
+            file = base / file;
+         AddFile(file.string());
+      }
+      return 0;
+   }
+
+   int BatchFit::WatchDirectory(const std::string &dir, int pollSeconds)
+   {
+      boost::system::error_code error;
+      if (!fs::is_directory(dir, error))
+         return 1;
+      std::lock_guard<std::mutex> lock(_fileLock);
+      _watchDir = dir;
+      _pollSeconds = pollSeconds > 0 ? pollSeconds : 0;
+      //A one-off scan takes everything, polling waits for sizes to settle
+      ScanDirectory(_pollSeconds > 0);
+      return 0;
+   }
+
+   void BatchFit::ScanDirectory(bool stable)
+   {
+      boost::system::error_code error;
+      for (fs::directory_iterator it(_watchDir, error), end; !error && it != end; it.increment(error))
+      {
+         const fs::path &file = it->path();
+         std::string ext = file.extension().string();
+         if ((ext != ".tif" && ext != ".tiff") || !fs::is_regular_file(file, error))
+            continue;
+         std::string path = file.string();
+         if (_seen.count(path) != 0)
+            continue;
+         std::string stem = file.stem().string();
+         bool output = false;
+         for (const std::string &suffix : OutputSuffixes)
+         {
+            output |= stem.size() > suffix.size() &&
+               stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0;
+         }
+         if (output || fs::exists(OutputPath(path), error))
+         {
+            _seen.insert(path);
+            continue;
+         }
+         uintmax_t size = fs::file_size(file, error);
+         if (error)
+            continue;
+         if (stable)
+         {
+            auto pending = _pending.begin();
+            while (pending != _pending.end() && pending->first != path)
+               pending++;
+            if (pending == _pending.end())
+            {
+               _pending.push_back({ path, size });
+               continue;
+            }
+            if (pending->second != size)
+            {
+               pending->second = size;
+               continue;
+            }
+            _pending.erase(pending);
+         }
+         _seen.insert(path);
+         _files.push_back(path);
+      }
+   }
+
+   std::string BatchFit::OutputPath(const std::string &path) const
+   {
+      fs::path input = path;
+      fs::path dir = _outputDir.empty() ? input.parent_path() : fs::path(_outputDir);
+      return (dir / (input.stem().string() + "_fit.tif")).string();
+   }
+
+   bool BatchFit::NextFile(std::string &path)
+   {
+      std::unique_lock<std::mutex> lock(_fileLock);
+      while (!_stopping)
+      {
+         if (!_files.empty())
+         {
+            path = _files.front();
+            _files.pop_front();
+            return true;
+         }
+         if (_pollSeconds <= 0)
+            return false;
+         _fileQueued.wait_for(lock, std::chrono::seconds(_pollSeconds));
+         if (_files.empty() && !_stopping)
+            ScanDirectory(true);
+      }
+      return false;
+   }
+
+   void BatchFit::ReaderLoop(void)
+   {
+      TiffStackReader reader;
+      std::string path;
+      while (NextFile(path))
+      {
+         InputSlot *slot;
+         {
+            std::unique_lock<std::mutex> lock(_slotLock);
+            _slotChanged.wait(lock, [this] { return !_freeInputs.empty(); });
+            slot = _freeInputs.front();
+            _freeInputs.pop_front();
+         }
+         slot->path = path;
+         //Decoded into the slot's pages, which keep their buffers between
+         //stacks of the same size
+         int status = reader.Open(path) || reader.Frames() != (int)_angles.size() ||
+            reader.ReadPages(0, reader.Frames(), slot->stack);
+         reader.Close();
+         std::lock_guard<std::mutex> lock(_slotLock);
+         if (status)
+         {
+            std::cerr << "Could not read " << path << " as a 16 bit stack of " << _angles.size() << " frames" << std::endl;
+            _failed++;
+            _freeInputs.push_back(slot);
+         }
+         else
+            _readInputs.push_back(slot);
+         _slotChanged.notify_all();
+      }
+      std::lock_guard<std::mutex> lock(_slotLock);
+      _readerDone = true;
+      _slotChanged.notify_all();
+   }
+
+   void BatchFit::WriterLoop(void)
+   {
+      while (true)
+      {
+         OutputSlot *slot;
+         {
+            std::unique_lock<std::mutex> lock(_slotLock);
+            _slotChanged.wait(lock, [this] { return !_fitOutputs.empty() || _fitDone; });
+            if (_fitOutputs.empty())
+               break;
+            slot = _fitOutputs.front();
+            _fitOutputs.pop_front();
+         }
+         std::string path = OutputPath(slot->path);
+         tw32f::Tiff32FWriter writer;
+         if (writer.Open(path, slot->maps[0].cols, slot->maps[0].rows, 7) ||
+            writer.SetPageNames(MapNames) || writer.WriteBand(0, slot->maps) || writer.Close())
+         {
+            std::cerr << "Could not write " << path << std::endl;
+            _failed++;
+         }
+         else
+         {
+            _done++;
+            int done, failed;
+            double rate;
+            GetCounts(&done, &failed, &rate);
+            std::cout << slot->path << " fit in " << slot->fitSeconds << " s, " << done << " done, " <<
+               failed << " failed, " << rate << " stacks/hour" << std::endl;
+         }
+         std::lock_guard<std::mutex> lock(_slotLock);
+         _freeOutputs.push_back(slot);
+         _slotChanged.notify_all();
+      }
+   }
+
+   int BatchFit::Fit(InputSlot *in, OutputSlot *out)
+   {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      //Every stack after the first only swaps its frames into the model
+      if (!_modelReady)
+      {
+         _model->RegisterImages(in->stack);
+         if (_model->InitializeBuffers())
+            return 1;
+         if (_model->CalculateConstants(_optics, _angles.data()))
+         {
+            _model->ReleaseBuffers();
+            return 1;
+         }
+         _modelReady = true;
+      }
+      else if (_model->UpdateImages(in->stack))
+      {
+         _model->ReleaseBuffers();
+         _modelReady = false;
+         return 1;
+      }
+      if (_model->ParallelRunFit())
+         return 1;
+      //The model clears its maps for the next stack, the writer gets copies
+      std::vector<cv::Mat> maps = _model->GetImages();
+      out->maps.resize(maps.size());
+      for (size_t i = 0; i < maps.size(); i++)
+         maps[i].copyTo(out->maps[i]);
+      out->path = in->path;
+      out->fitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      return 0;
+   }
+
+   int BatchFit::Run(void)
+   {
+      if (_angles.empty())
+         return 1;
+      _stopping = false;
+      _readerDone = _fitDone = false;
+      _done = _failed = 0;
+      _freeInputs.assign({ &_inputs[0], &_inputs[1] });
+      _freeOutputs.assign({ &_outputs[0], &_outputs[1] });
+      _readInputs.clear();
+      _fitOutputs.clear();
+      _start = std::chrono::steady_clock::now();
+
+      std::thread reader(&BatchFit::ReaderLoop, this);
+      std::thread writer(&BatchFit::WriterLoop, this);
+      while (true)
+      {
+         InputSlot *in;
+         OutputSlot *out;
+         {
+            std::unique_lock<std::mutex> lock(_slotLock);
+            _slotChanged.wait(lock, [this] { return !_readInputs.empty() || _readerDone; });
+            if (_readInputs.empty())
+               break;
+            in = _readInputs.front();
+            _readInputs.pop_front();
+            _slotChanged.wait(lock, [this] { return !_freeOutputs.empty(); });
+            out = _freeOutputs.front();
+            _freeOutputs.pop_front();
+         }
+         int status = Fit(in, out);
+         if (status)
+            std::cerr << "Could not fit " << in->path << std::endl;
+         std::lock_guard<std::mutex> lock(_slotLock);
+         _freeInputs.push_back(in);
+         if (status)
+         {
+            _failed++;
+            _freeOutputs.push_back(out);
+         }
+         else
+            _fitOutputs.push_back(out);
+         _slotChanged.notify_all();
+      }
+      {
+         std::lock_guard<std::mutex> lock(_slotLock);
+         _fitDone = true;
+         _slotChanged.notify_all();
+      }
+      reader.join();
+      writer.join();
+      if (_modelReady)
+      {
+         _model->ReleaseBuffers();
+         _modelReady = false;
+      }
+      return _failed > 0;
+   }
+
+   void BatchFit::Stop(void)
+   {
+      std::lock_guard<std::mutex> lock(_fileLock);
+      _stopping = true;
+      _fileQueued.notify_all();
+   }
+
+   void BatchFit::GetCounts(int *done, int *failed, double *stacksPerHour) const
+   {
+      double hours = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count() / 3600.0;
+      *done = _done;
+      *failed = _failed;
+      *stacksPerHour = hours > 0.0 ? _done / hours : 0.0;
+   }
+}
@@ -0,0 +1,177 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#ifndef BATCH_FIT_H
+#define BATCH_FIT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "optical_model.h"
+#include "saim_model_cpu.h"
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Fits a queue of whole stacks with one model, reading the next stack
+   * and writing the last one's maps while the current one fits.
+   *
+   * A reader thread decodes stacks into two recycled input slots, the calling
+   * thread fits them one after another with ParallelRunFit, and a writer
+   * thread stores each stack's seven maps as <stem>_fit.tif from two recycled
+   * output slots. The model's buffers, constants and height basis and the fit
+   * threads are set up once and kept for every stack with the same frame
+   * count, so a stack costs only its read, fit and write. Stacks come from
+   * AddFile, a manifest or a watched directory.
+   ****************************************************************************/
+   class BatchFit
+   {
+   public:
+      /*************************************************************************
+      * @brief The model's solver and start settings are used as they are, the
+      * model must outlive the fit
+      *************************************************************************/
+      BatchFit(CPUModel *model);
+      ~BatchFit();
+
+      /**Optics and the angle of each frame, stacks of other frame counts fail*/
+      int SetConstants(double wavelength, double dOx, double nB, double nOx, double nSi, const double *angles, int frames);
+      int SetConstants(const OpticalStack &stack, const double *angles, int frames);
+
+      /*************************************************************************
+      * @brief Directory the maps are written to, empty (default) writes them
+      * next to each stack
+      *************************************************************************/
+      int SetOutputDirectory(const std::string &dir);
+
+      /**Queues one stack*/
+      int AddFile(const std::string &path);
+
+      /*************************************************************************
+      * @brief Queues the stacks listed in a text file, one path per line.
+      * Relative paths are taken from the manifest's directory, blank lines
+      * and lines starting with # are skipped.
+      *************************************************************************/
+      int AddManifest(const std::string &path);
+
+      /*************************************************************************
+      * @brief Queues the .tif stacks of a directory that have no _fit.tif yet.
+      * With pollSeconds > 0 Run keeps polling it for new stacks until Stop,
+      * a stack is taken once its size holds still between two polls so files
+      * still being copied in are left alone.
+      *************************************************************************/
+      int WatchDirectory(const std::string &dir, int pollSeconds = 0);
+
+      /*************************************************************************
+      * @brief Fits every queued stack, and with a polled directory keeps
+      * going until Stop. Returns nonzero if any stack failed.
+      *************************************************************************/
+      int Run(void);
+
+      /**Ends Run once the stacks already read are written, from any thread*/
+      void Stop(void);
+
+      /*************************************************************************
+      * @brief Stacks written and failed so far and the throughput since Run
+      * started, in stacks per hour
+      *************************************************************************/
+      void GetCounts(int *done, int *failed, double *stacksPerHour) const;
+
+   private:
+      BatchFit(const BatchFit &) = delete;
+      BatchFit &operator=(const BatchFit &) = delete;
+
+      struct InputSlot
+      {
+         std::string path;
+         std::vector<cv::Mat> stack;   //CV_16U pages, reused between stacks
+      };
+
+      struct OutputSlot
+      {
+         std::string path;
+         std::vector<cv::Mat> maps;    //copies of the model's outputs
+         double fitSeconds;
+      };
+
+      //Blocks until a stack is queued or the queue is finished, false at the end
+      bool NextFile(std::string &path);
+      //Queues the unfitted .tif files of the watched directory, with stable
+      //only those whose size has not changed since the last poll
+      void ScanDirectory(bool stable);
+      std::string OutputPath(const std::string &path) const;
+
+      void ReaderLoop(void);
+      void WriterLoop(void);
+      //Fits the slot's stack and copies the maps into out
+      int Fit(InputSlot *in, OutputSlot *out);
+
+      CPUModel *_model;
+      bool _modelReady;
+      OpticalStack _optics;
+      std::vector<double> _angles;
+      std::string _outputDir;
+
+      std::mutex _fileLock;
+      std::condition_variable _fileQueued;
+      std::deque<std::string> _files;
+      std::set<std::string> _seen;
+      std::vector<std::pair<std::string, uintmax_t>> _pending;   //watched files and their last size
+      std::string _watchDir;
+      int _pollSeconds;
+      std::atomic<bool> _stopping;
+
+      //Free and filled slots, handed between the three stages
+      std::mutex _slotLock;
+      std::condition_variable _slotChanged;
+      std::deque<InputSlot *> _freeInputs, _readInputs;
+      std::deque<OutputSlot *> _freeOutputs, _fitOutputs;
+      bool _readerDone, _fitDone;
+      InputSlot _inputs[2];
+      OutputSlot _outputs[2];
+
+      std::atomic<int> _done, _failed;
+      std::chrono::steady_clock::time_point _start;
+   };
+}
+
+#endif //BATCH_FIT_H
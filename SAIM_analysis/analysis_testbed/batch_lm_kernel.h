@@ -0,0 +1,284 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef BATCH_LM_KERNEL_H
+#define BATCH_LM_KERNEL_H
+
+//Namespace of the build, set by the batch_lm_kernel_<level>.cpp including
+//this file
+#ifndef SAIM_LM_ISA
+#error SAIM_LM_ISA must name the instruction set namespace
+#endif
+
+#include "batch_lm_solver.h"
+#include "lm_step.h"
+
+#include <cmath>
+#include <mkl.h>
+
+namespace cpu_model
+{
+   namespace SAIM_LM_ISA
+   {
+      /*************************************************************************
+      * @brief BatchLMSolverT with W lanes, for the instruction set the
+      * including file is compiled for.
+      *
+      * Each build gets its own namespace, and lm_step.h has internal linkage,
+      * so no out-of-line function is shared between builds and the linker
+      * cannot hand an AVX-512 copy to a baseline caller.
+      *************************************************************************/
+      template <typename Real, int W>
+      class BatchLMKernelW : public BatchLMKernel<Real>
+      {
+      public:
+         BatchLMKernelW(int frames, const double *constvec);
+         ~BatchLMKernelW();
+
+         void SetTolerances(const double *eps, int iterations);
+         int Solve(const unsigned short *const *pixels, int count, double *xvec, double *fvec, int *stopCrit,
+            int *iterations);
+
+      private:
+         BatchLMKernelW(const BatchLMKernelW &) = delete;
+         BatchLMKernelW &operator=(const BatchLMKernelW &) = delete;
+
+         //Evaluates ||F||^2, J'F and J'J (upper triangle) at the lane parameters
+         void Accumulate(const double *A, const double *B, const double *H, double *cost, double *grad, double *hess) const;
+
+         int _n;
+         int _maxIterations{ 1000 };
+         double _eps[6]{ 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001 };
+         Real *_data;         //frames x lanes
+         double *_twoC;       //2 * Re(rTE) per frame
+         double *_twoD;       //2 * Im(rTE) per frame
+         double *_offset;     //1 + |rTE|^2 per frame
+         double *_phi;        //phase factor per frame
+         Real *_kernel;       //the four above in Real, same layout
+      };
+
+      template <typename Real, int W>
+      BatchLMKernelW<Real, W>::BatchLMKernelW(int frames, const double *constvec) : _n(frames)
+      {
+         _data = (Real *)mkl_malloc(_n * W * sizeof(Real), 64);
+         _twoC = (double *)mkl_malloc(_n * 4 * sizeof(double), 64);
+         _twoD = _twoC + _n;
+         _offset = _twoD + _n;
+         _phi = _offset + _n;
+         _kernel = (Real *)mkl_malloc(_n * 4 * sizeof(Real), 64);
+         for (int i = 0; i < _n; i++)
+         {
+            double c{ constvec[3 * i] }, d{ constvec[3 * i + 1] };
+            _twoC[i] = 2.0 * c;
+            _twoD[i] = 2.0 * d;
+            _offset[i] = 1.0 + c * c + d * d;
+            _phi[i] = constvec[3 * i + 2];
+         }
+         //The four per-frame arrays are contiguous from _twoC
+         for (int i = 0; i < _n * 4; i++)
+            _kernel[i] = (Real)_twoC[i];
+      }
+
+      template <typename Real, int W>
+      BatchLMKernelW<Real, W>::~BatchLMKernelW()
+      {
+         mkl_free(_data);
+         mkl_free(_twoC);
+         mkl_free(_kernel);
+      }
+
+      template <typename Real, int W>
+      void BatchLMKernelW<Real, W>::SetTolerances(const double *eps, int iterations)
+      {
+         for (int i = 0; i < 6; i++)
+            _eps[i] = eps[i];
+         _maxIterations = iterations;
+      }
+
+      template <typename Real, int W>
+      void BatchLMKernelW<Real, W>::Accumulate(const double *A, const double *B, const double *H, double *cost, double *grad, double *hess) const
+      {
+         Real a[W], b[W], h[W], c[W], g[3 * W], m[6 * W];
+         for (int l = 0; l < W; l++)
+         {
+            a[l] = (Real)A[l];
+            b[l] = (Real)B[l];
+            h[l] = (Real)H[l];
+            c[l] = 0;
+            for (int k = 0; k < 3; k++)
+               g[k * W + l] = 0;
+            for (int k = 0; k < 6; k++)
+               m[k * W + l] = 0;
+         }
+         const Real *twoCs = _kernel, *twoDs = _kernel + _n, *offsets = _kernel + 2 * _n, *phis = _kernel + 3 * _n;
+         for (int i = 0; i < _n; i++)
+         {
+            const Real twoC{ twoCs[i] }, twoD{ twoDs[i] }, offset{ offsets[i] }, phi{ phis[i] };
+            const Real *y = _data + i * W;
+   #pragma omp simd
+            for (int l = 0; l < W; l++)
+            {
+               Real cosv = std::cos(phi * h[l]);
+               Real sinv = std::sin(phi * h[l]);
+               Real shape = offset + twoC * cosv - twoD * sinv;
+               Real r = y[l] - (a[l] * shape + b[l]);
+               //dF/dA = -shape, dF/dB = -1, dF/dH = 2 * A * phi * (c * sin + d * cos)
+               Real jA = -shape;
+               Real jH = a[l] * phi * (twoC * sinv + twoD * cosv);
+               c[l] += r * r;
+               g[l] += jA * r;
+               g[W + l] -= r;
+               g[2 * W + l] += jH * r;
+               m[l] += jA * jA;
+               m[W + l] -= jA;
+               m[2 * W + l] += jA * jH;
+               m[3 * W + l] += 1;
+               m[4 * W + l] -= jH;
+               m[5 * W + l] += jH * jH;
+            }
+         }
+         for (int l = 0; l < W; l++)
+         {
+            cost[l] = c[l];
+            for (int k = 0; k < 3; k++)
+               grad[k * W + l] = g[k * W + l];
+            for (int k = 0; k < 6; k++)
+               hess[k * W + l] = m[k * W + l];
+         }
+      }
+
+      template <typename Real, int W>
+      int BatchLMKernelW<Real, W>::Solve(const unsigned short *const *pixels, int count, double *xvec, double *fvec, int *stopCrit, int *iterations)
+      {
+         if (count < 1 || count > W)
+            return 1;
+
+         double x[3 * W], cost[W], grad[3 * W], hess[6 * W];
+         double tx[3 * W], tcost[W], tgrad[3 * W], thess[6 * W];
+         double lambda[W], nu[W], pred[W];
+         int active[W], stop[W], iters[W];
+
+         //Unused lanes repeat the first pixel and are retired immediately
+         for (int l = 0; l < W; l++)
+         {
+            int src = l < count ? l : 0;
+            const unsigned short *pixel = pixels[src];
+            for (int i = 0; i < _n; i++)
+               _data[i * W + l] = (Real)pixel[i];
+            for (int k = 0; k < 3; k++)
+               x[k * W + l] = xvec[src * 3 + k];
+            active[l] = l < count;
+            stop[l] = 0;
+            iters[l] = 0;
+         }
+
+         Accumulate(x, x + W, x + 2 * W, cost, grad, hess);
+         for (int l = 0; l < W; l++)
+         {
+            lambda[l] = 0.001;
+            nu[l] = 2.0;
+            if (!active[l])
+               continue;
+            stop[l] = LMStartStop(cost[l], hess + l, W, _eps);
+            active[l] = stop[l] == 0;
+         }
+
+         for (int iter = 0; iter < _maxIterations; iter++)
+         {
+            int running = 0;
+            for (int l = 0; l < W; l++)
+            {
+               double step[3];
+               bool solved = LMStep(grad + l, hess + l, W, lambda[l], step, &pred[l]);
+               tx[l] = x[l] + step[0];
+               tx[W + l] = x[W + l] + step[1];
+               tx[2 * W + l] = x[2 * W + l] + step[2];
+
+               if (!active[l])
+                  continue;
+               iters[l]++;
+               //A broken down factorization leaves x as the trial point, which
+               //is rejected
+               if (solved)
+                  stop[l] = LMStepStop(step, cost[l], pred[l], _eps);
+               active[l] = stop[l] == 0;
+               running += active[l];
+            }
+            if (running == 0)
+               break;
+
+            Accumulate(tx, tx + W, tx + 2 * W, tcost, tgrad, thess);
+            for (int l = 0; l < W; l++)
+            {
+               if (!active[l])
+                  continue;
+               if (LMAccept(cost[l], tcost[l], pred[l], _eps, &lambda[l], &nu[l], &stop[l]))
+               {
+                  for (int k = 0; k < 3; k++)
+                  {
+                     x[k * W + l] = tx[k * W + l];
+                     grad[k * W + l] = tgrad[k * W + l];
+                  }
+                  for (int k = 0; k < 6; k++)
+                     hess[k * W + l] = thess[k * W + l];
+                  cost[l] = tcost[l];
+               }
+               active[l] = stop[l] == 0;
+            }
+         }
+
+         //Residual at the solution for the post-fit statistics
+         for (int i = 0; i < _n; i++)
+         {
+            const double twoC{ _twoC[i] }, twoD{ _twoD[i] }, offset{ _offset[i] }, phi{ _phi[i] };
+            const Real *y = _data + i * W;
+            for (int l = 0; l < count; l++)
+            {
+               double shape = offset + twoC * cos(phi * x[2 * W + l]) - twoD * sin(phi * x[2 * W + l]);
+               fvec[l * _n + i] = y[l] - (x[l] * shape + x[W + l]);
+            }
+         }
+         for (int l = 0; l < count; l++)
+         {
+            for (int k = 0; k < 3; k++)
+               xvec[l * 3 + k] = x[k * W + l];
+            stopCrit[l] = stop[l] == 0 ? 1 : stop[l];
+            iterations[l] = iters[l];
+         }
+         return 0;
+      }
+   }
+}
+
+#endif //BATCH_LM_KERNEL_H
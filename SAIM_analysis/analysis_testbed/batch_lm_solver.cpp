@@ -0,0 +1,89 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "batch_lm_solver.h"
+
+namespace cpu_model
+{
+   template <typename Real>
+   BatchLMKernel<Real>::BatchLMKernel()
+   {
+   }
+
+   template <typename Real>
+   BatchLMKernel<Real>::~BatchLMKernel()
+   {
+   }
+
+   template <typename Real>
+   BatchLMSolverT<Real>::BatchLMSolverT(int frames, const double *constvec, SimdLevel level) : _lanes(LanesFor(level))
+   {
+      switch (level)
+      {
+      case SimdLevel::SIMD_AVX512:
+         _kernel = CreateAvx512LMKernel<Real>(frames, constvec);
+         break;
+      case SimdLevel::SIMD_AVX2:
+         _kernel = CreateAvx2LMKernel<Real>(frames, constvec);
+         break;
+      default:
+         _kernel = CreateScalarLMKernel<Real>(frames, constvec);
+         break;
+      }
+   }
+
+   template <typename Real>
+   BatchLMSolverT<Real>::~BatchLMSolverT()
+   {
+      delete _kernel;
+   }
+
+   template <typename Real>
+   void BatchLMSolverT<Real>::SetTolerances(const double *eps, int iterations)
+   {
+      _kernel->SetTolerances(eps, iterations);
+   }
+
+   template <typename Real>
+   int BatchLMSolverT<Real>::Solve(const unsigned short *const *pixels, int count, double *xvec, double *fvec, int *stopCrit,
+      int *iterations)
+   {
+      return _kernel->Solve(pixels, count, xvec, fvec, stopCrit, iterations);
+   }
+
+   template class BatchLMKernel<double>;
+   template class BatchLMKernel<float>;
+   template class BatchLMSolverT<double>;
+   template class BatchLMSolverT<float>;
+}
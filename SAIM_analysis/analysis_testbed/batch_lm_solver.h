@@ -0,0 +1,163 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef BATCH_LM_SOLVER_H
+#define BATCH_LM_SOLVER_H
+
+#include "simd_level.h"
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief One instruction set build of the batched solver, see
+   * BatchLMSolverT for the interface
+   ****************************************************************************/
+   template <typename Real>
+   class BatchLMKernel
+   {
+   public:
+      BatchLMKernel();
+      virtual ~BatchLMKernel();
+
+      virtual void SetTolerances(const double *eps, int iterations) = 0;
+      virtual int Solve(const unsigned short *const *pixels, int count, double *xvec, double *fvec, int *stopCrit,
+         int *iterations) = 0;
+   };
+
+   //Instantiated in batch_lm_solver.cpp, at the baseline instruction set
+   extern template class BatchLMKernel<double>;
+   extern template class BatchLMKernel<float>;
+
+   /*************************************************************************
+   * @brief A new solver build for frames frames. Defined in
+   * batch_lm_kernel_<level>.cpp, each compiled for its instruction set.
+   *************************************************************************/
+   template <typename Real>
+   BatchLMKernel<Real> *CreateScalarLMKernel(int frames, const double *constvec);
+   template <typename Real>
+   BatchLMKernel<Real> *CreateAvx2LMKernel(int frames, const double *constvec);
+   template <typename Real>
+   BatchLMKernel<Real> *CreateAvx512LMKernel(int frames, const double *constvec);
+
+   /****************************************************************************
+   * @brief Levenberg-Marquardt solver for the 3 parameter SAIM model that fits
+   * several pixels at once, one per SIMD lane.
+   *
+   * The normal equations are accumulated on the fly while the model is
+   * evaluated, so no Jacobian is stored and there is no per-pixel setup cost.
+   * Stop criteria are reported with the same codes as dtrnlsp_get:
+   *    1 - iteration limit reached
+   *    2 - damping grew past 1 / eps[0] (trust region collapsed)
+   *    3 - ||F(x)|| < eps[1]
+   *    4 - a Jacobian column norm < eps[2]
+   *    5 - ||s|| < eps[3]
+   *    6 - ||F(x)|| - ||F(x) + J(x)s|| < eps[4]
+   *
+   * Real is the type the model, its Jacobian and the normal equations are
+   * evaluated in. The damped step is always solved in double, as are the
+   * residuals handed back for the post-fit statistics.
+   *
+   * The lane loops are written so the compiler maps one lane to one value in
+   * a vector register. The solver is built once per SimdLevel, with as many
+   * lanes as that level's registers hold, and the constructor picks the
+   * build, by default the widest the CPU runs. The builds differ only in how
+   * many pixels share a Solve call; each pixel's arithmetic is the same.
+   ****************************************************************************/
+   template <typename Real>
+   class BatchLMSolverT
+   {
+   public:
+      /*************************************************************************
+      * @brief Pixels per Solve call of the build for level
+      *************************************************************************/
+      static constexpr int LanesFor(SimdLevel level)
+      {
+         return SimdDoubleLanes(level) * (int)(sizeof(double) / sizeof(Real));
+      }
+
+      //Lanes of the widest build, for sizing per-lane arrays of callers
+      static const int MaxLanes = LanesFor(SimdLevel::SIMD_AVX512);
+
+      /*************************************************************************
+      * @brief Sets up the solver for a stack of frames
+      * @param frames Number of frames per pixel
+      * @param constvec The (rTE real, rTE imag, phi) triplet for each frame
+      * @param level Build to run, at most DetectSimdLevel()
+      *************************************************************************/
+      BatchLMSolverT(int frames, const double *constvec, SimdLevel level = DetectSimdLevel());
+      ~BatchLMSolverT();
+
+      /*************************************************************************
+      * @brief Pixels per Solve call, LanesFor the level the solver was built
+      * with
+      *************************************************************************/
+      int Lanes(void) const { return _lanes; }
+
+      /*************************************************************************
+      * @brief Sets the stop tolerances (6 values, same order as dtrnlsp) and
+      * the iteration limit
+      *************************************************************************/
+      void SetTolerances(const double *eps, int iterations);
+
+      /*************************************************************************
+      * @brief Fits up to Lanes() pixels
+      * @param pixels Pointer to the frames of each pixel
+      * @param count Number of valid entries in pixels, at most Lanes()
+      * @param xvec In: initial (A, B, H) of each pixel. Out: the fit result
+      * @param fvec Out: residual (data - model) of each pixel, frames apart
+      * @param stopCrit Out: stop criterion of each pixel
+      * @param iterations Out: number of iterations used by each pixel
+      *************************************************************************/
+      int Solve(const unsigned short *const *pixels, int count, double *xvec, double *fvec, int *stopCrit, int *iterations);
+
+   private:
+      BatchLMSolverT(const BatchLMSolverT &) = delete;
+      BatchLMSolverT &operator=(const BatchLMSolverT &) = delete;
+
+      BatchLMKernel<Real> *_kernel;
+      int _lanes;
+   };
+
+   typedef BatchLMSolverT<double> BatchLMSolver;
+
+   /****************************************************************************
+   * @brief Single precision solver, twice the lanes of BatchLMSolver. Float
+   * rounding limits how close it gets to the optimum, so it needs looser
+   * tolerances and the pixels it cannot converge are polished with
+   * BatchLMSolver by the model.
+   ****************************************************************************/
+   typedef BatchLMSolverT<float> FloatLMSolver;
+}
+
+#endif //BATCH_LM_SOLVER_H
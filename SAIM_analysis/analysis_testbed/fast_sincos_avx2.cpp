@@ -0,0 +1,93 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+//Compiled for AVX2 with FMA contraction off, which would otherwise make the
+//results differ from the baseline scalar version. Only intrinsics here, no
+//inline functions shared with the baseline files.
+#include "fast_sincos.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace cpu_model
+{
+   namespace sincos_detail
+   {
+      int FastSinCosAvx2(const double *x, double *s, double *c, int first, int n)
+      {
+         int i = first;
+#if defined(__AVX2__)
+         const __m256d signBit = _mm256_set1_pd(-0.0), limit = _mm256_set1_pd(FastSinCosLimit);
+         const __m256d one = _mm256_set1_pd(1.0), half = _mm256_set1_pd(0.5);
+         for (; i + 4 <= n; i += 4)
+         {
+            __m256d vx = _mm256_loadu_pd(x + i);
+            //Any lane out of range sends the group back to the scalar path
+            if (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(signBit, vx), limit, _CMP_LE_OQ)) != 0xF)
+               return i;
+            //Same operations in the same order as the scalar version, no FMA
+            __m256d k = _mm256_round_pd(_mm256_mul_pd(vx, _mm256_set1_pd(TwoOverPi)),
+               _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            __m256d r = _mm256_sub_pd(vx, _mm256_mul_pd(k, _mm256_set1_pd(PiOver2[0])));
+            r = _mm256_sub_pd(r, _mm256_mul_pd(k, _mm256_set1_pd(PiOver2[1])));
+            r = _mm256_sub_pd(r, _mm256_mul_pd(k, _mm256_set1_pd(PiOver2[2])));
+            __m256d z = _mm256_mul_pd(r, r);
+
+            __m256d p = _mm256_set1_pd(Sin[5]);
+            for (int t = 4; t >= 0; t--)
+               p = _mm256_add_pd(_mm256_set1_pd(Sin[t]), _mm256_mul_pd(z, p));
+            __m256d sinr = _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(r, z), p));
+            p = _mm256_set1_pd(Cos[5]);
+            for (int t = 4; t >= 0; t--)
+               p = _mm256_add_pd(_mm256_set1_pd(Cos[t]), _mm256_mul_pd(z, p));
+            __m256d cosr = _mm256_add_pd(_mm256_sub_pd(one, _mm256_mul_pd(half, z)),
+               _mm256_mul_pd(_mm256_mul_pd(z, z), p));
+
+            //Quadrant k mod 4 as 64-bit lane masks
+            __m256i quadrant = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k));
+            __m256i swap = _mm256_cmpeq_epi64(_mm256_and_si256(quadrant, _mm256_set1_epi64x(1)), _mm256_set1_epi64x(1));
+            __m256i sinSign = _mm256_slli_epi64(_mm256_and_si256(quadrant, _mm256_set1_epi64x(2)), 62);
+            __m256i cosSign = _mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(quadrant, _mm256_set1_epi64x(1)),
+               _mm256_set1_epi64x(2)), 62);
+            __m256d sinv = _mm256_blendv_pd(sinr, cosr, _mm256_castsi256_pd(swap));
+            __m256d cosv = _mm256_blendv_pd(cosr, sinr, _mm256_castsi256_pd(swap));
+            _mm256_storeu_pd(s + i, _mm256_xor_pd(sinv, _mm256_castsi256_pd(sinSign)));
+            _mm256_storeu_pd(c + i, _mm256_xor_pd(cosv, _mm256_castsi256_pd(cosSign)));
+         }
+#endif
+         return i;
+      }
+   }
+}
@@ -0,0 +1,193 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#include "fit_diagnostics.h"
+
+#include <cstring>
+#include <iomanip>
+
+#include <opencv2/core/core.hpp>
+
+namespace cpu_model
+{
+   FitDiagnostics::FitDiagnostics() : _enabled(false), _maps(false), _rows(0), _cols(0)
+   {
+      Clear();
+   }
+
+   FitDiagnostics::~FitDiagnostics() {}
+
+   int FitDiagnostics::SetEnabled(bool enable)
+   {
+      _enabled = enable;
+      return 0;
+   }
+
+   int FitDiagnostics::SetMaps(bool enable)
+   {
+      _maps = enable;
+      if (!_maps)
+      {
+         _iterationMap.clear();
+         _timeMap.clear();
+      }
+      return 0;
+   }
+
+   void FitDiagnostics::Clear()
+   {
+      _iterations.clear();
+      _cycles.clear();
+      memset(_times, 0, sizeof(_times));
+      memset(_stopPixels, 0, sizeof(_stopPixels));
+      memset(_stopTime, 0, sizeof(_stopTime));
+      _pixels = 0;
+      _totalTime = 0;
+      _iterationMap.assign(_iterationMap.size(), 0.0f);
+      _timeMap.assign(_timeMap.size(), 0.0f);
+   }
+
+   void FitDiagnostics::BeginFit(int rows, int cols)
+   {
+      _rows = rows;
+      _cols = cols;
+      if (!_enabled || !_maps)
+         return;
+      _iterationMap.assign((size_t)rows * cols, 0.0f);
+      _timeMap.assign((size_t)rows * cols, 0.0f);
+   }
+
+   void FitDiagnostics::Merge(std::vector<PixelTrace> &trace)
+   {
+      const bool maps = _maps && _iterationMap.size() == (size_t)_rows * _cols;
+      for (const PixelTrace &record : trace)
+      {
+         if (record.iterations >= (int)_iterations.size())
+            _iterations.resize(record.iterations + 1, 0);
+         _iterations[record.iterations]++;
+         if (record.cycles >= (int)_cycles.size())
+            _cycles.resize(record.cycles + 1, 0);
+         _cycles[record.cycles]++;
+
+         int bin = 0;
+         for (int64_t t = record.nanoseconds; t > 0 && bin < TimeBins - 1; t >>= 1)
+            bin++;
+         _times[bin]++;
+         if (record.stopCrit >= 0 && record.stopCrit < StopCodes)
+         {
+            _stopPixels[record.stopCrit]++;
+            _stopTime[record.stopCrit] += record.nanoseconds;
+         }
+         _pixels++;
+         _totalTime += record.nanoseconds;
+
+         if (maps && record.pixel >= 0 && record.pixel < _rows * _cols)
+         {
+            _iterationMap[record.pixel] = (float)record.iterations;
+            _timeMap[record.pixel] = (float)(record.nanoseconds / 1000.0);
+         }
+      }
+      trace.clear();
+   }
+
+   int FitDiagnostics::GetStopCriterion(int code, int64_t *pixels, int64_t *nanoseconds) const
+   {
+      if (code < 0 || code >= StopCodes)
+         return 1;
+      *pixels = _stopPixels[code];
+      *nanoseconds = _stopTime[code];
+      return 0;
+   }
+
+   int FitDiagnostics::GetMaps(cv::Mat &iterations, cv::Mat &microseconds) const
+   {
+      if (_iterationMap.empty() || _iterationMap.size() != (size_t)_rows * _cols)
+         return 1;
+      iterations = cv::Mat(_rows, _cols, CV_32F);
+      microseconds = cv::Mat(_rows, _cols, CV_32F);
+      memcpy(iterations.ptr<float>(), _iterationMap.data(), _iterationMap.size() * sizeof(float));
+      memcpy(microseconds.ptr<float>(), _timeMap.data(), _timeMap.size() * sizeof(float));
+      return 0;
+   }
+
+   int FitDiagnostics::Percentile(const std::vector<int64_t> &histogram, int64_t total, double fraction)
+   {
+      int64_t sum{ 0 };
+      for (size_t i = 0; i < histogram.size(); i++)
+      {
+         sum += histogram[i];
+         if (sum >= fraction * total)
+            return (int)i;
+      }
+      return (int)histogram.size() - 1;
+   }
+
+   void FitDiagnostics::Report(std::ostream &out) const
+   {
+      if (_pixels == 0)
+      {
+         out << "No pixels traced" << std::endl;
+         return;
+      }
+      out << _pixels << " pixels, " << _totalTime / 1000000 << " ms of solver time, " <<
+         _totalTime / _pixels << " ns per pixel" << std::endl;
+      out << "Iterations  p50 " << Percentile(_iterations, _pixels, 0.5) << ", p90 " <<
+         Percentile(_iterations, _pixels, 0.9) << ", p99 " << Percentile(_iterations, _pixels, 0.99) <<
+         ", max " << _iterations.size() - 1 << std::endl;
+      out << "RCI cycles  p50 " << Percentile(_cycles, _pixels, 0.5) << ", p90 " <<
+         Percentile(_cycles, _pixels, 0.9) << ", p99 " << Percentile(_cycles, _pixels, 0.99) <<
+         ", max " << _cycles.size() - 1 << std::endl;
+
+      out << "Wall time per pixel:" << std::endl;
+      for (int k = 0; k < TimeBins; k++)
+      {
+         if (_times[k] == 0)
+            continue;
+         out << "   < " << std::setw(12) << ((int64_t)1 << k) << " ns " << std::setw(10) << _times[k] <<
+            std::setw(7) << std::fixed << std::setprecision(2) << 100.0 * _times[k] / _pixels << "%" << std::endl;
+      }
+
+      out << "By stop criterion:" << std::endl;
+      for (int code = 0; code < StopCodes; code++)
+      {
+         if (_stopPixels[code] == 0)
+            continue;
+         out << "   " << code << ": " << std::setw(10) << _stopPixels[code] << " pixels, " <<
+            std::setw(7) << std::fixed << std::setprecision(2) <<
+            (_totalTime > 0 ? 100.0 * _stopTime[code] / _totalTime : 0.0) << "% of the time" << std::endl;
+      }
+      out.unsetf(std::ios::fixed);
+   }
+}
@@ -0,0 +1,158 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#ifndef FIT_DIAGNOSTICS_H
+#define FIT_DIAGNOSTICS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace cv
+{
+   class Mat;
+};
+
+namespace cpu_model
+{
+   /**Solver record of one fitted pixel*/
+   struct PixelTrace
+   {
+      int pixel;
+      int iterations;
+      int cycles;                //RCI cycles, 0 for solvers without reverse communication
+      int stopCrit;
+      int64_t nanoseconds;
+   };
+
+   /****************************************************************************
+   * @brief Histograms of the solver work spent on the pixels of a fit.
+   *
+   * Fit threads append a PixelTrace per pixel to a buffer of their own, so
+   * tracing costs two clock reads and a push_back per pixel and no locking,
+   * and nothing but a flag test when disabled. The buffers are merged here
+   * once the threads are done. Iterations and RCI cycles are binned one per
+   * count, wall times in powers of two of nanoseconds, and time is also
+   * totalled per stop criterion. The histograms accumulate over fits, e.g.
+   * the bands of a stream, until Clear. The optional maps hold the last fit.
+   ****************************************************************************/
+   class FitDiagnostics
+   {
+   public:
+      static const int TimeBins = 40;
+      static const int StopCodes = 7;
+
+      FitDiagnostics();
+      ~FitDiagnostics();
+
+      /**Timestamp for a trace, in nanoseconds*/
+      static int64_t Now()
+      {
+         return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+      }
+
+      int SetEnabled(bool);
+
+      bool Enabled() const { return _enabled; }
+
+      /*************************************************************************
+      * @brief Also keeps rows x cols maps of each pixel's iterations and wall
+      * time (microseconds), zero for pixels that were not fit
+      *************************************************************************/
+      int SetMaps(bool);
+
+      /**Empties the histograms and maps*/
+      void Clear();
+
+      /*************************************************************************
+      * @brief Called by the model before a fit of rows x cols pixels, resets
+      * the maps
+      *************************************************************************/
+      void BeginFit(int rows, int cols);
+
+      /*************************************************************************
+      * @brief Folds one thread's records into the histograms and maps and
+      * empties the buffer. Not thread safe, call once the fit is done.
+      *************************************************************************/
+      void Merge(std::vector<PixelTrace> &trace);
+
+      /**Pixels by iteration count*/
+      const std::vector<int64_t> &Iterations() const { return _iterations; }
+
+      /**Pixels by RCI cycle count*/
+      const std::vector<int64_t> &Cycles() const { return _cycles; }
+
+      /**Pixels by wall time, bin k holds [2^(k-1), 2^k) ns and the last bin
+      everything longer*/
+      const int64_t *Times() const { return _times; }
+
+      int64_t Pixels() const { return _pixels; }
+
+      int64_t TotalNanoseconds() const { return _totalTime; }
+
+      /*************************************************************************
+      * @brief Pixels and wall time of a stop criterion (0-6)
+      *************************************************************************/
+      int GetStopCriterion(int code, int64_t *pixels, int64_t *nanoseconds) const;
+
+      /*************************************************************************
+      * @brief Copies of the maps as CV_32F images
+      *************************************************************************/
+      int GetMaps(cv::Mat &iterations, cv::Mat &microseconds) const;
+
+      /*************************************************************************
+      * @brief Prints a summary: percentiles of each histogram, the wall time
+      * histogram and the time spent per stop criterion
+      *************************************************************************/
+      void Report(std::ostream &out) const;
+
+   private:
+      //Smallest count whose cumulative share reaches fraction
+      static int Percentile(const std::vector<int64_t> &histogram, int64_t total, double fraction);
+
+      bool _enabled;
+      bool _maps;
+      int _rows, _cols;
+      std::vector<int64_t> _iterations, _cycles;
+      int64_t _times[TimeBins];
+      int64_t _stopPixels[StopCodes], _stopTime[StopCodes];
+      int64_t _pixels, _totalTime;
+      std::vector<float> _iterationMap, _timeMap;
+   };
+}
+
+#endif //FIT_DIAGNOSTICS_H
@@ -0,0 +1,82 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#ifndef FIT_STATISTICS_H
+#define FIT_STATISTICS_H
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Goodness of fit of one pixel in a single pass over its frames.
+   *
+   * Works from the final residuals f = y - (A * g + B) the solvers leave
+   * behind, so no model evaluation is needed: the signal A * g of each frame
+   * is y - f - B. The frame sums are accumulated in one vectorizable loop
+   * with no temporaries, the data offset by its first frame so the total sum
+   * of squares keeps its precision. Fills stats with
+   *    [0] R2   = 1 - ssr / sst
+   *    [1] d    = sum (f_j - f_j-1)^2 / ssr  (Durbin-Watson)
+   *    [2] SNR  = mean (A * g)^2 / mean f^2
+   * N is the frame count, or 0 to take it from n at run time.
+   ****************************************************************************/
+   template <int N>
+   inline void FrameStatistics(const unsigned short *data, const double *fvec, double B, int n, double *stats)
+   {
+      const int frames = N > 0 ? N : n;
+      const double first = data[0];
+      double sy{ 0.0 }, syy{ 0.0 }, ssr{ fvec[0] * fvec[0] }, ssc{ 0.0 };
+      double signal = first - fvec[0] - B, sss{ signal * signal };
+#pragma omp simd reduction(+:sy, syy, ssr, ssc, sss)
+      for (int j = 1; j < frames; j++)
+      {
+         double y = (double)data[j] - first;
+         double f = fvec[j];
+         double change = f - fvec[j - 1];
+         double s = (double)data[j] - f - B;
+         sy += y;
+         syy += y * y;
+         ssr += f * f;
+         ssc += change * change;
+         sss += s * s;
+      }
+      double sst = syy - sy * sy / frames;
+      stats[0] = 1.0 - ssr / sst;
+      stats[1] = ssc / ssr;
+      stats[2] = sss / ssr;
+   }
+}
+
+#endif //FIT_STATISTICS_H
@@ -0,0 +1,118 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "grid_initializer.h"
+
+#include <cmath>
+#include <mkl.h>
+
+namespace cpu_model
+{
+   GridInitializer::GridInitializer(const HeightBasis *basis) :
+      _basis(basis), _n(basis->Frames()), _points(basis->Points())
+   {
+      _tile = (double *)mkl_malloc(TilePixels * _n * sizeof(double), 64);
+      _correlation = (double *)mkl_malloc((size_t)TilePixels * _points * sizeof(double), 64);
+   }
+
+   GridInitializer::~GridInitializer()
+   {
+      mkl_free(_tile);
+      mkl_free(_correlation);
+   }
+
+   int GridInitializer::Initialize(const unsigned short *data, int pixels, double *xvec)
+   {
+      if (_tile == nullptr || _correlation == nullptr)
+         return 1;
+      const double n = (double)_n;
+      for (int start = 0; start < pixels; start += TilePixels)
+      {
+         int count = pixels - start < TilePixels ? pixels - start : TilePixels;
+         const unsigned short *src = data + (size_t)start * _n;
+         for (int i = 0; i < count * _n; i++)
+            _tile[i] = (double)src[i];
+
+         //correlation(pixel, point) = sum over frames of data * s(H_point)
+         cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, count, _points, _n,
+            1.0, _tile, _n, _basis->Curve(0), _n, 0.0, _correlation, _points);
+
+         for (int p = 0; p < count; p++)
+         {
+            const double *y = _tile + p * _n;
+            const double *corr = _correlation + (size_t)p * _points;
+            double *x = xvec + (size_t)(start + p) * 3;
+            double sy{ 0.0 }, syy{ 0.0 };
+            for (int i = 0; i < _n; i++)
+            {
+               sy += y[i];
+               syy += y[i] * y[i];
+            }
+
+            int best{ 0 };
+            double bestCost{ HUGE_VAL }, prevCost{ HUGE_VAL }, nextCost{ HUGE_VAL }, lastCost{ HUGE_VAL };
+            for (int j = 0; j < _points; j++)
+            {
+               double ss{ _basis->Sum(j) }, sss{ _basis->SumSq(j) };
+               double A = (n * corr[j] - ss * sy) / (n * sss - ss * ss);
+               double B = (sy - A * ss) / n;
+               double cost = syy - A * corr[j] - B * sy;
+               if (cost < bestCost)
+               {
+                  bestCost = cost;
+                  best = j;
+                  prevCost = lastCost;
+                  nextCost = HUGE_VAL;
+                  x[0] = A;
+                  x[1] = B;
+               }
+               else if (j == best + 1)
+                  nextCost = cost;
+               lastCost = cost;
+            }
+
+            //Parabolic refinement between the neighbouring grid points
+            double offset{ 0.0 };
+            double curvature = prevCost - 2.0 * bestCost + nextCost;
+            if (best > 0 && best < _points - 1 && curvature > 0.0)
+            {
+               offset = 0.5 * (prevCost - nextCost) / curvature;
+               offset = offset > 0.5 ? 0.5 : offset < -0.5 ? -0.5 : offset;
+            }
+            x[2] = _basis->Height(best) + offset * _basis->Step();
+         }
+      }
+      return 0;
+   }
+}
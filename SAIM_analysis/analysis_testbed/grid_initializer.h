@@ -0,0 +1,83 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef GRID_INITIALIZER_H
+#define GRID_INITIALIZER_H
+
+#include "height_basis.h"
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Picks a starting (A, B, H) for each pixel from the HeightBasis
+   * dictionary instead of a fixed guess.
+   *
+   * A tile of pixels is correlated against every dictionary curve in a single
+   * GEMM, then A and B are solved in closed form for each grid height and the
+   * height with the smallest residual wins. The winner is refined to a
+   * fraction of the grid step by fitting a parabola through the residuals of
+   * its neighbours, which puts the start in the right periodic branch and
+   * close enough to the minimum that the solver only has to polish it.
+   ****************************************************************************/
+   class GridInitializer
+   {
+   public:
+      static const int TilePixels = 64;
+
+      /*************************************************************************
+      * @brief Sets up the initializer, the basis must outlive it
+      *************************************************************************/
+      GridInitializer(const HeightBasis *basis);
+      ~GridInitializer();
+
+      /*************************************************************************
+      * @brief Computes starting points for consecutive pixels
+      * @param data Frames of each pixel, pixel after pixel
+      * @param pixels Number of pixels, any count (tiled internally)
+      * @param xvec Out: (A, B, H) of each pixel
+      *************************************************************************/
+      int Initialize(const unsigned short *data, int pixels, double *xvec);
+
+   private:
+      GridInitializer(const GridInitializer &) = delete;
+      GridInitializer &operator=(const GridInitializer &) = delete;
+
+      const HeightBasis *_basis;
+      int _n, _points;
+      double *_tile;          //TilePixels x frames
+      double *_correlation;   //TilePixels x points
+   };
+}
+
+#endif //GRID_INITIALIZER_H
@@ -0,0 +1,94 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "height_basis.h"
+
+#include <cmath>
+#include <mkl.h>
+
+namespace cpu_model
+{
+   HeightBasis::HeightBasis(int frames, const double *constvec, double hMin, double hMax, double hStep) :
+      _n(frames), _hMin(hMin), _hStep(hStep)
+   {
+      _points = (int)floor((hMax - hMin) / hStep + 0.5) + 1;
+      if (_points < 1)
+         _points = 1;
+      _curves = (double *)mkl_malloc((size_t)_points * _n * sizeof(double), 64);
+      _sums = (double *)mkl_malloc(2 * _points * sizeof(double), 64);
+      _twoC = (double *)mkl_malloc(4 * _n * sizeof(double), 64);
+      _twoD = _twoC + _n;
+      _offset = _twoD + _n;
+      _phi = _offset + _n;
+      for (int i = 0; i < _n; i++)
+      {
+         double c{ constvec[3 * i] }, d{ constvec[3 * i + 1] };
+         _twoC[i] = 2.0 * c;
+         _twoD[i] = 2.0 * d;
+         _offset[i] = 1.0 + c * c + d * d;
+         _phi[i] = constvec[3 * i + 2];
+      }
+      for (int j = 0; j < _points; j++)
+      {
+         double H = Height(j), sum{ 0.0 }, sumSq{ 0.0 };
+         double *curve = _curves + (size_t)j * _n;
+         for (int i = 0; i < _n; i++)
+         {
+            curve[i] = _offset[i] + _twoC[i] * cos(_phi[i] * H) - _twoD[i] * sin(_phi[i] * H);
+            sum += curve[i];
+            sumSq += curve[i] * curve[i];
+         }
+         _sums[2 * j] = sum;
+         _sums[2 * j + 1] = sumSq;
+      }
+   }
+
+   HeightBasis::~HeightBasis()
+   {
+      mkl_free(_curves);
+      mkl_free(_sums);
+      mkl_free(_twoC);
+   }
+
+   void HeightBasis::Evaluate(double H, double *shape, double *slope) const
+   {
+      for (int i = 0; i < _n; i++)
+      {
+         double cosv = cos(_phi[i] * H);
+         double sinv = sin(_phi[i] * H);
+         shape[i] = _offset[i] + _twoC[i] * cosv - _twoD[i] * sinv;
+         slope[i] = -_phi[i] * (_twoC[i] * sinv + _twoD[i] * cosv);
+      }
+   }
+}
@@ -0,0 +1,99 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef HEIGHT_BASIS_H
+#define HEIGHT_BASIS_H
+
+#include <cstddef>
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Table of the SAIM intensity shape over a grid of heights.
+   *
+   * The model is I = A * s(H) + B with s(H) = 1 + |rTE|^2 + 2 * Re(rTE) *
+   * cos(phi * H) - 2 * Im(rTE) * sin(phi * H). Since s does not depend on the
+   * data, it is evaluated once per frame and grid height and reused for every
+   * pixel. Curves are stored grid point by grid point with the frames in the
+   * same order as the constant vector, so Curve(j) is a frames long vector.
+   ****************************************************************************/
+   class HeightBasis
+   {
+   public:
+      /*************************************************************************
+      * @brief Builds the table
+      * @param frames Number of frames
+      * @param constvec The (rTE real, rTE imag, phi) triplet for each frame
+      * @param hMin, hMax, hStep Height grid in nm, hMax is included
+      *************************************************************************/
+      HeightBasis(int frames, const double *constvec, double hMin, double hMax, double hStep);
+      ~HeightBasis();
+
+      int Frames(void) const { return _n; }
+      int Points(void) const { return _points; }
+      double Step(void) const { return _hStep; }
+      double Height(int point) const { return _hMin + point * _hStep; }
+
+      /*************************************************************************
+      * @brief s(H) at grid point j for all frames
+      *************************************************************************/
+      const double *Curve(int point) const { return _curves + (size_t)point * _n; }
+
+      /*************************************************************************
+      * @brief Sum of s and of s^2 over the frames at grid point j
+      *************************************************************************/
+      double Sum(int point) const { return _sums[2 * point]; }
+      double SumSq(int point) const { return _sums[2 * point + 1]; }
+
+      /*************************************************************************
+      * @brief Exact s(H) and ds/dH at an arbitrary height
+      *************************************************************************/
+      void Evaluate(double H, double *shape, double *slope) const;
+
+   private:
+      HeightBasis(const HeightBasis &) = delete;
+      HeightBasis &operator=(const HeightBasis &) = delete;
+
+      int _n, _points;
+      double _hMin, _hStep;
+      double *_curves;     //points x frames
+      double *_sums;       //(sum s, sum s^2) per point
+      double *_twoC;       //2 * Re(rTE) per frame
+      double *_twoD;       //2 * Im(rTE) per frame
+      double *_offset;     //1 + |rTE|^2 per frame
+      double *_phi;        //phase factor per frame
+   };
+}
+
+#endif //HEIGHT_BASIS_H
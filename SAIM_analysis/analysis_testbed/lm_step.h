@@ -0,0 +1,151 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef LM_STEP_H
+#define LM_STEP_H
+
+#include <cmath>
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Per-pixel pieces of the Levenberg-Marquardt iteration shared by
+   * BatchLMSolver and the GPU model's GrainLMSolver, so the two report the
+   * same steps and dtrnlsp_get stop codes for the same normal equations.
+   *
+   * A pixel's state is its cost ||F||^2, its gradient J'F (3 values) and the
+   * upper triangle of J'J (00, 01, 02, 11, 12, 22), each value stride apart:
+   * the lane count when the pixels are interleaved, 1 when they are not.
+   * The functions are static so each instruction set build of the batched
+   * solver keeps its own copy.
+   ****************************************************************************/
+
+   /*************************************************************************
+   * @brief Stop code at the starting point: 4 if a Jacobian column norm is
+   * below eps[2], 3 if ||F|| is below eps[1], otherwise 0
+   *************************************************************************/
+   static inline int LMStartStop(double cost, const double *hess, int stride, const double *eps)
+   {
+      if (sqrt(hess[0]) < eps[2] || sqrt(hess[3 * stride]) < eps[2] || sqrt(hess[5 * stride]) < eps[2])
+         return 4;
+      if (sqrt(cost) < eps[1])
+         return 3;
+      return 0;
+   }
+
+   /*************************************************************************
+   * @brief Solves the damped normal equations (J'J + lambda * diag(J'J)) s
+   * = -J'F by Cholesky
+   * @param s Out: the step, zero if the factorization broke down
+   * @param pred Out: decrease of ||F||^2 predicted by the undamped linear
+   * model, zero if the factorization broke down
+   * @return false if the factorization broke down
+   *************************************************************************/
+   static inline bool LMStep(const double *grad, const double *hess, int stride, double lambda, double *s, double *pred)
+   {
+      const int W = stride;
+      double m00{ hess[0] * (1.0 + lambda) }, m01{ hess[W] }, m02{ hess[2 * W] };
+      double m11{ hess[3 * W] * (1.0 + lambda) }, m12{ hess[4 * W] };
+      double m22{ hess[5 * W] * (1.0 + lambda) };
+      double l00 = sqrt(m00);
+      double l10 = m01 / l00;
+      double l20 = m02 / l00;
+      double l11 = sqrt(m11 - l10 * l10);
+      double l21 = (m12 - l20 * l10) / l11;
+      double l22 = sqrt(m22 - l20 * l20 - l21 * l21);
+      double y0 = -grad[0] / l00;
+      double y1 = (-grad[W] - l10 * y0) / l11;
+      double y2 = (-grad[2 * W] - l20 * y0 - l21 * y1) / l22;
+      double s2 = y2 / l22;
+      double s1 = (y1 - l21 * s2) / l11;
+      double s0 = (y0 - l10 * s1 - l20 * s2) / l00;
+      if (!std::isfinite(s0 + s1 + s2))
+      {
+         s[0] = s[1] = s[2] = 0.0;
+         *pred = 0.0;
+         return false;
+      }
+      double jts = 2.0 * (s0 * grad[0] + s1 * grad[W] + s2 * grad[2 * W]);
+      double sts = s0 * s0 * hess[0] + s1 * s1 * hess[3 * W] + s2 * s2 * hess[5 * W]
+         + 2.0 * (s0 * s1 * hess[W] + s0 * s2 * hess[2 * W] + s1 * s2 * hess[4 * W]);
+      s[0] = s0;
+      s[1] = s1;
+      s[2] = s2;
+      *pred = -(jts + sts);
+      return true;
+   }
+
+   /*************************************************************************
+   * @brief Stop code of a step before it is evaluated: 5 if ||s|| is below
+   * eps[3], 6 if the predicted decrease of ||F|| is below eps[4], otherwise
+   * 0 and the step is tried
+   *************************************************************************/
+   static inline int LMStepStop(const double *s, double cost, double pred, const double *eps)
+   {
+      if (sqrt(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]) < eps[3])
+         return 5;
+      if (sqrt(cost) - sqrt(fmax(cost - pred, 0.0)) < eps[4])
+         return 6;
+      return 0;
+   }
+
+   /*************************************************************************
+   * @brief Accepts or rejects a trial point by its gain ratio and updates
+   * the damping: an accepted step shrinks lambda by up to 3, a rejected one
+   * grows it by nu, which doubles on every rejection in a row
+   * @param stop Out: 3 if the accepted ||F|| is below eps[1], 2 if the
+   * rejected damping grew past 1 / eps[0], otherwise left alone
+   * @return true if the trial point is accepted
+   *************************************************************************/
+   static inline bool LMAccept(double cost, double trialCost, double pred, const double *eps, double *lambda, double *nu,
+      int *stop)
+   {
+      double rho = pred > 0.0 ? (cost - trialCost) / pred : -1.0;
+      if (rho > 0.0)
+      {
+         double t = 2.0 * rho - 1.0;
+         *lambda *= fmax(1.0 / 3.0, 1.0 - t * t * t);
+         *nu = 2.0;
+         if (sqrt(trialCost) < eps[1])
+            *stop = 3;
+         return true;
+      }
+      *lambda *= *nu;
+      *nu *= 2.0;
+      if (*lambda > 1.0 / eps[0])
+         *stop = 2;
+      return false;
+   }
+}
+
+#endif //LM_STEP_H
@@ -0,0 +1,204 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include "optical_model.h"
+
+#include <cmath>
+#include <cstring>
+#include <list>
+#include <mutex>
+
+namespace cpu_model
+{
+   typedef std::complex<double> Complex;
+
+   static const double Pi = 3.14159265358979323846;
+
+   //Cached constants with the key they were computed for, most recent first
+   struct OpticalCacheEntry
+   {
+      uint64_t hash;
+      std::vector<double> key;
+      std::vector<double> constants;
+   };
+
+   static std::mutex CacheLock;
+   static std::list<OpticalCacheEntry> Cache;
+   static int64_t CacheHits{ 0 }, CacheMisses{ 0 };
+
+   OpticalStack SingleOxideStack(double wavelength, double dOx, double nB, double nOx, double nSi,
+      Polarization polarization)
+   {
+      OpticalStack stack;
+      stack.wavelength = wavelength;
+      stack.nSample = nB;
+      stack.layers.push_back(OpticalLayer{ dOx, Complex(nOx, 0.0) });
+      stack.nSubstrate = Complex(nSi, 0.0);
+      stack.polarization = polarization;
+      return stack;
+   }
+
+   //Every input of the constants flattened into doubles, compared on a hit
+   //so a hash collision can never return another stack's constants
+   static std::vector<double> CacheKey(const OpticalStack &stack, const double *angles, int count)
+   {
+      std::vector<double> key;
+      key.reserve(6 + 3 * stack.layers.size() + count);
+      key.push_back(stack.wavelength);
+      key.push_back(stack.nSample);
+      key.push_back(stack.polarization == Polarization::POLARIZATION_TM ? 1.0 : 0.0);
+      key.push_back(stack.nSubstrate.real());
+      key.push_back(stack.nSubstrate.imag());
+      key.push_back((double)stack.layers.size());
+      for (const OpticalLayer &layer : stack.layers)
+      {
+         key.push_back(layer.thickness);
+         key.push_back(layer.index.real());
+         key.push_back(layer.index.imag());
+      }
+      key.insert(key.end(), angles, angles + count);
+      return key;
+   }
+
+   //FNV-1a over the bytes of the key
+   static uint64_t HashKey(const std::vector<double> &key)
+   {
+      uint64_t hash = 14695981039346656037ULL;
+      const unsigned char *bytes = (const unsigned char *)key.data();
+      for (size_t i = 0; i < key.size() * sizeof(double); i++)
+      {
+         hash ^= bytes[i];
+         hash *= 1099511628211ULL;
+      }
+      return hash;
+   }
+
+   //Admittance of a medium at the angle where n sin(theta) = invariant
+   static Complex Admittance(Complex index, double invariant, Polarization polarization, Complex *cosTheta)
+   {
+      Complex sinTheta = invariant / index;
+      *cosTheta = std::sqrt(1.0 - sinTheta * sinTheta);
+      //Decaying branch for evanescent and absorbing media
+      if (cosTheta->imag() < 0.0)
+         *cosTheta = -*cosTheta;
+      return polarization == Polarization::POLARIZATION_TE ? index * *cosTheta : *cosTheta / index;
+   }
+
+   static Complex Reflection(const OpticalStack &stack, double angle)
+   {
+      const Complex i(0.0, 1.0);
+      const double invariant = stack.nSample * sin(angle);
+      Complex cosTheta;
+      Complex p0 = Admittance(stack.nSample, invariant, stack.polarization, &cosTheta);
+      Complex m11(1.0), m12(0.0), m21(0.0), m22(1.0);
+      for (const OpticalLayer &layer : stack.layers)
+      {
+         Complex p = Admittance(layer.index, invariant, stack.polarization, &cosTheta);
+         Complex beta = 2.0 * Pi / stack.wavelength * layer.index * layer.thickness * cosTheta;
+         Complex c = std::cos(beta), s = std::sin(beta);
+         Complex l11 = c, l12 = -i * s / p, l21 = -i * p * s, l22 = c;
+         Complex n11 = m11 * l11 + m12 * l21, n12 = m11 * l12 + m12 * l22;
+         Complex n21 = m21 * l11 + m22 * l21, n22 = m21 * l12 + m22 * l22;
+         m11 = n11;
+         m12 = n12;
+         m21 = n21;
+         m22 = n22;
+      }
+      Complex pS = Admittance(stack.nSubstrate, invariant, stack.polarization, &cosTheta);
+      Complex b = (m11 + m12 * pS) * p0, c = m21 + m22 * pS;
+      return (b - c) / (b + c);
+   }
+
+   int CalculateOpticalConstants(const OpticalStack &stack, const double *angles, int count, double *constvec)
+   {
+      if (count < 1 || angles == nullptr || constvec == nullptr || stack.wavelength <= 0.0)
+         return 1;
+      std::vector<double> key = CacheKey(stack, angles, count);
+      uint64_t hash = HashKey(key);
+      {
+         std::lock_guard<std::mutex> lock(CacheLock);
+         for (auto entry = Cache.begin(); entry != Cache.end(); entry++)
+         {
+            if (entry->hash != hash || entry->key != key)
+               continue;
+            memcpy(constvec, entry->constants.data(), 3 * count * sizeof(double));
+            Cache.splice(Cache.begin(), Cache, entry);
+            CacheHits++;
+            return 0;
+         }
+         CacheMisses++;
+      }
+
+      //Computed outside the lock, two threads missing on the same stack both
+      //compute it and the second insert is dropped
+      std::vector<double> constants(3 * count);
+      for (int a = 0; a < count; a++)
+      {
+         Complex r = Reflection(stack, angles[a]);
+         constants[3 * a] = r.real();
+         constants[3 * a + 1] = r.imag();
+         constants[3 * a + 2] = 4.0 * Pi * stack.nSample * cos(angles[a]) / stack.wavelength;
+      }
+      memcpy(constvec, constants.data(), 3 * count * sizeof(double));
+
+      std::lock_guard<std::mutex> lock(CacheLock);
+      for (const OpticalCacheEntry &entry : Cache)
+      {
+         if (entry.hash == hash && entry.key == key)
+            return 0;
+      }
+      Cache.push_front(OpticalCacheEntry{ hash, std::move(key), std::move(constants) });
+      if ((int)Cache.size() > OpticalCacheEntries)
+         Cache.pop_back();
+      return 0;
+   }
+
+   void ClearOpticalCache(void)
+   {
+      std::lock_guard<std::mutex> lock(CacheLock);
+      Cache.clear();
+      CacheHits = CacheMisses = 0;
+   }
+
+   void GetOpticalCacheCounts(int64_t *hits, int64_t *misses)
+   {
+      std::lock_guard<std::mutex> lock(CacheLock);
+      if (hits != nullptr)
+         *hits = CacheHits;
+      if (misses != nullptr)
+         *misses = CacheMisses;
+   }
+}
@@ -0,0 +1,103 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#ifndef OPTICAL_MODEL_H
+#define OPTICAL_MODEL_H
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+namespace cpu_model
+{
+   /**Polarization of the excitation the reflection coefficient is taken for*/
+   enum class Polarization
+   {
+      POLARIZATION_TE,
+      POLARIZATION_TM
+   };
+
+   /**One film of the chip, thickness in nm, index may be complex (absorbing)*/
+   struct OpticalLayer
+   {
+      double thickness;
+      std::complex<double> index;
+   };
+
+   /****************************************************************************
+   * @brief The reflecting chip under the sample: the medium the sample sits in,
+   * the films from the sample side down and the semi-infinite substrate.
+   * The standard SAIM chip is one oxide layer on silicon, SingleOxideStack.
+   ****************************************************************************/
+   struct OpticalStack
+   {
+      double wavelength;                  //nm, in vacuum
+      double nSample;                     //index of the medium the sample sits in
+      std::vector<OpticalLayer> layers;
+      std::complex<double> nSubstrate;
+      Polarization polarization;
+   };
+
+   OpticalStack SingleOxideStack(double wavelength, double dOx, double nB, double nOx, double nSi,
+      Polarization polarization = Polarization::POLARIZATION_TE);
+
+   /****************************************************************************
+   * @brief Fit constants of the SAIM model for count incidence angles (radians,
+   * in the sample medium): (Re r, Im r, phi) per angle into constvec, where r
+   * is the reflection coefficient of the stack and phi = 4 pi nSample
+   * cos(angle) / wavelength.
+   *
+   * r comes from the product of the characteristic (transfer) matrices of the
+   * layers, with p = n cos(theta) for TE and cos(theta) / n for TM, so TM is
+   * the reflection of the tangential magnetic field. The angle in each layer
+   * follows from Snell's law in complex arithmetic, which also covers
+   * absorbing layers and evanescent angles.
+   *
+   * Results are cached process-wide under a hash of (wavelength, sample index,
+   * layers, substrate, polarization, angles), so repeating a chip and angle
+   * set, e.g. every file of a batch, is a lookup. The cache is thread safe and
+   * keeps the OpticalCacheEntries most recently used sets.
+   ****************************************************************************/
+   int CalculateOpticalConstants(const OpticalStack &stack, const double *angles, int count, double *constvec);
+
+   /**Empties the cache, and counts of the lookups it answered and missed*/
+   void ClearOpticalCache(void);
+   void GetOpticalCacheCounts(int64_t *hits, int64_t *misses);
+
+   const int OpticalCacheEntries = 64;
+}
+
+#endif //OPTICAL_MODEL_H
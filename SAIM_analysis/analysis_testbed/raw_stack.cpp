@@ -0,0 +1,199 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "raw_stack.h"
+#include "tiff_stack_reader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <opencv2/core/core.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cpu_model
+{
+   static const char RawMagic[8] = "SAIMRAW";
+
+   RawStack::RawStack() : _header(), _data(nullptr), _view(nullptr), _viewSize(0),
+#ifdef _WIN32
+      _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+#else
+      _file(-1)
+#endif
+   {}
+
+   RawStack::~RawStack()
+   {
+      Close();
+   }
+
+   int RawStack::Open(const std::string &path)
+   {
+      Close();
+      uint64_t fileSize{ 0 };
+#ifdef _WIN32
+      _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+         FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      if (_file == INVALID_HANDLE_VALUE)
+         return 1;
+      LARGE_INTEGER size;
+      GetFileSizeEx(_file, &size);
+      fileSize = (uint64_t)size.QuadPart;
+      _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (_mapping != nullptr)
+         _view = MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+      _file = open(path.c_str(), O_RDONLY);
+      if (_file < 0)
+         return 1;
+      struct stat st;
+      fstat(_file, &st);
+      fileSize = (uint64_t)st.st_size;
+      if (fileSize >= sizeof(RawStackHeader))
+      {
+         _view = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, _file, 0);
+         if (_view == MAP_FAILED)
+            _view = nullptr;
+         else
+            madvise(_view, fileSize, MADV_SEQUENTIAL);
+      }
+#endif
+      if (_view == nullptr || fileSize < sizeof(RawStackHeader))
+      {
+         Close();
+         return 1;
+      }
+      _viewSize = (size_t)fileSize;
+      memcpy(&_header, _view, sizeof(RawStackHeader));
+      uint64_t dataBytes = (uint64_t)_header.rows * _header.cols * _header.frames * sizeof(unsigned short);
+      if (memcmp(_header.magic, RawMagic, sizeof(RawMagic)) != 0 || _header.version != Version ||
+         _header.frames == 0 || _header.dataOffset < sizeof(RawStackHeader) + _header.frames * sizeof(double) ||
+         _header.dataOffset + dataBytes > fileSize)
+      {
+         Close();
+         return 1;
+      }
+      const double *angles = (const double *)((const char *)_view + sizeof(RawStackHeader));
+      _angles.assign(angles, angles + _header.frames);
+      _data = (const unsigned short *)((const char *)_view + _header.dataOffset);
+      return 0;
+   }
+
+   void RawStack::Close()
+   {
+#ifdef _WIN32
+      if (_view != nullptr)
+         UnmapViewOfFile(_view);
+      if (_mapping != nullptr)
+         CloseHandle(_mapping);
+      if (_file != INVALID_HANDLE_VALUE)
+         CloseHandle(_file);
+      _mapping = nullptr;
+      _file = INVALID_HANDLE_VALUE;
+#else
+      if (_view != nullptr)
+         munmap(_view, _viewSize);
+      if (_file >= 0)
+         close(_file);
+      _file = -1;
+#endif
+      _view = nullptr;
+      _viewSize = 0;
+      _data = nullptr;
+      _angles.clear();
+      _header = RawStackHeader();
+   }
+
+   int RawStack::Convert(const std::string &tiffPath, const std::string &rawPath,
+      const RawStackHeader &header, const double *angles, int bandRows)
+   {
+      TiffStackReader reader;
+      if (reader.Open(tiffPath) || bandRows < 1)
+         return 1;
+      RawStackHeader out = header;
+      memcpy(out.magic, RawMagic, sizeof(RawMagic));
+      out.version = Version;
+      out.rows = reader.Rows();
+      out.cols = reader.Cols();
+      out.frames = reader.Frames();
+      uint64_t headerBytes = sizeof(RawStackHeader) + out.frames * sizeof(double);
+      out.dataOffset = (headerBytes + Alignment - 1) / Alignment * Alignment;
+
+      FILE *file = fopen(rawPath.c_str(), "wb");
+      if (file == nullptr)
+         return 1;
+      std::vector<char> head((size_t)out.dataOffset, 0);
+      memcpy(head.data(), &out, sizeof(RawStackHeader));
+      memcpy(head.data() + sizeof(RawStackHeader), angles, out.frames * sizeof(double));
+      bool ok = fwrite(head.data(), 1, head.size(), file) == head.size();
+
+      //Each band is transposed to pixel-major and appended, pixels of a band
+      //are consecutive in the file because bands span whole rows
+      std::vector<cv::Mat> band;
+      std::vector<unsigned short> pixels;
+      for (int first = 0; ok && first < reader.Rows(); first += bandRows)
+      {
+         int rows = reader.Rows() - first < bandRows ? reader.Rows() - first : bandRows;
+         if (reader.ReadBand(first, rows, band))
+         {
+            ok = false;
+            break;
+         }
+         size_t count = (size_t)rows * out.cols;
+         pixels.resize(count * out.frames);
+         for (size_t block = 0; block < count; block += 64)
+         {
+            size_t end = count - block < 64 ? count : block + 64;
+            for (uint32_t i = 0; i < out.frames; i++)
+            {
+               const unsigned short *src = band[i].ptr<unsigned short>();
+               for (size_t j = block; j < end; j++)
+                  pixels[j * out.frames + i] = src[j];
+            }
+         }
+         ok = fwrite(pixels.data(), sizeof(unsigned short), pixels.size(), file) == pixels.size();
+      }
+      ok = fclose(file) == 0 && ok;
+      if (!ok)
+         remove(rawPath.c_str());
+      return ok ? 0 : 1;
+   }
+}
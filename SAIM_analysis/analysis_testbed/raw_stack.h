@@ -0,0 +1,114 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef RAW_STACK_H
+#define RAW_STACK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Pixel-interleaved stack file that CPUModel fits without a copy.
+   *
+   * A RawStackHeader and the angles (radians, one per frame) are followed at
+   * a page aligned offset by uint16 data in [pixel][frame] order, the layout
+   * of CPUModel::_data. Open maps the file read only so re-fitting the same
+   * acquisition with new constants skips decoding and transposing entirely.
+   ****************************************************************************/
+   struct RawStackHeader
+   {
+      char magic[8];          //"SAIMRAW"
+      uint32_t version;
+      uint32_t rows, cols, frames;
+      uint64_t dataOffset;    //bytes from the start of the file
+      double wavelength, dOx, nB, nOx, nSi;
+   };
+
+   class RawStack
+   {
+   public:
+      static const uint32_t Version = 1;
+      static const uint64_t Alignment = 4096;
+
+      RawStack();
+      ~RawStack();
+
+      /*************************************************************************
+      * @brief Maps a stack file, fails on a bad header or a short file
+      *************************************************************************/
+      int Open(const std::string &path);
+
+      void Close();
+
+      int Rows() const { return (int)_header.rows; }
+      int Cols() const { return (int)_header.cols; }
+      int Frames() const { return (int)_header.frames; }
+      const RawStackHeader &Header() const { return _header; }
+      const double *Angles() const { return _angles.data(); }
+
+      /*************************************************************************
+      * @brief The mapped frames of every pixel, pixel after pixel
+      *************************************************************************/
+      const unsigned short *Data() const { return _data; }
+
+      /*************************************************************************
+      * @brief Converts a 16 bit multi-page TIFF band by band, so the stack
+      * never has to fit in memory
+      * @param header Optical constants, the shape and offset are filled in
+      * @param angles One incidence angle (radians) per page
+      *************************************************************************/
+      static int Convert(const std::string &tiffPath, const std::string &rawPath,
+         const RawStackHeader &header, const double *angles, int bandRows = 64);
+
+   private:
+      RawStack(const RawStack &) = delete;
+      RawStack &operator=(const RawStack &) = delete;
+
+      RawStackHeader _header;
+      std::vector<double> _angles;
+      const unsigned short *_data;
+      void *_view;
+      size_t _viewSize;
+#ifdef _WIN32
+      void *_file, *_mapping;
+#else
+      int _file;
+#endif
+   };
+}
+
+#endif //RAW_STACK_H
@@ -0,0 +1,302 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#include "run_config.h"
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "../../software/SSv3_calibration/dac_calibration.h"
+
+namespace po = boost::program_options;
+
+namespace cpu_model
+{
+   static const double DegToRad = 3.14159265358979323846 / 180.0;
+
+   RunConfig::RunConfig()
+   {
+      //31 frames, 2.660735 degrees apart and centred on normal incidence
+      for (int i = 0; i < 31; i++)
+         angles.push_back((-39.911025 + i * 2.660735) * DegToRad);
+   }
+
+   int RunConfig::Load(const std::string &path)
+   {
+      po::options_description opts("Run configuration");
+      opts.add_options()
+         ("wavelength", po::value<double>(), "excitation wavelength in vacuum (nm)")
+         ("polarization", po::value<std::string>(), "TE or TM")
+         ("sampleIndex", po::value<double>(), "index of the medium the sample sits in")
+         ("layerThickness", po::value<std::vector<double>>()->multitoken(), "film thickness (nm), sample side first")
+         ("layerIndex", po::value<std::vector<double>>()->multitoken(), "film index")
+         ("layerExtinction", po::value<std::vector<double>>()->multitoken(), "film extinction coefficient")
+         ("substrateIndex", po::value<double>(), "substrate index")
+         ("substrateExtinction", po::value<double>(), "substrate extinction coefficient")
+         ("angle", po::value<std::vector<double>>()->multitoken(), "angle of each frame (degrees)")
+         ("firstAngle", po::value<double>(), "first angle of a linear scan (degrees)")
+         ("angleStep", po::value<double>(), "step of a linear scan (degrees)")
+         ("frames", po::value<int>(), "frames of a linear scan")
+         ("dac", po::value<std::vector<double>>()->multitoken(), "DAC code of each frame")
+         ("calibrationConstants", po::value<std::vector<double>>()->multitoken(), "values used to convert DAC->Deg")
+         ("calibrationIndex", po::value<double>(), "sample index the calibration was made for")
+         ("solver", po::value<std::string>(), "mkl, batched, varpro or float")
+         ("gridStart", po::value<bool>(), "seed from the height grid search")
+         ("heightMin", po::value<double>(), "height grid start (nm)")
+         ("heightMax", po::value<double>(), "height grid end (nm)")
+         ("heightStep", po::value<double>(), "height grid step (nm)")
+         ("guessA", po::value<double>(), "start A over the pixel's range")
+         ("guessB", po::value<double>(), "start B over the pixel's minimum")
+         ("guessH", po::value<double>(), "start H (nm)")
+         ("tolerance", po::value<std::vector<double>>()->multitoken(), "stop tolerances, one or six")
+         ("iterations", po::value<int>(), "iteration limit");
+      //The control panel's scanner settings, so its .cfg files load as they are
+      po::options_description panel("Control panel settings");
+      panel.add_options()
+         ("xCenter", po::value<unsigned short>())
+         ("yCenter", po::value<unsigned short>())
+         ("tirRadius", po::value<unsigned short>())
+         ("phase", po::value<unsigned short>())
+         ("frequency", po::value<unsigned short>())
+         ("yScale", po::value<unsigned short>());
+      opts.add(panel);
+
+      std::ifstream fStream(path);
+      if (!fStream.is_open())
+      {
+         std::cerr << "Could not open the configuration " << path << std::endl;
+         return 1;
+      }
+      po::variables_map vm;
+      try
+      {
+         po::store(po::parse_config_file(fStream, opts), vm);
+         po::notify(vm);
+      }
+      catch (const po::error &e)
+      {
+         std::cerr << path << ": " << e.what() << std::endl;
+         return 1;
+      }
+
+      //Built on a copy, a bad file leaves the configuration as it was
+      RunConfig config = *this;
+      std::vector<std::string> errors;
+
+      if (vm.count("wavelength"))
+         config.optics.wavelength = vm["wavelength"].as<double>();
+      if (vm.count("sampleIndex"))
+         config.optics.nSample = vm["sampleIndex"].as<double>();
+      if (vm.count("polarization"))
+      {
+         std::string pol = vm["polarization"].as<std::string>();
+         if (pol == "TE")
+            config.optics.polarization = Polarization::POLARIZATION_TE;
+         else if (pol == "TM")
+            config.optics.polarization = Polarization::POLARIZATION_TM;
+         else
+            errors.push_back("polarization must be TE or TM");
+      }
+      if (vm.count("layerThickness") || vm.count("layerIndex") || vm.count("layerExtinction"))
+      {
+         std::vector<double> thickness, index, extinction;
+         if (vm.count("layerThickness"))
+            thickness = vm["layerThickness"].as<std::vector<double>>();
+         if (vm.count("layerIndex"))
+            index = vm["layerIndex"].as<std::vector<double>>();
+         if (vm.count("layerExtinction"))
+            extinction = vm["layerExtinction"].as<std::vector<double>>();
+         if (thickness.size() != index.size() || (!extinction.empty() && extinction.size() != index.size()))
+            errors.push_back("every layer needs one layerThickness and one layerIndex (and layerExtinction if any has one)");
+         config.optics.layers.clear();
+         for (size_t i = 0; i < thickness.size() && i < index.size(); i++)
+         {
+            double k = extinction.size() == index.size() ? extinction[i] : 0.0;
+            if (!(thickness[i] >= 0.0) || !(index[i] > 0.0) || !(k >= 0.0))
+               errors.push_back("layer " + std::to_string(i + 1) + " needs a thickness >= 0, an index > 0 and an extinction >= 0");
+            config.optics.layers.push_back({ thickness[i], std::complex<double>(index[i], k) });
+         }
+      }
+      if (vm.count("substrateIndex") || vm.count("substrateExtinction"))
+      {
+         double n = vm.count("substrateIndex") ? vm["substrateIndex"].as<double>() : config.optics.nSubstrate.real();
+         double k = vm.count("substrateExtinction") ? vm["substrateExtinction"].as<double>() : 0.0;
+         config.optics.nSubstrate = std::complex<double>(n, k);
+      }
+      if (!(config.optics.wavelength > 0.0) || !(config.optics.nSample > 0.0) ||
+         !(config.optics.nSubstrate.real() > 0.0) || !(config.optics.nSubstrate.imag() >= 0.0))
+         errors.push_back("wavelength, sampleIndex and substrateIndex must be positive");
+
+      //Frame angles, from exactly one source
+      bool linear = vm.count("firstAngle") || vm.count("angleStep") || vm.count("frames");
+      int sources = (vm.count("angle") ? 1 : 0) + (linear ? 1 : 0) + (vm.count("dac") ? 1 : 0);
+      std::vector<double> degrees;
+      if (sources > 1)
+         errors.push_back("give the angles as angle, as firstAngle/angleStep/frames or as dac, not several");
+      else if (vm.count("angle"))
+         degrees = vm["angle"].as<std::vector<double>>();
+      else if (linear)
+      {
+         if (!vm.count("firstAngle") || !vm.count("angleStep") || !vm.count("frames") || vm["frames"].as<int>() < 1)
+            errors.push_back("a linear scan needs firstAngle, angleStep and frames > 0");
+         else
+         {
+            for (int i = 0; i < vm["frames"].as<int>(); i++)
+               degrees.push_back(vm["firstAngle"].as<double>() + i * vm["angleStep"].as<double>());
+         }
+      }
+      else if (vm.count("dac"))
+         config.dac = vm["dac"].as<std::vector<double>>();
+      if (sources == 1 && !vm.count("dac"))
+         config.dac.clear();
+
+      if (vm.count("calibrationConstants"))
+      {
+         config.calibrationConstants = vm["calibrationConstants"].as<std::vector<double>>();
+         if (config.calibrationConstants.size() < 2 || SSV3::DacCalibration().SetCoefficients(config.calibrationConstants))
+            errors.push_back("calibrationConstants needs at least two finite values, highest order first");
+      }
+      if (vm.count("calibrationIndex"))
+      {
+         config.calibrationIndex = vm["calibrationIndex"].as<double>();
+         if (!(config.calibrationIndex >= 0.0))
+            errors.push_back("calibrationIndex must be positive, or 0 for sampleIndex");
+      }
+      //Redone whenever the scan is DAC codes, a later file may change the calibration
+      if (!config.dac.empty() && config.calibrationConstants.empty())
+         errors.push_back("dac needs the control panel's calibrationConstants, in this file or an earlier --config");
+      else if (!config.dac.empty())
+      {
+         SSV3::DacCalibration calibration(config.calibrationConstants);
+         degrees.resize(config.dac.size());
+         calibration.DacToDeg(config.dac.data(), degrees.data(), (int)degrees.size());
+         if (config.calibrationIndex > 0.0 && config.calibrationIndex != config.optics.nSample)
+            SSV3::DacCalibration::Refract(degrees.data(), degrees.data(), (int)degrees.size(), config.calibrationIndex, config.optics.nSample);
+      }
+      if ((sources == 1 || !config.dac.empty()) && errors.empty())
+      {
+         config.angles.clear();
+         for (double deg : degrees)
+         {
+            if (!(fabs(deg) < 90.0))
+            {
+               errors.push_back("angle " + std::to_string(deg) + " is not between -90 and 90 degrees");
+               break;
+            }
+            config.angles.push_back(deg * DegToRad);
+         }
+      }
+
+      if (vm.count("solver"))
+      {
+         std::string solver = vm["solver"].as<std::string>();
+         if (solver == "mkl")
+            config.solver = CPUModel::SolverType::SOLVER_MKL_TRNLSP;
+         else if (solver == "batched")
+            config.solver = CPUModel::SolverType::SOLVER_BATCHED_LM;
+         else if (solver == "varpro")
+            config.solver = CPUModel::SolverType::SOLVER_VARPRO;
+         else if (solver == "float")
+            config.solver = CPUModel::SolverType::SOLVER_FLOAT_LM;
+         else
+            errors.push_back("solver must be mkl, batched, varpro or float");
+      }
+      if (vm.count("gridStart"))
+         config.gridStart = vm["gridStart"].as<bool>();
+      if (vm.count("heightMin"))
+         config.heightRange[0] = vm["heightMin"].as<double>();
+      if (vm.count("heightMax"))
+         config.heightRange[1] = vm["heightMax"].as<double>();
+      if (vm.count("heightStep"))
+         config.heightRange[2] = vm["heightStep"].as<double>();
+      if (!(config.heightRange[2] > 0.0) || !(config.heightRange[1] >= config.heightRange[0]))
+         errors.push_back("the height grid needs heightStep > 0 and heightMax >= heightMin");
+      if (vm.count("guessA"))
+         config.guesses[0] = vm["guessA"].as<double>();
+      if (vm.count("guessB"))
+         config.guesses[1] = vm["guessB"].as<double>();
+      if (vm.count("guessH"))
+         config.guesses[2] = vm["guessH"].as<double>();
+      if (vm.count("tolerance"))
+      {
+         std::vector<double> eps = vm["tolerance"].as<std::vector<double>>();
+         if (eps.size() != 1 && eps.size() != 6)
+            errors.push_back("tolerance takes one value or six");
+         for (int k = 0; k < 6 && (eps.size() == 1 || eps.size() == 6); k++)
+         {
+            config.eps[k] = eps.size() == 1 ? eps[0] : eps[k];
+            if (!(config.eps[k] > 0.0))
+               errors.push_back("tolerances must be positive");
+         }
+      }
+      if (vm.count("iterations"))
+      {
+         config.iterations = vm["iterations"].as<int>();
+         if (config.iterations < 1)
+            errors.push_back("iterations must be at least 1");
+      }
+
+      if (!errors.empty())
+      {
+         for (const std::string &error : errors)
+            std::cerr << path << ": " << error << std::endl;
+         return 1;
+      }
+      *this = config;
+      return 0;
+   }
+
+   int RunConfig::CheckFrames(int frames) const
+   {
+      if (frames == Frames())
+         return 0;
+      std::cerr << "The stack has " << frames << " frames but the configuration has " << Frames() << " angles" << std::endl;
+      return 1;
+   }
+
+   int RunConfig::Apply(CPUModel *model) const
+   {
+      model->SetSolver(solver);
+      model->SetGridStart(gridStart);
+      model->SetGuesses(guesses[0], guesses[1], guesses[2]);
+      if (model->SetHeightRange(heightRange[0], heightRange[1], heightRange[2]) ||
+         model->SetTolerances(eps, iterations))
+         return 1;
+      return 0;
+   }
+}
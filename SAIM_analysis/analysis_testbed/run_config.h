@@ -0,0 +1,105 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#ifndef RUN_CONFIG_H
+#define RUN_CONFIG_H
+
+#include <string>
+#include <vector>
+
+#include "optical_model.h"
+#include "saim_model_cpu.h"
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Everything about an acquisition protocol the fit needs, read at
+   * startup from a key=value file in the format of the control panel's .cfg
+   * files, so a new protocol needs no rebuild.
+   *
+   * The frame angles come from exactly one of:
+   *    angle=...             one line per frame, degrees in the sample
+   *    firstAngle, angleStep and frames, a linear scan in degrees
+   *    dac=...               one line per frame, the scan's DAC codes,
+   *                          converted with the control panel's polynomial
+   *                          calibrationConstants (one per line, highest order
+   *                          first, any order) from this file or an earlier
+   *                          one. calibrationIndex is the sample
+   *                          index the calibration was made for, when it
+   *                          differs from sampleIndex the angles are refracted
+   * The optics are wavelength, polarization (TE or TM), sampleIndex, the
+   * films as matching layerThickness / layerIndex (/ layerExtinction) lines
+   * from the sample side down, and substrateIndex (substrateExtinction).
+   * Solver settings are optional: solver (mkl, batched, varpro or float),
+   * gridStart, heightMin / heightMax / heightStep, guessA / guessB / guessH,
+   * tolerance (one value, or six in dtrnlsp order) and iterations.
+   * Unset keys keep the defaults below, the standard 31 frame protocol.
+   * Files can be layered, so the control panel's own settings file, whose
+   * scanner keys are ignored, can supply the calibration for a protocol
+   * file holding the dac lines.
+   ****************************************************************************/
+   struct RunConfig
+   {
+      OpticalStack optics{ 560.0, 1.34, { { 1910.5, 1.463 } }, 4.3638, Polarization::POLARIZATION_TE };
+      std::vector<double> angles;         //radians, one per frame
+      std::vector<double> dac;            //DAC code of each frame, empty unless the angles come from the scan
+      std::vector<double> calibrationConstants;   //highest order first, empty until a file sets them
+      double calibrationIndex{ 0.0 };     //0 when the calibration is for sampleIndex
+      CPUModel::SolverType solver{ CPUModel::SolverType::SOLVER_MKL_TRNLSP };
+      bool gridStart{ true };
+      double heightRange[3]{ 0.0, 300.0, 2.0 };
+      double guesses[3]{ 0.8, 1.0, 6.0 };
+      double eps[6]{ 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001 };
+      int iterations{ 1000 };
+
+      RunConfig();
+
+      /*************************************************************************
+      * @brief Reads a configuration file over the current values, checking
+      * every value. Problems are written to std::cerr.
+      *************************************************************************/
+      int Load(const std::string &path);
+
+      int Frames(void) const { return (int)angles.size(); }
+
+      /**Nonzero, with a message, unless the stack has one frame per angle*/
+      int CheckFrames(int frames) const;
+
+      /**Solver, start and tolerance settings into the model*/
+      int Apply(CPUModel *model) const;
+   };
+}
+
+#endif //RUN_CONFIG_H
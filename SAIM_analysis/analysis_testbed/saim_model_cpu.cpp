@@ -32,9 +32,17 @@
 //  project, the Paszek Research Group, or Cornell University.                //
 //////////////////////////////////////////////////////////////////////////////*/
 
+#include "fast_sincos.h"
+#include "fit_diagnostics.h"
+#include "fit_statistics.h"
 #include "saim_model_cpu.h"
+#include "varpro_solver.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <stdio.h>
 #include <iostream>
 
@@ -43,7 +51,11 @@
 namespace cpu_model
 {
    CPUModel::CPUModel() {};
-   CPUModel::~CPUModel() {};
+
+   CPUModel::~CPUModel()
+   {
+      DropScratch();
+   };
 
    int CPUModel::RegisterImages(std::vector<cv::Mat> &imStack)
    {
@@ -56,40 +68,159 @@ namespace cpu_model
       return 0;
    }
 
+   int CPUModel::RegisterPixelMajor(const unsigned short *data, int rows, int cols, int frames)
+   {
+      if (_initialized || data == nullptr)
+         return 1;
+      _rawImgs.clear();
+      _external = data;
+      _externalShape[0] = rows;
+      _externalShape[1] = cols;
+      _externalShape[2] = frames;
+      _outputImgs.clear();
+      for (int i = 0; i < 7; i++)
+      {
+         _outputImgs.push_back(cv::Mat(rows, cols, CV_32F));
+      }
+      return 0;
+   }
+
    int CPUModel::SetGrainSize(int grain)
    {
+      if (grain < 1)
+         return 1;
       _grainSize = grain;
+      if (_initialized)
+      {
+         _nGrains = _m % _grainSize == 0 ? _m / _grainSize : _m / _grainSize + 1;
+         _emptyPixels = _m % _grainSize == 0 ? 0 : _grainSize - (_m % _grainSize);
+      }
+      return 0;
+   }
+
+   int CPUModel::SetSolver(SolverType solver)
+   {
+      _solver = solver;
+      return 0;
+   }
+
+   int CPUModel::SetSimdLevel(SimdLevel level)
+   {
+      if (level > DetectSimdLevel())
+         return 1;
+      if (level != _simd)
+         DropScratch();
+      _simd = level;
+      return 0;
+   }
+
+   int CPUModel::SetHeightRange(double hMin, double hMax, double hStep)
+   {
+      if (hStep <= 0.0 || hMax < hMin)
+         return 1;
+      _heightRange[0] = hMin;
+      _heightRange[1] = hMax;
+      _heightRange[2] = hStep;
+      return 0;
+   }
+
+   int CPUModel::SetGridStart(bool enable)
+   {
+      _gridStart = enable;
+      return 0;
+   }
+
+   int CPUModel::SetGuesses(double aScale, double bScale, double h)
+   {
+      _guesses[0] = aScale;
+      _guesses[1] = bScale;
+      _guesses[2] = h;
+      return 0;
+   }
+
+   int CPUModel::SetTolerances(const double *eps, int iterations)
+   {
+      if (iterations < 1)
+         return 1;
+      for (int k = 0; k < 6; k++)
+      {
+         if (!(eps[k] > 0.0))
+            return 1;
+      }
+      for (int k = 0; k < 6; k++)
+         _eps[k] = eps[k];
+      _maxIterations = iterations;
+      return 0;
+   }
+
+   int CPUModel::SetFastSinCos(bool enable)
+   {
+      _fastSinCos = enable;
+      return 0;
+   }
+
+   int CPUModel::SetLazyTiles(bool enable)
+   {
+      if (_initialized)
+         return 1;
+      _lazyTiles = enable;
       return 0;
    }
 
    int CPUModel::InitializeBuffers()
    {
-      _m = _rawImgs[0].rows * _rawImgs[0].cols;
-      _n = _rawImgs.size();
+      DropScratch();
+      if (_rawImgs.empty())
+      {
+         if (_external == nullptr)
+            return 1;
+         _m = _externalShape[0] * _externalShape[1];
+         _n = _externalShape[2];
+      }
+      else
+      {
+         _external = nullptr;
+         _m = _rawImgs[0].rows * _rawImgs[0].cols;
+         _n = _rawImgs.size();
+      }
       _nGrains = _m % _grainSize == 0 ? _m / _grainSize : _m / _grainSize + 1;
       _emptyPixels = _m % _grainSize == 0 ? 0 : _grainSize - (_m % _grainSize);
       _datasz = _m * _n;
       _fnsz = _n;
       _jacsz = _n * 3;
-      _data = (unsigned short *)MKL_malloc(_datasz * sizeof(unsigned short), 64);
-      if (_data == nullptr)
-      {
-         _initialized = false;
-         return 1;
-      }
       _constvec = (double *)MKL_malloc(_n * 3 * sizeof(double), 64);
       if (_constvec == nullptr)
       {
-         mkl_free(_data);
          _initialized = false;
          return 1;
       }
-      for (int i = 0; i < _rawImgs.size(); i++)
+      if (_external != nullptr)
+      {
+         _data = _external;
+      }
+      else if (!_lazyTiles)
       {
-         unsigned short *ptr = _rawImgs[i].ptr<unsigned short>();
-         for (int j = 0; j < _m; j++)
+         unsigned short *data = (unsigned short *)MKL_malloc(_datasz * sizeof(unsigned short), 64);
+         if (data == nullptr)
          {
-            _data[j * _n + i] = *ptr++;
+            mkl_free(_constvec);
+            _constvec = nullptr;
+            _initialized = false;
+            return 1;
+         }
+         for (int j = 0; j < _m; j += TilePixels)
+            TransposeBlock(j, _m - j < TilePixels ? _m - j : TilePixels, data + (size_t)j * _n);
+         _data = data;
+      }
+      _iterations.assign(_m, 0);
+      _seriesPrevious = false;
+      if (_series)
+      {
+         _seriesFrames = (unsigned short *)MKL_malloc(_datasz * sizeof(unsigned short), 64);
+         if (_seriesFrames == nullptr)
+         {
+            ReleaseBuffers();
+            return 1;
          }
       }
       _initialized = true;
@@ -98,102 +229,725 @@ namespace cpu_model
 
    int CPUModel::ReleaseBuffers(void)
    {
-      if (_data != nullptr)
+      if (_data != nullptr && _data != _external)
+         mkl_free((void *)_data);
+      _data = nullptr;
+      if (_seriesFrames != nullptr)
       {
-         mkl_free(_data);
-         _data = nullptr;
+         mkl_free(_seriesFrames);
+         _seriesFrames = nullptr;
       }
+      _seriesPrevious = false;
       if (_constvec != nullptr)
       {
          mkl_free(_constvec);
          _constvec = nullptr;
       }
+      DropScratch();
+      if (_basis != nullptr)
+      {
+         delete _basis;
+         _basis = nullptr;
+      }
       _initialized = false;
       return 0;
    }
 
-   int CPUModel::CalculateConstants(double wavelength, double dOx, double nB, double nOx, double nSi, double *angles)
+   int CPUModel::UpdateImages(std::vector<cv::Mat> &imStack)
    {
-      double angleOx, angleSi, pB, pOx, pSi, kOx, m11, m12, m21, m22;
-      std::complex<double> num, denom, rTE;
-      for (int i = 0; i < _n; i++)
+      if (!_initialized || _external != nullptr || (int)imStack.size() != _n)
+         return 1;
+      int m = imStack[0].rows * imStack[0].cols;
+      unsigned short *data = (unsigned short *)_data;
+      if (data != nullptr && m > _m)
+      {
+         mkl_free(data);
+         _data = data = (unsigned short *)MKL_malloc((size_t)m * _n * sizeof(unsigned short), 64);
+         if (data == nullptr)
+         {
+            ReleaseBuffers();
+            return 1;
+         }
+      }
+      _rawImgs = imStack;
+      bool sameShape = _outputImgs[0].rows == _rawImgs[0].rows && _outputImgs[0].cols == _rawImgs[0].cols;
+      if (!sameShape)
+      {
+         _outputImgs.clear();
+         for (int i = 0; i < 7; i++)
+            _outputImgs.push_back(cv::Mat(_rawImgs[0].rows, _rawImgs[0].cols, CV_32F));
+      }
+      //A time series keeps the last timepoint's results to copy and start
+      //from, otherwise skipped pixels must not keep the previous band's
+      _seriesPrevious = _series && sameShape;
+      if (!_seriesPrevious)
+      {
+         for (int i = 0; i < 7; i++)
+            _outputImgs[i].setTo(0);
+      }
+      if (_series && m > _m)
       {
-         angleOx = asin(sin(angles[i]) * nB / nOx);
-         angleSi = asin(sin(angleOx) * nOx / nSi);
-         kOx = 2.0 * CV_PI * nOx / wavelength;
-         pB = nB * cos(angles[i]);
-         pOx = nOx * cos(angleOx);
-         pSi = nSi * cos(angleSi);
-         m11 = cos(kOx * dOx * cos(angleOx));
-         m12 = -1.0 / pOx * sin(kOx * dOx * cos(angleOx));
-         m21 = -pOx * sin(kOx * dOx * cos(angleOx));
-         m22 = m11;
-         num = std::complex<double>(m11 * pB - m22 * pSi, m12 * pSi * pB - m21);
-         denom = std::complex<double>(m11 * pB + m22 * pSi, m12 * pSi * pB + m21);
-         rTE = num / denom;
-         _constvec[i * 3] = rTE.real();
-         _constvec[i * 3 + 1] = rTE.imag();
-         _constvec[i * 3 + 2] = 4 * CV_PI * nB * cos(angles[i]) / wavelength;
+         mkl_free(_seriesFrames);
+         _seriesFrames = (unsigned short *)MKL_malloc((size_t)m * _n * sizeof(unsigned short), 64);
+         if (_seriesFrames == nullptr)
+         {
+            ReleaseBuffers();
+            return 1;
+         }
+      }
+      _m = m;
+      if (!_seriesPrevious)
+         _iterations.assign(_m, 0);
+      _nGrains = _m % _grainSize == 0 ? _m / _grainSize : _m / _grainSize + 1;
+      _emptyPixels = _m % _grainSize == 0 ? 0 : _grainSize - (_m % _grainSize);
+      _datasz = _m * _n;
+      if (data != nullptr)
+      {
+         for (int j = 0; j < _m; j += TilePixels)
+            TransposeBlock(j, _m - j < TilePixels ? _m - j : TilePixels, data + (size_t)j * _n);
       }
       return 0;
    }
 
+   int CPUModel::CalculateConstants(double wavelength, double dOx, double nB, double nOx, double nSi, double *angles)
+   {
+      return CalculateConstants(SingleOxideStack(wavelength, dOx, nB, nOx, nSi), angles);
+   }
+
+   int CPUModel::CalculateConstants(const OpticalStack &stack, const double *angles)
+   {
+      if (_constvec == nullptr)
+         return 1;
+      std::vector<double> constants(3 * _n);
+      if (CalculateOpticalConstants(stack, angles, _n, constants.data()))
+         return 1;
+      //The same chip, angles and height grid as last time leave the solvers
+      //and the basis built on the constants valid
+      size_t bytes = constants.size() * sizeof(double);
+      if (_basis != nullptr && memcmp(_constvec, constants.data(), bytes) == 0 &&
+         memcmp(_basisRange, _heightRange, sizeof(_heightRange)) == 0)
+         return 0;
+      memcpy(_constvec, constants.data(), bytes);
+      memcpy(_basisRange, _heightRange, sizeof(_heightRange));
+      DropScratch();
+      if (_basis != nullptr)
+         delete _basis;
+      _basis = new HeightBasis(_n, _constvec, _heightRange[0], _heightRange[1], _heightRange[2]);
+      return 0;
+   }
+
    int CPUModel::RunFit(void)
    {
       FitTask task(this, _n, 0, 1);
-      for (int i = 0; i < _m; i++)
-         task(i);
+      _diagnostics.BeginFit(_outputImgs[0].rows, _outputImgs[0].cols);
+      FitScratch &scratch = SerialScratch();
+      if (Classifying())
+      {
+         if (scratch.Prepare(this))
+            return 1;
+         _classes.resize(_m);
+         for (int t = 0; t < (_m + TilePixels - 1) / TilePixels; t++)
+            ClassifyTile(t, scratch.tile);
+         CompactFitIndex();
+      }
+      //The whole image as one range on the calling thread, so the serial fit
+      //gives the same results as the parallel ones
+      task.Fit(0, WorkItems(), scratch);
+      MKL_Free_Buffers();
+      MergeTraces(true);
       return 0;
    }
 
-   int CPUModel::ParforRunFit(void)
+   int CPUModel::ParallelRunFit(void)
+   {
+#ifdef SAIM_WITH_TBB
+      return ParforRunFit();
+#else
+      return ThreadedRunFit();
+#endif
+   }
+
+   void CPUModel::MergeTraces(bool keep)
+   {
+      auto merge = [this, keep](FitScratch *scratch)
+      {
+         if (scratch == nullptr)
+            return;
+         if (keep)
+            _diagnostics.Merge(scratch->trace);
+         else
+            scratch->trace.clear();
+      };
+      merge(_serialScratch);
+      for (FitScratch *scratch : _workerScratch)
+         merge(scratch);
+#ifdef SAIM_WITH_TBB
+      MergeTbbTraces(keep);
+#endif
+   }
+
+   int CPUModel::SolverGrain(int grain) const
+   {
+      if (WarmActive())
+         return 1;
+      if (_solver != SolverType::SOLVER_BATCHED_LM && _solver != SolverType::SOLVER_FLOAT_LM)
+         return grain;
+      const int lanes = _solver == SolverType::SOLVER_FLOAT_LM ? FloatLMSolver::LanesFor(_simd) :
+         BatchLMSolver::LanesFor(_simd);
+      return (grain + lanes - 1) / lanes * lanes;
+   }
+
+   int CPUModel::ThreadedRunFit(void)
    {
-      std::chrono::high_resolution_clock::time_point earlier, later;
-      std::chrono::duration<double> timeTaken;
-      earlier = std::chrono::high_resolution_clock::now();
+      if (!_initialized)
+         return 1;
       FitTask task(this, _n, 0, 1);
-      tbb::parallel_for(tbb::blocked_range<int>(0, _m), FitTask(this, _n, 0, 1));
-      later = std::chrono::high_resolution_clock::now();
-      timeTaken = later - earlier;
-      std::cout << "Took " << std::chrono::duration_cast<std::chrono::milliseconds>(timeTaken).count() << std::endl;
+      _pixelsDone = 0;
+      _diagnostics.BeginFit(_outputImgs[0].rows, _outputImgs[0].cols);
+      ClassifyParallel();
+      const int work = WorkItems();
+      //Whole seed tiles, so no tile is seeded twice
+      const int tile = SolverGrain((_grainSize + TilePixels - 1) / TilePixels * TilePixels);
+      const int tiles = (work + tile - 1) / tile;
+      RunOnPool(tiles, [&](int worker, int item)
+      {
+         int first = item * tile;
+         int last = first + tile < work ? first + tile : work;
+         task.Fit(first, last, WorkerScratch(worker));
+         _pixelsDone.fetch_add(last - first, std::memory_order_relaxed);
+      });
+      _schedule[0] = tiles;
+      _schedule[1] = _pool.Stolen();
+      //The workers keep MKL's per-thread buffers alive between tiles
+      MKL_Free_Buffers();
+      MergeTraces(true);
       return 0;
    }
 
-   int CPUModel::ThreadedRunFit(void)
+   int CPUModel::SetThreadCount(int threads)
+   {
+      DropWorkerScratch();
+      return _pool.SetWorkers(threads);
+   }
+
+   int CPUModel::SetThreadPinning(bool pin)
+   {
+      DropWorkerScratch();
+      return _pool.SetPinning(pin);
+   }
+
+   int CPUModel::GetScheduling(int *tiles, int *stolen) const
+   {
+      *tiles = _schedule[0];
+      *stolen = _schedule[1];
+      return 0;
+   }
+
+   CPUModel::FitScratch &CPUModel::WorkerScratch(int worker)
+   {
+      if (_workerScratch[worker] == nullptr)
+         _workerScratch[worker] = new FitScratch();
+      return *_workerScratch[worker];
+   }
+
+   CPUModel::FitScratch &CPUModel::SerialScratch(void)
+   {
+      if (_serialScratch == nullptr)
+         _serialScratch = new FitScratch();
+      return *_serialScratch;
+   }
+
+   void CPUModel::RunOnPool(int items, const std::function<void(int worker, int item)> &body)
+   {
+      _workerScratch.resize(_pool.Workers(), nullptr);
+      _pool.Run(items, body);
+   }
+
+   void CPUModel::ForEachTile(const std::function<void(FitScratch &scratch, int tile)> &body)
+   {
+      const int tiles = (_m + TilePixels - 1) / TilePixels;
+#ifdef SAIM_WITH_TBB
+      TbbForEachTile(tiles, body);
+#else
+      RunOnPool(tiles, [this, &body](int worker, int tile) { body(WorkerScratch(worker), tile); });
+#endif
+   }
+
+   void CPUModel::DropScratch(void)
+   {
+      delete _serialScratch;
+      _serialScratch = nullptr;
+      DropWorkerScratch();
+#ifdef SAIM_WITH_TBB
+      DropTbbState();
+#endif
+   }
+
+   void CPUModel::DropWorkerScratch(void)
+   {
+      for (size_t w = 0; w < _workerScratch.size(); w++)
+         delete _workerScratch[w];
+      _workerScratch.clear();
+   }
+
+   int CPUModel::GetProgress(int *done, int *total) const
+   {
+      *done = _pixelsDone.load(std::memory_order_relaxed);
+      *total = WorkItems();
+      return 0;
+   }
+
+   int CPUModel::SetPixelClassifier(bool enable, double minMean, double minVariance, double minPeakToPeak, int saturation)
+   {
+      if (saturation < 1)
+         return 1;
+      _classify = enable;
+      _classThresholds[0] = minMean;
+      _classThresholds[1] = minVariance;
+      _classThresholds[2] = minPeakToPeak;
+      _saturation = saturation;
+      return 0;
+   }
+
+   int CPUModel::GetPixelClasses(int *fit, int *background, int *saturated, int *unchanged) const
+   {
+      *fit = _classCounts[(int)PixelClass::PIXEL_FIT];
+      *background = _classCounts[(int)PixelClass::PIXEL_BACKGROUND];
+      *saturated = _classCounts[(int)PixelClass::PIXEL_SATURATED];
+      if (unchanged != nullptr)
+         *unchanged = _classCounts[(int)PixelClass::PIXEL_UNCHANGED];
+      return 0;
+   }
+
+   int CPUModel::SetTimeSeries(bool enable, double threshold)
+   {
+      if (threshold < 0.0)
+         return 1;
+      _series = enable;
+      _seriesThreshold = threshold;
+      _seriesPrevious = false;
+      if (!_series && _seriesFrames != nullptr)
+      {
+         mkl_free(_seriesFrames);
+         _seriesFrames = nullptr;
+      }
+      if (_series && _initialized && _seriesFrames == nullptr)
+      {
+         _seriesFrames = (unsigned short *)MKL_malloc((size_t)_m * _n * sizeof(unsigned short), 64);
+         if (_seriesFrames == nullptr)
+            return 1;
+      }
+      return 0;
+   }
+
+   CPUModel::PixelClass CPUModel::SeriesClass(int pixel, const unsigned short *data)
+   {
+      unsigned short *reference = _seriesFrames + (size_t)pixel * _n;
+      //Only pixels fit at the last timepoint have frames to compare against,
+      //_classes still holds their last class at this point
+      unsigned char last = _classes[pixel];
+      if (_seriesPrevious && (last == (unsigned char)PixelClass::PIXEL_FIT || last == (unsigned char)PixelClass::PIXEL_UNCHANGED))
+      {
+         double change{ 0.0 };
+#pragma omp simd reduction(+:change)
+         for (int j = 0; j < _n; j++)
+         {
+            double diff = (double)data[j] - (double)reference[j];
+            change += diff * diff / ((double)data[j] + (double)reference[j] + 1.0);
+         }
+         if (change / _n <= _seriesThreshold)
+            return PixelClass::PIXEL_UNCHANGED;
+      }
+      memcpy(reference, data, _n * sizeof(unsigned short));
+      return PixelClass::PIXEL_FIT;
+   }
+
+   void CPUModel::SeriesStart(int pixel, const unsigned short *data, double *xvec) const
    {
+      //Only converged solutions are worth starting from
+      if (*(_outputImgs[3].ptr<float>() + pixel) <= 1.0f)
+         return;
+      SeedFromHeight(data, *(_outputImgs[2].ptr<float>() + pixel), xvec);
+   }
+
+   bool CPUModel::SeedFromHeight(const unsigned short *data, double height, double *xvec) const
+   {
+      double sg{ 0.0 }, sgg{ 0.0 }, sy{ 0.0 }, syy{ 0.0 }, sgy{ 0.0 }, startCost{ 0.0 };
+      for (int j = 0; j < _n; j++)
+      {
+         double c{ _constvec[3 * j] }, d{ _constvec[3 * j + 1] }, phi{ _constvec[3 * j + 2] };
+         double g = 1.0 + 2.0 * c * cos(phi * height) - 2.0 * d * sin(phi * height) + c * c + d * d;
+         double gStart = 1.0 + 2.0 * c * cos(phi * xvec[2]) - 2.0 * d * sin(phi * xvec[2]) + c * c + d * d;
+         double value = data[j];
+         double residual = value - xvec[0] * gStart - xvec[1];
+         sg += g;
+         sgg += g * g;
+         sy += value;
+         syy += value * value;
+         sgy += g * value;
+         startCost += residual * residual;
+      }
+      double det = _n * sgg - sg * sg;
+      if (det <= 0.0)
+         return false;
+      double A = (_n * sgy - sg * sy) / det;
+      double B = (sy - A * sg) / _n;
+      double cost = syy - 2.0 * A * sgy - 2.0 * B * sy + A * A * sgg + 2.0 * A * B * sg + _n * B * B;
+      if (!(cost < startCost))
+         return false;
+      xvec[0] = A;
+      xvec[1] = B;
+      xvec[2] = height;
+      return true;
+   }
+
+   int CPUModel::SetWarmStart(WarmStartOrder order)
+   {
+      _warmStart = order;
+      _warmOrder.resize(WarmBlock * WarmBlock);
+      for (int d = 0; d < WarmBlock * WarmBlock; d++)
+      {
+         int x{ d % WarmBlock }, y{ d / WarmBlock };
+         if (order == WarmStartOrder::WARM_START_HILBERT)
+         {
+            //Hilbert curve index to (x, y), consecutive pixels stay adjacent
+            x = y = 0;
+            for (int s = 1, t = d; s < WarmBlock; s *= 2, t /= 4)
+            {
+               int rx = 1 & (t / 2);
+               int ry = 1 & (t ^ rx);
+               if (ry == 0)
+               {
+                  if (rx == 1)
+                  {
+                     x = s - 1 - x;
+                     y = s - 1 - y;
+                  }
+                  std::swap(x, y);
+               }
+               x += s * rx;
+               y += s * ry;
+            }
+         }
+         _warmOrder[d] = y * WarmBlock + x;
+      }
       return 0;
    }
+
+   int CPUModel::WorkItems(void) const
+   {
+      if (!WarmActive())
+         return WorkCount();
+      int rows = _outputImgs[0].rows, cols = _outputImgs[0].cols;
+      return ((rows + WarmBlock - 1) / WarmBlock) * ((cols + WarmBlock - 1) / WarmBlock);
+   }
+
+   void CPUModel::ClassifyTile(int tile, unsigned short *buffer)
+   {
+      const int first = tile * TilePixels;
+      const int count = _m - first < TilePixels ? _m - first : TilePixels;
+      const unsigned short *data = LoadTile(first, count, buffer);
+      const int n = _n;
+      for (int p = 0; p < count; p++)
+      {
+         //Integer sums are exact and vectorize across the frames
+         const unsigned short *y = data + (size_t)p * n;
+         unsigned int sum{ 0 }, low{ 65535 }, high{ 0 };
+         unsigned long long sumSq{ 0 };
+#pragma omp simd reduction(+:sum, sumSq) reduction(min:low) reduction(max:high)
+         for (int j = 0; j < n; j++)
+         {
+            unsigned int value = y[j];
+            sum += value;
+            sumSq += (unsigned long long)value * value;
+            low = value < low ? value : low;
+            high = value > high ? value : high;
+         }
+         double mean = (double)sum / n;
+         double variance = (double)sumSq / n - mean * mean;
+         int pixel = first + p;
+         PixelClass pixelClass = PixelClass::PIXEL_FIT;
+         if (_classify && (int)high >= _saturation)
+            pixelClass = PixelClass::PIXEL_SATURATED;
+         else if (_classify && (mean < _classThresholds[0] || variance < _classThresholds[1] || (double)(high - low) < _classThresholds[2]))
+            pixelClass = PixelClass::PIXEL_BACKGROUND;
+         if (pixelClass == PixelClass::PIXEL_FIT && _series)
+            pixelClass = SeriesClass(pixel, y);
+         _classes[pixel] = (unsigned char)pixelClass;
+         if (pixelClass == PixelClass::PIXEL_FIT)
+            continue;
+         //Unchanged pixels keep the last timepoint's results
+         _iterations[pixel] = 0;
+         if (pixelClass == PixelClass::PIXEL_UNCHANGED)
+            continue;
+         *(_outputImgs[0].ptr<float>() + pixel) = 0.0f;
+         *(_outputImgs[1].ptr<float>() + pixel) = (float)mean;
+         *(_outputImgs[2].ptr<float>() + pixel) = std::numeric_limits<float>::quiet_NaN();
+         *(_outputImgs[3].ptr<float>() + pixel) = pixelClass == PixelClass::PIXEL_SATURATED ? -2.0f : -1.0f;
+         *(_outputImgs[4].ptr<float>() + pixel) = 0.0f;
+         *(_outputImgs[5].ptr<float>() + pixel) = 0.0f;
+         *(_outputImgs[6].ptr<float>() + pixel) = 0.0f;
+      }
+   }
+
+   void CPUModel::ClassifyParallel(void)
+   {
+      if (!Classifying())
+         return;
+      _classes.resize(_m);
+      ForEachTile([this](FitScratch &scratch, int tile)
+      {
+         if (scratch.Prepare(this) == 0)
+            ClassifyTile(tile, scratch.tile);
+      });
+      CompactFitIndex();
+   }
+
+   void CPUModel::CompactFitIndex(void)
+   {
+      _fitIndex.clear();
+      _fitIndex.reserve(_m);
+      _classCounts[0] = _classCounts[1] = _classCounts[2] = _classCounts[3] = 0;
+      for (int p = 0; p < _m; p++)
+      {
+         _classCounts[_classes[p]]++;
+         if (_classes[p] == (unsigned char)PixelClass::PIXEL_FIT)
+            _fitIndex.push_back(p);
+      }
+   }
    
    int CPUModel::CalculateFunction(int pixel, double *xvec, double *fvec)
    {
+      return CalculateFunction(_data + (size_t)pixel * _n, xvec, fvec);
+   }
+
+   int CPUModel::CalculateFunction(const unsigned short *data, double *xvec, double *fvec)
+   {
+      switch (KernelFrames())
+      {
+      case 16:
+         FunctionKernel<16>(data, xvec, fvec);
+         break;
+      case 31:
+         FunctionKernel<31>(data, xvec, fvec);
+         break;
+      case 32:
+         FunctionKernel<32>(data, xvec, fvec);
+         break;
+      case 64:
+         FunctionKernel<64>(data, xvec, fvec);
+         break;
+      default:
+         FunctionKernel<0>(data, xvec, fvec);
+      }
+      return 0;
+   }
+
+   int CPUModel::CalculateJacobian(int pixel, double *xvec, double *jvec)
+   {
+      switch (KernelFrames())
+      {
+      case 16:
+         JacobianKernel<16>(xvec, jvec);
+         break;
+      case 31:
+         JacobianKernel<31>(xvec, jvec);
+         break;
+      case 32:
+         JacobianKernel<32>(xvec, jvec);
+         break;
+      case 64:
+         JacobianKernel<64>(xvec, jvec);
+         break;
+      default:
+         JacobianKernel<0>(xvec, jvec);
+      }
+      return 0;
+   }
+
+   int CPUModel::SetFrameKernels(bool enable)
+   {
+      _frameKernels = enable;
+      return 0;
+   }
+
+   int CPUModel::KernelFrames(void) const
+   {
+      int n = _n;
+      if (_frameKernels && (n == 16 || n == 31 || n == 32 || n == 64))
+         return n;
+      return 0;
+   }
+
+   template <int N>
+   void CPUModel::FunctionKernel(const unsigned short *data, const double *xvec, double *fvec) const
+   {
+      static_assert(N <= SinCosChunk, "fixed frame kernels take their phases in one chunk");
+      const int n = N > 0 ? N : _n;
       double A{ xvec[0] }, B{ xvec[1] }, H{ xvec[2] };
+      double sinv[SinCosChunk], cosv[SinCosChunk];
       //double *dataVec = new double[_n];
       //double *funVec = new double[_n];
-      for (int i = 0; i < _n; i++)
+      for (int first = 0; first < n; first += SinCosChunk)
       {
-         double c{ _constvec[3 * i] }, d{ _constvec[3 * i + 1] }, phi{ _constvec[3 * i + 2] };
-         double value = A * (1.0 + 2.0 * c * cos(phi * H) - 2.0 * d * sin(phi * H) + c * c + d * d) + B;
-         fvec[i] = (double)_data[_n * pixel + i] - value;
-         //dataVec[i] = (double)_data[_n * pixel + i];
-         //funVec[i] = value;
+         int count = n - first < SinCosChunk ? n - first : SinCosChunk;
+         PhaseSinCos(first, count, H, sinv, cosv);
+         for (int j = 0; j < count; j++)
+         {
+            int i = first + j;
+            double c{ _constvec[3 * i] }, d{ _constvec[3 * i + 1] };
+            double value = A * (1.0 + 2.0 * c * cosv[j] - 2.0 * d * sinv[j] + c * c + d * d) + B;
+            fvec[i] = (double)data[i] - value;
+            //dataVec[i] = (double)data[i];
+            //funVec[i] = value;
+         }
       }
       //delete[] dataVec;
       //delete[] funVec;
-      return 0;
    }
 
-   int CPUModel::CalculateJacobian(int pixel, double *xvec, double *jvec)
+   template <int N>
+   void CPUModel::JacobianKernel(const double *xvec, double *jvec) const
    {
+      static_assert(N <= SinCosChunk, "fixed frame kernels take their phases in one chunk");
+      const int n = N > 0 ? N : _n;
       double A{ xvec[0] }, H{ xvec[2] };
-      for (int i = 0; i < _n; i++)
+      double sinv[SinCosChunk], cosv[SinCosChunk];
+      for (int first = 0; first < n; first += SinCosChunk)
+      {
+         int count = n - first < SinCosChunk ? n - first : SinCosChunk;
+         PhaseSinCos(first, count, H, sinv, cosv);
+         for (int j = 0; j < count; j++)
+         {
+            int i = first + j;
+            double c{ _constvec[3 * i] }, d{ _constvec[3 * i + 1] }, phi{ _constvec[3 * i + 2] };
+            jvec[i] = -1.0 * (1.0 + 2.0 * c * cosv[j] - 2.0 * d * sinv[j] + c * c + d * d);
+            jvec[i + n] = -1.0;
+            jvec[i + 2 * n] = 2.0 * A * phi * (c * sinv[j] + d * cosv[j]);
+         }
+      }
+   }
+
+   void CPUModel::PhaseSinCos(int first, int count, double H, double *sinv, double *cosv) const
+   {
+      if (!_fastSinCos)
       {
-         double c{ _constvec[3 * i] }, d{ _constvec[3 * i + 1] }, phi{ _constvec[3 * i + 2] };
-         jvec[i] = -1.0 * (1.0 + 2.0 * c * cos(phi * H) - 2.0 * d * sin(phi * H) + c * c + d * d);
-         jvec[i + _n] = -1.0;
-         jvec[i + 2 * _n] = 2.0 * A * phi * (c * sin(phi * H) + d * cos(phi * H));
+         for (int j = 0; j < count; j++)
+         {
+            double phi{ _constvec[3 * (first + j) + 2] };
+            sinv[j] = sin(phi * H);
+            cosv[j] = cos(phi * H);
+         }
+         return;
       }
+      double phase[SinCosChunk];
+      for (int j = 0; j < count; j++)
+         phase[j] = _constvec[3 * (first + j) + 2] * H;
+      FastSinCos(phase, sinv, cosv, count);
+   }
 
-      return 0;
+   void CPUModel::Statistics(const unsigned short *data, const double *fvec, double B, double *stats) const
+   {
+      switch (KernelFrames())
+      {
+      case 16:
+         FrameStatistics<16>(data, fvec, B, _n, stats);
+         break;
+      case 31:
+         FrameStatistics<31>(data, fvec, B, _n, stats);
+         break;
+      case 32:
+         FrameStatistics<32>(data, fvec, B, _n, stats);
+         break;
+      case 64:
+         FrameStatistics<64>(data, fvec, B, _n, stats);
+         break;
+      default:
+         FrameStatistics<0>(data, fvec, B, _n, stats);
+      }
+   }
+
+   void CPUModel::StoreResults(int pixel, const unsigned short *data, const double *xvec, const double *fvec, int stopCrit, int iterations)
+   {
+      //R2, d and SNR
+      double stats[3];
+      Statistics(data, fvec, xvec[1], stats);
+
+      *(_outputImgs[0].ptr<float>() + pixel) = (float)xvec[0];
+      *(_outputImgs[1].ptr<float>() + pixel) = (float)xvec[1];
+      *(_outputImgs[2].ptr<float>() + pixel) = (float)xvec[2];
+      *(_outputImgs[3].ptr<float>() + pixel) = (float)stopCrit;
+      *(_outputImgs[4].ptr<float>() + pixel) = (float)stats[0];
+      *(_outputImgs[5].ptr<float>() + pixel) = (float)stats[1];
+      *(_outputImgs[6].ptr<float>() + pixel) = (float)stats[2];
+      _iterations[pixel] = iterations;
+   }
+
+   void CPUModel::StartingPoints(GridInitializer *init, const unsigned short *pixels, int count, double *xvec)
+   {
+      if (init != nullptr)
+      {
+         init->Initialize(pixels, count, xvec);
+         return;
+      }
+      for (int p = 0; p < count; p++)
+      {
+         const unsigned short *pixel = pixels + (size_t)p * _n;
+         double maxval = (double)pixel[0];
+         double minval{ maxval };
+         for (int j = 1; j < _n; j++)
+         {
+            double thisval = (double)pixel[j];
+            maxval = maxval < thisval ? thisval : maxval;
+            minval = minval > thisval ? thisval : minval;
+         }
+         xvec[p * 3] = _guesses[0] * (maxval - minval);
+         xvec[p * 3 + 1] = _guesses[1] * minval;
+         xvec[p * 3 + 2] = _guesses[2];
+      }
+   }
+
+   const unsigned short *CPUModel::LoadWork(int first, int count, unsigned short *tile)
+   {
+      if (!Classifying())
+         return LoadTile(first, count, tile);
+      GatherPixels(_fitIndex.data() + first, count, tile);
+      return tile;
+   }
+
+   void CPUModel::GatherPixels(const int *pixels, int count, unsigned short *tile)
+   {
+      for (int p = 0; p < count; p++)
+      {
+         unsigned short *dst = tile + (size_t)p * _n;
+         if (_data != nullptr)
+         {
+            memcpy(dst, _data + (size_t)pixels[p] * _n, _n * sizeof(unsigned short));
+            continue;
+         }
+         for (int i = 0; i < _n; i++)
+            dst[i] = _rawImgs[i].ptr<unsigned short>()[pixels[p]];
+      }
+   }
+
+   const unsigned short *CPUModel::LoadTile(int first, int count, unsigned short *tile)
+   {
+      if (_data != nullptr)
+         return _data + (size_t)first * _n;
+      TransposeBlock(first, count, tile);
+      return tile;
+   }
+
+   void CPUModel::TransposeBlock(int first, int count, unsigned short *dst)
+   {
+      //One short contiguous read per frame, all writes land in a block of
+      //count * _n values that stays in L1
+      for (int i = 0; i < _n; i++)
+      {
+         const unsigned short *src = _rawImgs[i].ptr<unsigned short>() + first;
+         for (int j = 0; j < count; j++)
+            dst[j * _n + i] = src[j];
+      }
    }
 
    std::vector<cv::Mat> CPUModel::GetImages(void)
@@ -201,7 +955,56 @@ namespace cpu_model
       return _outputImgs;
    }
 
-   CPUModel::FitTask::FitTask(CPUModel *parent, int frames, int startIdx, int count) : l_parent(parent), l_nPoints(frames), l_count(count) {}
+   int CPUModel::RecomputeStatistics(const cv::Mat &A, const cv::Mat &B, const cv::Mat &H, std::vector<cv::Mat> &stats)
+   {
+      if (!_initialized || _outputImgs.empty())
+         return 1;
+      const int rows = _outputImgs[0].rows, cols = _outputImgs[0].cols;
+      for (const cv::Mat *map : { &A, &B, &H })
+      {
+         if (map->rows != rows || map->cols != cols || map->type() != CV_32F || !map->isContinuous())
+            return 1;
+      }
+      stats.resize(3);
+      for (cv::Mat &image : stats)
+         image.create(rows, cols, CV_32F);
+
+      ForEachTile([this, &A, &B, &H, &stats](FitScratch &scratch, int tile)
+      {
+         if (scratch.Prepare(this))
+            return;
+         const int first = tile * TilePixels;
+         const int count = _m - first < TilePixels ? _m - first : TilePixels;
+         const unsigned short *data = LoadTile(first, count, scratch.tile);
+         for (int p = 0; p < count; p++)
+         {
+            int pixel = first + p;
+            double xvec[3]{ *(A.ptr<float>() + pixel), *(B.ptr<float>() + pixel), *(H.ptr<float>() + pixel) };
+            double values[3]{ 0.0, 0.0, 0.0 };
+            //Skipped pixels have no height to evaluate the model at
+            if (std::isfinite(xvec[2]))
+            {
+               const unsigned short *pixelData = data + (size_t)p * _n;
+               CalculateFunction(pixelData, xvec, scratch.fvec);
+               Statistics(pixelData, scratch.fvec, xvec[1], values);
+            }
+            for (int k = 0; k < 3; k++)
+               *(stats[k].ptr<float>() + pixel) = (float)values[k];
+         }
+      });
+      return 0;
+   }
+
+   CPUModel::FitTask::FitTask(CPUModel *parent, int frames, int startIdx, int count) : l_parent(parent), l_nPoints(frames), l_count(count)
+   {
+      //The float solver's step and decrease tests stay at float resolution
+      for (int k = 0; k < 6; k++)
+      {
+         l_eps[k] = parent->_eps[k];
+         l_floatEps[k] = k == 3 || k == 4 ? fmax(parent->_eps[k], 0.001) : parent->_eps[k];
+      }
+      l_iterations = parent->_maxIterations;
+   }
 
    CPUModel::FitTask::~FitTask() {}
 
@@ -223,11 +1026,10 @@ namespace cpu_model
          mkl_free(l_fvec);
          return;
       }
-      std::chrono::high_resolution_clock::time_point earlier, later;
-      std::chrono::duration<double> timeTaken;
+      const bool tracing = l_parent->_diagnostics.Enabled();
       for (int i = 0; i < l_count; i++)
       {
-         earlier = std::chrono::high_resolution_clock::now();
+         int64_t started = tracing ? FitDiagnostics::Now() : 0;
 
          l_successful = 0;
          l_xvec[0] = l_parent->_guesses[0];
@@ -284,7 +1086,6 @@ namespace cpu_model
             }
             if (l_rciRequest == 2)
                l_parent->CalculateJacobian(pixel, l_xvec, l_jvec);
-            //std::cout << "RCI cycle: " << _counter++ << std::endl;
             l_counter++;
          }
          if (dtrnlsp_get(&solverHandle, &l_actualIterations, &l_stopCrit, &l_initialRes, &l_finalRes) != TR_SUCCESS)
@@ -300,15 +1101,15 @@ namespace cpu_model
             return;
          }
 
-         *(l_parent->_outputImgs[0].ptr<double>() + pixel) = l_xvec[0];
-         *(l_parent->_outputImgs[1].ptr<double>() + pixel) = l_xvec[1];
-         *(l_parent->_outputImgs[2].ptr<double>() + pixel) = l_xvec[2];
-         *(l_parent->_outputImgs[3].ptr<double>() + pixel) = l_stopCrit;
-         *(l_parent->_outputImgs[4].ptr<double>() + pixel) = l_finalRes;
+         *(l_parent->_outputImgs[0].ptr<float>() + pixel) = (float)l_xvec[0];
+         *(l_parent->_outputImgs[1].ptr<float>() + pixel) = (float)l_xvec[1];
+         *(l_parent->_outputImgs[2].ptr<float>() + pixel) = (float)l_xvec[2];
+         *(l_parent->_outputImgs[3].ptr<float>() + pixel) = (float)l_stopCrit;
+         *(l_parent->_outputImgs[4].ptr<float>() + pixel) = (float)l_finalRes;
 
-         later = std::chrono::high_resolution_clock::now();
-         timeTaken = later - earlier;
-         std::cout << "Pixel " << pixel << " finished " << l_counter << " cycles in " << std::chrono::duration_cast<std::chrono::microseconds>(timeTaken).count() << " microseconds." << std::endl;
+         if (tracing)
+            Trace(l_parent->SerialScratch(), pixel, (int)l_actualIterations, (int)l_counter, (int)l_stopCrit,
+               FitDiagnostics::Now() - started);
       }
       mkl_free(l_xvec);
       mkl_free(l_fvec);
@@ -317,172 +1118,517 @@ namespace cpu_model
       l_xvec = l_fvec = l_jvec = nullptr;
    }
 
-   volatile void CPUModel::FitTask::operator()(const tbb::blocked_range<int> &index) const
+   void CPUModel::FitTask::Fit(int first, int last, FitScratch &scratch) const
    {
-      double *xvec = (double *)mkl_malloc(3 * sizeof(double), 64);
-      if (l_xvec == nullptr)
+      if (scratch.Prepare(l_parent))
          return;
-      double *fvec = (double *)mkl_malloc(l_parent->_fnsz * sizeof(double), 64);
-      if (l_fvec == nullptr)
+      if (l_parent->WarmActive())
       {
-         mkl_free(xvec);
+         for (int block = first; block != last; block++)
+            WarmFit(block, scratch);
          return;
       }
-      double *jvec = (double *)mkl_malloc(l_parent->_jacsz * sizeof(double), 64);
-      if (l_jvec == nullptr)
+      switch (l_parent->_solver)
       {
-         mkl_free(xvec);
-         mkl_free(fvec);
+      case SolverType::SOLVER_BATCHED_LM:
+         BatchFit(first, last, scratch);
+         return;
+      case SolverType::SOLVER_VARPRO:
+         VarProFit(first, last, scratch);
+         return;
+      case SolverType::SOLVER_FLOAT_LM:
+         FloatFit(first, last, scratch);
+         return;
+      default:
+         MklFit(first, last, scratch);
          return;
       }
-      int fitInfo[6]{ 0, 0, 0, 0, 0, 0 };
-      std::chrono::high_resolution_clock::time_point earlier, later;
-      std::chrono::duration<double> timeTaken;
-      for (size_t i = index.begin(); i != index.end(); i++)
+   }
+
+   void CPUModel::FitTask::MklFit(int first, int last, FitScratch &scratch) const
+   {
+      double *xvec = scratch.xvec, *fvec = scratch.fvec, *jvec = scratch.jvec, *starts = scratch.starts;
+      const int tile = TilePixels;
+      const bool tracing = l_parent->_diagnostics.Enabled();
+      const unsigned short *tileData{ nullptr };
+      int tileFirst{ 0 };
+      for (int i = first; i != last; i++)
       {
-         if (l_parent->_data[i * l_nPoints] == 0)
+         if (i == first || i % tile == 0)
+            tileFirst = SeedTile(i, scratch, &tileData);
+         int offset = i - tileFirst;
+         const unsigned short *pixelData = tileData + offset * l_nPoints;
+         if (pixelData[0] == 0)
             continue;
-         earlier = std::chrono::high_resolution_clock::now();
-         double maxval = (double)l_parent->_data[i * l_nPoints];
-         double minval{ maxval };
-         for (int j = 0; j < l_nPoints; j++)
-         {
-            fvec[j] = 0;
-            jvec[j] = 0;
-            jvec[j + l_nPoints] = 0;
-            jvec[j + l_nPoints * 2] = 0;
-            double thisval = (double)l_parent->_data[i * l_nPoints + j];
-            maxval = maxval < thisval ? thisval : maxval;
-            minval = minval > thisval ? thisval : minval;
-         }
+         xvec[0] = starts[offset * 3];
+         xvec[1] = starts[offset * 3 + 1];
+         xvec[2] = starts[offset * 3 + 2];
+         int pixel = l_parent->PixelAt(i);
+         if (l_parent->_seriesPrevious)
+            l_parent->SeriesStart(pixel, pixelData, xvec);
+         int iterations{ 0 }, cycles{ 0 };
+         int64_t started = tracing ? FitDiagnostics::Now() : 0;
+         int stopCrit = MklSolve(pixel, pixelData, xvec, fvec, jvec, &iterations, &cycles);
+         if (stopCrit == 0)
+            return;
+         if (tracing)
+            Trace(scratch, pixel, iterations, cycles, stopCrit, FitDiagnostics::Now() - started);
+         l_parent->StoreResults(pixel, pixelData, xvec, fvec, stopCrit, iterations);
+      }
+   }
 
-         int successful = 0;
-         xvec[0] = l_parent->_guesses[0] * (maxval - minval);
-         xvec[1] = l_parent->_guesses[1] * minval;
-         xvec[2] = l_parent->_guesses[2];
-         int pixel = i;
+   int CPUModel::FitTask::MklSolve(int pixel, const unsigned short *pixelData, double *xvec, double *fvec, double *jvec, int *iterations,
+      int *cycles) const
+   {
+      int fitInfo[6]{ 0, 0, 0, 0, 0, 0 };
+      for (int j = 0; j < l_nPoints; j++)
+      {
+         fvec[j] = 0;
+         jvec[j] = 0;
+         jvec[j + l_nPoints] = 0;
+         jvec[j + l_nPoints * 2] = 0;
+      }
 
-         _TRNSP_HANDLE_t solverHandle;
+      _TRNSP_HANDLE_t solverHandle;
 
-         if (dtrnlsp_init(&solverHandle, &l_nVars, &l_nPoints, xvec, l_eps, &l_iterations, &l_stepIterations, &l_initialStep) != TR_SUCCESS)
+      if (dtrnlsp_init(&solverHandle, &l_nVars, &l_nPoints, xvec, l_eps, &l_iterations, &l_stepIterations, &l_initialStep) != TR_SUCCESS)
+      {
+         std::cerr << "Error initializing solver" << std::endl;
+         MKL_Thread_Free_Buffers();
+         return 0;
+      }
+      if (dtrnlsp_check(&solverHandle, &l_nVars, &l_nPoints, jvec, fvec, l_eps, fitInfo) != TR_SUCCESS)
+      {
+         std::cerr << "Error checking solver" << std::endl;
+         MKL_Thread_Free_Buffers();
+         return 0;
+      }
+      else
+      {
+         if (fitInfo[0] != 0 ||
+            fitInfo[1] != 0 ||
+            fitInfo[2] != 0 ||
+            fitInfo[3] != 0)
          {
-            std::cerr << "Error initializing solver" << std::endl;
+            std::cerr << "Invalid array passed to solver: " << fitInfo[0] << fitInfo[1] << fitInfo[2] << fitInfo[3] << std::endl;
             MKL_Thread_Free_Buffers();
-            return;
+            return 0;
          }
-         if (dtrnlsp_check(&solverHandle, &l_nVars, &l_nPoints, jvec, fvec, l_eps, fitInfo) != TR_SUCCESS)
+      }
+      int successful = 0;
+      int rciRequest = 0;
+      *cycles = 0;
+      while (successful == 0)
+      {
+         if (dtrnlsp_solve(&solverHandle, fvec, jvec, &rciRequest) != TR_SUCCESS)
          {
-            std::cerr << "Error checking solver" << std::endl;
+            std::cerr << "Error solving solver" << std::endl;
             MKL_Thread_Free_Buffers();
-            return;
+            return 0;
          }
-         else
+         if (rciRequest == -1 ||
+            rciRequest == -2 ||
+            rciRequest == -3 ||
+            rciRequest == -4 ||
+            rciRequest == -5 ||
+            rciRequest == -6)
+            successful = 1;
+         if (rciRequest == 1)
+            l_parent->CalculateFunction(pixelData, xvec, fvec);
+         if (rciRequest == 2)
+            l_parent->CalculateJacobian(pixel, xvec, jvec);
+         (*cycles)++;
+      }
+      MKL_INT actualIterations{ 0 };
+      MKL_INT stopCrit{ 0 };
+      double initialRes{ 0 }, finalRes{ 0 };
+      if (dtrnlsp_get(&solverHandle, &actualIterations, &stopCrit, &initialRes, &finalRes) != TR_SUCCESS)
+      {
+         std::cerr << "Error getting solver results" << std::endl;
+         MKL_Thread_Free_Buffers();
+         return 0;
+      }
+      if (dtrnlsp_delete(&solverHandle) != TR_SUCCESS)
+      {
+         std::cerr << "Error deleting the solver" << std::endl;
+         MKL_Thread_Free_Buffers();
+         return 0;
+      }
+      *iterations = (int)actualIterations;
+      return (int)stopCrit;
+   }
+
+   void CPUModel::FitTask::BatchFit(int first, int last, FitScratch &scratch) const
+   {
+      BatchLMSolver &solver = *scratch.batch;
+      const int lanes = solver.Lanes();
+      solver.SetTolerances(l_eps, l_iterations);
+      double *xvec = scratch.xvec, *fvec = scratch.fvec, *starts = scratch.starts;
+      const int tile = TilePixels;
+      const unsigned short *tileData{ nullptr };
+      const int maxLanes = BatchLMSolver::MaxLanes;
+      const unsigned short *pixels[maxLanes];
+      int batch[maxLanes], stopCrit[maxLanes], iterations[maxLanes];
+      int count = 0, tileFirst = 0;
+      const bool tracing = l_parent->_diagnostics.Enabled();
+      for (int i = first; i != last; i++)
+      {
+         if (i == first || i % tile == 0)
+            tileFirst = SeedTile(i, scratch, &tileData);
+         int offset = i - tileFirst;
+         const unsigned short *pixel = tileData + offset * l_nPoints;
+         if (pixel[0] != 0)
          {
-            if (fitInfo[0] != 0 ||
-               fitInfo[1] != 0 ||
-               fitInfo[2] != 0 ||
-               fitInfo[3] != 0)
-            {
-               std::cerr << "Invalid array passed to solver: " << fitInfo[0] << fitInfo[1] << fitInfo[2] << fitInfo[3] << std::endl;
-               MKL_Thread_Free_Buffers();
-               return;
-            }
+            xvec[count * 3] = starts[offset * 3];
+            xvec[count * 3 + 1] = starts[offset * 3 + 1];
+            xvec[count * 3 + 2] = starts[offset * 3 + 2];
+            pixels[count] = pixel;
+            batch[count] = l_parent->PixelAt(i);
+            if (l_parent->_seriesPrevious)
+               l_parent->SeriesStart(batch[count], pixel, xvec + count * 3);
+            count++;
          }
-         successful = 0;
-         int counter = 0;
-         int rciRequest = 0;
-         while (successful == 0)
+         //Flush at the end of each tile, the next tile may reuse the buffer
+         if (count == lanes || (count > 0 && (i + 1 == last || offset == tile - 1)))
          {
-            if (dtrnlsp_solve(&solverHandle, fvec, jvec, &rciRequest) != TR_SUCCESS)
+            int64_t started = tracing ? FitDiagnostics::Now() : 0;
+            solver.Solve(pixels, count, xvec, fvec, stopCrit, iterations);
+            //The lanes share the batch's time
+            int64_t share = tracing ? (FitDiagnostics::Now() - started) / count : 0;
+            for (int l = 0; l < count; l++)
             {
-               std::cerr << "Error solving solver" << std::endl;
-               MKL_Thread_Free_Buffers();
-               return;
+               if (tracing)
+                  Trace(scratch, batch[l], iterations[l], 0, stopCrit[l], share);
+               l_parent->StoreResults(batch[l], pixels[l], xvec + l * 3, fvec + l * l_nPoints, stopCrit[l], iterations[l]);
             }
-            if (rciRequest == -1 ||
-               rciRequest == -2 ||
-               rciRequest == -3 ||
-               rciRequest == -4 ||
-               rciRequest == -5 ||
-               rciRequest == -6)
-               successful = 1;
-            if (rciRequest == 1)
-               l_parent->CalculateFunction(pixel, xvec, fvec);
-            if (rciRequest == 2)
-               l_parent->CalculateJacobian(pixel, xvec, jvec);
-            //std::cout << "RCI cycle: " << _counter++ << std::endl;
+            count = 0;
          }
-         MKL_INT actualIterations{ 0 };
-         MKL_INT stopCrit{ 0 };
-         double initialRes{ 0 }, finalRes{ 0 };
-         if (dtrnlsp_get(&solverHandle, &actualIterations, &stopCrit, &initialRes, &finalRes) != TR_SUCCESS)
+      }
+   }
+
+   void CPUModel::FitTask::FloatFit(int first, int last, FitScratch &scratch) const
+   {
+      FloatLMSolver &solver = *scratch.floatBatch;
+      BatchLMSolver &polish = *scratch.batch;
+      const int lanes = solver.Lanes(), polishLanes = polish.Lanes();
+      solver.SetTolerances(l_floatEps, l_iterations);
+      polish.SetTolerances(l_eps, l_iterations);
+      double *xvec = scratch.xvec, *fvec = scratch.fvec, *starts = scratch.starts;
+      double *polishF = fvec + lanes * l_nPoints;
+      const int tile = TilePixels;
+      const bool tracing = l_parent->_diagnostics.Enabled();
+      const unsigned short *tileData{ nullptr };
+      const int maxLanes = FloatLMSolver::MaxLanes, maxPolish = BatchLMSolver::MaxLanes;
+      const unsigned short *pixels[maxLanes], *polishPixels[maxPolish];
+      int batch[maxLanes], stopCrit[maxLanes], iterations[maxLanes];
+      int polishLane[maxPolish], polishStop[maxPolish], polishIterations[maxPolish];
+      int64_t time[maxLanes];
+      double polishX[3 * maxPolish];
+      int count = 0, tileFirst = 0;
+      for (int i = first; i != last; i++)
+      {
+         if (i == first || i % tile == 0)
+            tileFirst = SeedTile(i, scratch, &tileData);
+         int offset = i - tileFirst;
+         const unsigned short *pixel = tileData + offset * l_nPoints;
+         if (pixel[0] != 0)
          {
-            std::cerr << "Error getting solver results" << std::endl;
-            MKL_Thread_Free_Buffers();
-            return;
+            xvec[count * 3] = starts[offset * 3];
+            xvec[count * 3 + 1] = starts[offset * 3 + 1];
+            xvec[count * 3 + 2] = starts[offset * 3 + 2];
+            pixels[count] = pixel;
+            batch[count] = l_parent->PixelAt(i);
+            if (l_parent->_seriesPrevious)
+               l_parent->SeriesStart(batch[count], pixel, xvec + count * 3);
+            count++;
          }
-         if (dtrnlsp_delete(&solverHandle) != TR_SUCCESS)
+         if (count < lanes && (count == 0 || (i + 1 != last && offset != tile - 1)))
+            continue;
+
+         //Flush at the end of each tile, the next tile may reuse the buffer
+         int64_t started = tracing ? FitDiagnostics::Now() : 0;
+         solver.Solve(pixels, count, xvec, fvec, stopCrit, iterations);
+         int64_t share = tracing ? (FitDiagnostics::Now() - started) / count : 0;
+         for (int l = 0; l < count; l++)
+            time[l] = share;
+
+         //Precision guard: lanes that hit the iteration limit or collapsed
+         //the trust region are refit in double from the float result
+         int queued = 0;
+         for (int l = 0; l <= count; l++)
          {
-            std::cerr << "Error deleting the solver" << std::endl;
-            MKL_Thread_Free_Buffers();
-            return;
+            if (l < count && stopCrit[l] <= 2)
+            {
+               polishPixels[queued] = pixels[l];
+               polishLane[queued] = l;
+               memcpy(polishX + queued * 3, xvec + l * 3, 3 * sizeof(double));
+               queued++;
+            }
+            if (queued == 0 || (queued < polishLanes && l < count))
+               continue;
+            started = tracing ? FitDiagnostics::Now() : 0;
+            polish.Solve(polishPixels, queued, polishX, polishF, polishStop, polishIterations);
+            share = tracing ? (FitDiagnostics::Now() - started) / queued : 0;
+            for (int q = 0; q < queued; q++)
+            {
+               int lane = polishLane[q];
+               memcpy(xvec + lane * 3, polishX + q * 3, 3 * sizeof(double));
+               memcpy(fvec + lane * l_nPoints, polishF + q * l_nPoints, l_nPoints * sizeof(double));
+               stopCrit[lane] = polishStop[q];
+               iterations[lane] += polishIterations[q];
+               time[lane] += share;
+            }
+            queued = 0;
          }
 
-         double res{ 0.0 }, avg{ 0.0 }, sst{ 0.0 }, ssr{ 0.0 }, ssc{ 0.0 };
-
-         for (int j = 0; j < l_nPoints; j++)
+         for (int l = 0; l < count; l++)
          {
-            avg += l_parent->_data[pixel * l_nPoints + j];
-            ssr += fvec[j] * fvec[j];
+            if (tracing)
+               Trace(scratch, batch[l], iterations[l], 0, stopCrit[l], time[l]);
+            l_parent->StoreResults(batch[l], pixels[l], xvec + l * 3, fvec + l * l_nPoints, stopCrit[l], iterations[l]);
          }
-         avg /= l_nPoints;
-         for (int j = 0; j < l_nPoints; j++)
+         count = 0;
+      }
+   }
+
+   void CPUModel::FitTask::VarProFit(int first, int last, FitScratch &scratch) const
+   {
+      VarProSolver &solver = *scratch.varpro;
+      solver.SetTolerances(l_eps, l_iterations);
+      double *xvec = scratch.xvec, *fvec = scratch.fvec;
+      const int tile = TilePixels;
+      const unsigned short *tileData{ nullptr };
+      const bool tracing = l_parent->_diagnostics.Enabled();
+      int stopCrit, iterations;
+      for (int i = first; i != last; i++)
+      {
+         int offset = (i - first) % tile;
+         if (offset == 0)
+            tileData = l_parent->LoadWork(i, last - i < tile ? last - i : tile, scratch.tile);
+         const unsigned short *pixel = tileData + offset * l_nPoints;
+         if (pixel[0] == 0)
+            continue;
+         int64_t started = tracing ? FitDiagnostics::Now() : 0;
+         solver.Solve(pixel, xvec, fvec, &stopCrit, &iterations);
+         if (tracing)
+            Trace(scratch, l_parent->PixelAt(i), iterations, 0, stopCrit, FitDiagnostics::Now() - started);
+         l_parent->StoreResults(l_parent->PixelAt(i), pixel, xvec, fvec, stopCrit, iterations);
+      }
+   }
+
+   int CPUModel::FitTask::SeedTile(int item, FitScratch &scratch, const unsigned short **tileData) const
+   {
+      const int first = item / TilePixels * TilePixels, work = l_parent->WorkCount();
+      const int count = work - first < TilePixels ? work - first : TilePixels;
+      *tileData = l_parent->LoadWork(first, count, scratch.tile);
+      l_parent->StartingPoints(l_parent->_gridStart ? scratch.init : nullptr, *tileData, count, scratch.starts);
+      return first;
+   }
+
+   void CPUModel::FitTask::WarmFit(int block, FitScratch &scratch) const
+   {
+      const int rows = l_parent->_outputImgs[0].rows, cols = l_parent->_outputImgs[0].cols;
+      const int blockCols = (cols + WarmBlock - 1) / WarmBlock;
+      const int x0 = block % blockCols * WarmBlock, y0 = block / blockCols * WarmBlock;
+      const bool batched = l_parent->_solver == SolverType::SOLVER_BATCHED_LM;
+      GridInitializer *init = l_parent->_gridStart ? scratch.init : nullptr;
+      double *xvec = scratch.xvec, *fvec = scratch.fvec, *jvec = scratch.jvec, *starts = scratch.starts;
+      const std::vector<int> &order = l_parent->_warmOrder;
+      memset(scratch.solved, 0, WarmBlock * WarmBlock);
+      if (batched)
+         scratch.batch->SetTolerances(l_eps, l_iterations);
+      const int lanes = batched ? scratch.batch->Lanes() : 1;
+      const bool tracing = l_parent->_diagnostics.Enabled();
+
+      //Batched lanes, as positions in the tile
+      const int maxLanes = BatchLMSolver::MaxLanes;
+      const unsigned short *pixels[maxLanes];
+      int lane[maxLanes], stopCrit[maxLanes], iterations[maxLanes], retries[maxLanes];
+      bool warm[maxLanes];
+      int queued = 0;
+      auto flush = [&]()
+      {
+         int64_t started = tracing ? FitDiagnostics::Now() : 0;
+         scratch.batch->Solve(pixels, queued, xvec, fvec, stopCrit, iterations);
+         //The lanes share the batch's time
+         int64_t share = tracing ? (FitDiagnostics::Now() - started) / queued : 0;
+         //Warm starts that ran out of iterations are fit again from the usual start
+         int retry = 0;
+         for (int l = 0; l < queued; l++)
          {
-            double dataval = l_parent->_data[pixel * l_nPoints + j];
-            dataval -= avg;
-            sst += dataval * dataval;
+            if (warm[l] && stopCrit[l] == 1)
+            {
+               pixels[retry] = pixels[l];
+               lane[retry] = lane[l];
+               retries[retry] = iterations[l];
+               memcpy(xvec + retry * 3, starts + lane[l] * 3, 3 * sizeof(double));
+               retry++;
+               continue;
+            }
+            if (tracing)
+               Trace(scratch, scratch.gather[lane[l]], iterations[l], 0, stopCrit[l], share);
+            l_parent->StoreResults(scratch.gather[lane[l]], pixels[l], xvec + l * 3, fvec + l * l_nPoints, stopCrit[l], iterations[l]);
+            if (stopCrit[l] > 1)
+               scratch.solved[(scratch.gather[lane[l]] / cols - y0) * WarmBlock + scratch.gather[lane[l]] % cols - x0] = 1;
          }
-         for (int j = 1; j < l_nPoints; j++)
+         if (retry > 0)
          {
-            double scval = fvec[j] - fvec[j - 1];
-            ssc += scval * scval;
+            started = tracing ? FitDiagnostics::Now() : 0;
+            scratch.batch->Solve(pixels, retry, xvec, fvec, stopCrit, iterations);
+            int64_t retryShare = tracing ? (FitDiagnostics::Now() - started) / retry : 0;
+            for (int l = 0; l < retry; l++)
+            {
+               if (tracing)
+                  Trace(scratch, scratch.gather[lane[l]], iterations[l] + retries[l], 0, stopCrit[l], share + retryShare);
+               l_parent->StoreResults(scratch.gather[lane[l]], pixels[l], xvec + l * 3, fvec + l * l_nPoints, stopCrit[l], iterations[l] + retries[l]);
+               if (stopCrit[l] > 1)
+                  scratch.solved[(scratch.gather[lane[l]] / cols - y0) * WarmBlock + scratch.gather[lane[l]] % cols - x0] = 1;
+            }
          }
+         queued = 0;
+      };
 
-         double rmsNoise{ 0.0 }, rmsSignal{ 0.0 }, snr{ 0.0 };
-         double *prediction = new double[l_nPoints];
+      size_t next = 0;
+      while (next < order.size())
+      {
+         //Next tile of pixels along the walk
+         int count = 0;
+         while (next < order.size() && count < TilePixels)
+         {
+            int x = x0 + order[next] % WarmBlock, y = y0 + order[next] / WarmBlock;
+            next++;
+            if (x >= cols || y >= rows)
+               continue;
+            int pixel = y * cols + x;
+            if (l_parent->Classifying() && l_parent->_classes[pixel] != (unsigned char)PixelClass::PIXEL_FIT)
+               continue;
+            scratch.gather[count++] = pixel;
+         }
+         if (count == 0)
+            break;
+         l_parent->GatherPixels(scratch.gather, count, scratch.tile);
+         l_parent->StartingPoints(init, scratch.tile, count, starts);
 
-         for (int j = 0; j < l_nPoints; j++)
+         for (int p = 0; p < count; p++)
          {
-            double c{ l_parent->_constvec[3 * j] }, d{ l_parent->_constvec[3 * j + 1] }, phi{ l_parent->_constvec[3 * j + 2] };
-            prediction[j] = xvec[0] * (1.0 + 2.0 * c * cos(phi * xvec[2]) - 2.0 * d * sin(phi * xvec[2]) + c * c + d * d);
-            rmsSignal += prediction[j] * prediction[j];
+            const unsigned short *pixelData = scratch.tile + (size_t)p * l_nPoints;
+            int pixel = scratch.gather[p];
+            int x = pixel % cols, y = pixel / cols;
+            if (pixelData[0] != 0 && l_parent->_seriesPrevious)
+               l_parent->SeriesStart(pixel, pixelData, starts + p * 3);
+            if (pixelData[0] != 0 && batched)
+            {
+               double *seed = xvec + queued * 3;
+               warm[queued] = WarmSeed(pixelData, x, y, x0, y0, scratch.solved, starts + p * 3, seed);
+               pixels[queued] = pixelData;
+               lane[queued++] = p;
+            }
+            else if (pixelData[0] != 0)
+            {
+               bool warmed = WarmSeed(pixelData, x, y, x0, y0, scratch.solved, starts + p * 3, xvec);
+               int used{ 0 }, retried{ 0 }, cycles{ 0 }, retryCycles{ 0 };
+               int64_t started = tracing ? FitDiagnostics::Now() : 0;
+               int stop = MklSolve(pixel, pixelData, xvec, fvec, jvec, &used, &cycles);
+               if (warmed && stop == 1)
+               {
+                  memcpy(xvec, starts + p * 3, 3 * sizeof(double));
+                  stop = MklSolve(pixel, pixelData, xvec, fvec, jvec, &retried, &retryCycles);
+               }
+               if (stop == 0)
+                  return;
+               if (tracing)
+                  Trace(scratch, pixel, used + retried, cycles + retryCycles, stop, FitDiagnostics::Now() - started);
+               l_parent->StoreResults(pixel, pixelData, xvec, fvec, stop, used + retried);
+               if (stop > 1)
+                  scratch.solved[(y - y0) * WarmBlock + x - x0] = 1;
+            }
+            //Flush at the end of each tile, the next tile reuses the buffer
+            if (queued == lanes || (queued > 0 && p == count - 1))
+               flush();
          }
-         
-         double d, r;
-         d = ssc / ssr;
-         r = 1 - ssr / sst;
-         rmsNoise = sqrt(ssr / l_nPoints);
-         rmsSignal = sqrt(rmsSignal / l_nPoints);
-         snr = (rmsSignal * rmsSignal) / (rmsNoise * rmsNoise);
-
-         *(l_parent->_outputImgs[0].ptr<float>() + pixel) = (float)xvec[0];
-         *(l_parent->_outputImgs[1].ptr<float>() + pixel) = (float)xvec[1];
-         *(l_parent->_outputImgs[2].ptr<float>() + pixel) = (float)xvec[2];
-         *(l_parent->_outputImgs[3].ptr<float>() + pixel) = (float)stopCrit;
-         *(l_parent->_outputImgs[4].ptr<float>() + pixel) = (float)r;
-         *(l_parent->_outputImgs[5].ptr<float>() + pixel) = (float)d;
-         *(l_parent->_outputImgs[6].ptr<float>() + pixel) = (float)snr;
-
-         later = std::chrono::high_resolution_clock::now();
-         timeTaken = later - earlier;
-         delete[] prediction;
-         //std::cout << "Pixel " << pixel << " finished in " << std::chrono::duration_cast<std::chrono::microseconds>(timeTaken).count() << " microseconds." << std::endl;
       }
+   }
+
+   void CPUModel::FitTask::Trace(FitScratch &scratch, int pixel, int iterations, int cycles, int stopCrit, int64_t nanoseconds) const
+   {
+      PixelTrace record;
+      record.pixel = pixel;
+      record.iterations = iterations;
+      record.cycles = cycles;
+      record.stopCrit = stopCrit;
+      record.nanoseconds = nanoseconds;
+      scratch.trace.push_back(record);
+   }
+
+   bool CPUModel::FitTask::WarmSeed(const unsigned short *data, int x, int y, int x0, int y0, const unsigned char *solved,
+      const double *start, double *xvec) const
+   {
+      const int dx[4]{ -1, 1, 0, 0 }, dy[4]{ 0, 0, -1, 1 };
+      const int cols = l_parent->_outputImgs[0].cols;
+      double height{ 0.0 };
+      int found{ 0 };
+      for (int k = 0; k < 4; k++)
+      {
+         int lx = x + dx[k] - x0, ly = y + dy[k] - y0;
+         if (lx < 0 || ly < 0 || lx >= WarmBlock || ly >= WarmBlock || !solved[ly * WarmBlock + lx])
+            continue;
+         height += *(l_parent->_outputImgs[2].ptr<float>() + (y + dy[k]) * cols + x + dx[k]);
+         found++;
+      }
+      memcpy(xvec, start, 3 * sizeof(double));
+      if (found == 0)
+         return false;
+      //A and B are linear at the neighbours' H, so they are solved for this
+      //pixel rather than inherited from the neighbours
+      return l_parent->SeedFromHeight(data, height / found, xvec);
+   }
+
+   CPUModel::FitScratch::FitScratch() : xvec(nullptr), fvec(nullptr), jvec(nullptr), starts(nullptr),
+      tile(nullptr), gather(nullptr), solved(nullptr), init(nullptr), batch(nullptr), floatBatch(nullptr), varpro(nullptr) {}
+
+   CPUModel::FitScratch::~FitScratch()
+   {
       mkl_free(xvec);
       mkl_free(fvec);
       mkl_free(jvec);
-      MKL_Thread_Free_Buffers();
-      xvec = fvec = jvec = nullptr;
+      mkl_free(starts);
+      mkl_free(tile);
+      mkl_free(gather);
+      mkl_free(solved);
+      delete init;
+      delete batch;
+      delete floatBatch;
+      delete varpro;
+   }
+
+   int CPUModel::FitScratch::Prepare(const CPUModel *model)
+   {
+      const int lanes = FloatLMSolver::MaxLanes;
+      if (xvec == nullptr)
+      {
+         //Sized for the widest user, the float solver's lanes at the widest
+         //level, plus a double batch of residuals for its polish
+         xvec = (double *)mkl_malloc(3 * lanes * sizeof(double), 64);
+         fvec = (double *)mkl_malloc((lanes + BatchLMSolver::MaxLanes) * model->_n * sizeof(double), 64);
+         jvec = (double *)mkl_malloc(3 * model->_n * sizeof(double), 64);
+         starts = (double *)mkl_malloc(3 * TilePixels * sizeof(double), 64);
+         tile = (unsigned short *)mkl_malloc(TilePixels * model->_n * sizeof(unsigned short), 64);
+         gather = (int *)mkl_malloc(TilePixels * sizeof(int), 64);
+         solved = (unsigned char *)mkl_malloc(WarmBlock * WarmBlock, 64);
+      }
+      if (xvec == nullptr || fvec == nullptr || jvec == nullptr || starts == nullptr || tile == nullptr ||
+         gather == nullptr || solved == nullptr)
+         return 1;
+      if (model->_gridStart && init == nullptr)
+         init = new GridInitializer(model->_basis);
+      const bool floatLM = model->_solver == SolverType::SOLVER_FLOAT_LM;
+      if ((model->_solver == SolverType::SOLVER_BATCHED_LM || floatLM) && batch == nullptr)
+         batch = new BatchLMSolver(model->_n, model->_constvec, model->_simd);
+      if (floatLM && floatBatch == nullptr)
+         floatBatch = new FloatLMSolver(model->_n, model->_constvec, model->_simd);
+      if (model->_solver == SolverType::SOLVER_VARPRO && varpro == nullptr)
+         varpro = new VarProSolver(model->_basis);
+      return 0;
    }
 
    void objective(MKL_INT *pixel, MKL_INT *m, double *x, double *f, void *instance)
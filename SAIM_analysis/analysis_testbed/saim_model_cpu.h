@@ -35,10 +35,18 @@
 #ifndef SAIM_MODEL_CPU_H
 #define SAIM_MODEL_CPU_H
 
+#include <atomic>
+#include <functional>
 #include <vector>
-#include <tbb/tbb.h>
 #include <mkl.h>
 
+#include "batch_lm_solver.h"
+#include "fit_diagnostics.h"
+#include "grid_initializer.h"
+#include "height_basis.h"
+#include "optical_model.h"
+#include "work_stealing_pool.h"
+
 namespace cv
 {
    class Mat;
@@ -46,39 +54,388 @@ namespace cv
 
 namespace cpu_model
 {
+   class VarProSolver;
 
    class CPUModel
    {
    public:
+      /**Nonlinear solvers available to the fit*/
+      enum class SolverType
+      {
+         SOLVER_MKL_TRNLSP,
+         SOLVER_BATCHED_LM,
+         SOLVER_VARPRO,
+         SOLVER_FLOAT_LM
+      };
+
+      /**Outcome of the pre-classification pass for each pixel*/
+      enum class PixelClass : unsigned char
+      {
+         PIXEL_FIT,
+         PIXEL_BACKGROUND,
+         PIXEL_SATURATED,
+         PIXEL_UNCHANGED
+      };
+
+      /**Order the spatial warm start walks each block of pixels in*/
+      enum class WarmStartOrder
+      {
+         WARM_START_OFF,
+         WARM_START_SCANLINE,
+         WARM_START_HILBERT
+      };
+
+#ifdef SAIM_WITH_TBB
+      /**TBB partitioners ParforRunFit can split the image with*/
+      enum class PartitionerType
+      {
+         PARTITIONER_SIMPLE,
+         PARTITIONER_AUTO,
+         PARTITIONER_AFFINITY
+      };
+#endif
+
       CPUModel();
       ~CPUModel();
 
       int RegisterImages(std::vector<cv::Mat> &input);
 
+      /*************************************************************************
+      * @brief Registers a stack that is already pixel-major ([pixel][frame],
+      * the layout of _data), e.g. a mapped RawStack. The model fits straight
+      * from it without a copy, the data must outlive the model's buffers.
+      *************************************************************************/
+      int RegisterPixelMajor(const unsigned short *data, int rows, int cols, int frames);
+
+      /*************************************************************************
+      * @brief Pixels per range handed to a thread by ParforRunFit. Rounded up
+      * to a multiple of the lanes for the batched and float solvers.
+      *************************************************************************/
       int SetGrainSize(int);
 
+      int GetGrainSize(void) const { return _grainSize; }
+
+#ifdef SAIM_WITH_TBB
+      /*************************************************************************
+      * @brief Selects how ParforRunFit splits the image. Simple splits down
+      * to the grain size, auto (default) lets TBB stop splitting once every
+      * thread has work, affinity replays the previous fit's thread mapping.
+      *************************************************************************/
+      int SetPartitioner(PartitionerType);
+
+      /*************************************************************************
+      * @brief Times fits of a block of pixels from the middle of the image
+      * with the current partitioner at a range of grain sizes and keeps the
+      * fastest. Call after CalculateConstants. The outputs, iteration counts
+      * and time series state are left as they were.
+      * @param pixelsPerSecond Out, optional: the rate at the chosen grain
+      *************************************************************************/
+      int AutoTuneGrainSize(double *pixelsPerSecond = nullptr);
+#endif
+
+      /*************************************************************************
+      * @brief Selects the solver used by RunFit and ParforRunFit. The float
+      * solver fits the batched model in single precision, twice the lanes,
+      * and refits in double, from the float result, the pixels it stopped on
+      * the iteration limit or a collapsed trust region, which is where float
+      * rounding cuts a fit short.
+      *************************************************************************/
+      int SetSolver(SolverType);
+
+      /*************************************************************************
+      * @brief Instruction set build of the batched and float solvers, by
+      * default the widest the CPU runs (DetectSimdLevel). Returns 1 for a
+      * level above that. A narrower build fits fewer pixels per call, and
+      * results differ from the wider builds only by rounding.
+      *************************************************************************/
+      int SetSimdLevel(SimdLevel);
+
+      SimdLevel GetSimdLevel(void) const { return _simd; }
+
+      /*************************************************************************
+      * @brief Sets the height grid (nm) searched by the variable projection
+      * solver, takes effect at the next CalculateConstants
+      *************************************************************************/
+      int SetHeightRange(double hMin, double hMax, double hStep);
+
+      /*************************************************************************
+      * @brief Seeds the MKL and batched solvers from a search of the height
+      * grid (default) or from the fixed guesses scaled by the pixel range
+      *************************************************************************/
+      int SetGridStart(bool);
+
+      /*************************************************************************
+      * @brief Fixed starting point used without the grid search: A is aScale
+      * times the pixel's range, B is bScale times its minimum, H is h (nm)
+      *************************************************************************/
+      int SetGuesses(double aScale, double bScale, double h);
+
+      /*************************************************************************
+      * @brief Stop tolerances of every solver (6 values, same order as
+      * dtrnlsp) and the iteration limit, taken at the next fit
+      *************************************************************************/
+      int SetTolerances(const double *eps, int iterations);
+
+      /*************************************************************************
+      * @brief Evaluates sin and cos of the phases phi * H in the model
+      * function, the Jacobian and the post-fit prediction with the range
+      * reduced polynomial kernel of fast_sincos.h (AVX2 where available,
+      * max error 1.8e-16 over the SAIM phase range) instead of libm. Off by
+      * default, which keeps results bit-identical to earlier fits.
+      *************************************************************************/
+      int SetFastSinCos(bool);
+
+      /*************************************************************************
+      * @brief Stacks of 16, 31, 32 or 64 frames are evaluated by model,
+      * Jacobian and statistics kernels compiled for that frame count, so the
+      * frame loops are fully unrolled and keep their values in registers.
+      * Other counts use the generic loops. On by default, off forces the
+      * generic loops for comparison. Results are the same either way.
+      *************************************************************************/
+      int SetFrameKernels(bool);
+
+      /*************************************************************************
+      * @brief When enabled, InitializeBuffers keeps no pixel-major copy of
+      * the stack and the fit gathers each tile of pixels from the registered
+      * frames as it reaches it. Must be set before InitializeBuffers.
+      *************************************************************************/
+      int SetLazyTiles(bool);
+
+      /*************************************************************************
+      * @brief Enables a pre-pass that classifies every pixel from its mean,
+      * variance and peak-to-peak across the frames before any solver runs.
+      * A pixel with a frame at or above saturation is saturated, one below
+      * any of the minimums is background, and only the remaining pixels are
+      * fit. Skipped pixels get A = 0, B = mean, H = NaN, R2 = d = SNR = 0 and
+      * stopCrit -1 (background) or -2 (saturated).
+      *************************************************************************/
+      int SetPixelClassifier(bool enable, double minMean = 0.0, double minVariance = 0.0,
+         double minPeakToPeak = 0.0, int saturation = 65535);
+
+      /*************************************************************************
+      * @brief Pixel counts of each class from the last classified fit,
+      * unchanged counts the pixels a time series copied from the last
+      * timepoint
+      *************************************************************************/
+      int GetPixelClasses(int *fit, int *background, int *saturated, int *unchanged = nullptr) const;
+
+      /*************************************************************************
+      * @brief Time-lapse mode for a series of stacks of the same angles and
+      * shape, each swapped in with UpdateImages after the first. The outputs
+      * carry over between timepoints: a pixel is fit again only when its
+      * frames moved from the ones it was last fit on by more than threshold,
+      * measured as the mean over the frames of (y - y_last)^2 / (y + y_last),
+      * i.e. in units of the Poisson variance of the difference, where shot
+      * noise alone gives about 1. Refit pixels
+      * start from their previous solution when it converged and fits them
+      * better than the usual start. Resets the series when switched.
+      *************************************************************************/
+      int SetTimeSeries(bool enable, double threshold = 2.0);
+
+      /*************************************************************************
+      * @brief Fits the image in WarmBlock x WarmBlock blocks, one block per
+      * thread, walking each block in scanline or Hilbert order and seeding
+      * every pixel from the mean H of its converged 4-neighbours in the
+      * block, with A and B solved linearly at that H, when that fits the
+      * pixel better than the usual starting point. Warm-started pixels that
+      * hit the iteration limit are fit again from the usual point. Applies to
+      * the MKL and batched solvers, the variable projection solver always
+      * scans the whole height grid and the float solver fits as usual.
+      *************************************************************************/
+      int SetWarmStart(WarmStartOrder);
+
+      /*************************************************************************
+      * @brief Solver iterations of each pixel in the last fit (row-major,
+      * rows x cols), including a warm start's failed attempt. Zero for
+      * pixels that were not fit.
+      *************************************************************************/
+      const int *GetIterationCounts(void) const { return _iterations.data(); }
+
+      /*************************************************************************
+      * @brief Per-pixel solver tracing, off by default. When enabled, every
+      * fit records each pixel's iterations, RCI cycles, stop criterion and
+      * wall time on its own thread and merges them into the histograms at the
+      * end of the run. The batched solver charges each pixel an equal share
+      * of its batch's time.
+      *************************************************************************/
+      FitDiagnostics &Diagnostics(void) { return _diagnostics; }
+
       int InitializeBuffers();
 
       int ReleaseBuffers();
 
+      /*************************************************************************
+      * @brief Swaps in a new stack with the same frame count after
+      * InitializeBuffers, keeping the constants and height basis. Used to fit
+      * a large acquisition band by band. The output images are reallocated
+      * only when the band shape changes and are cleared for the new band.
+      *************************************************************************/
+      int UpdateImages(std::vector<cv::Mat> &input);
+
       int CalculateConstants(double wavelength, double dOx, double nB, double nOx, double nSi, double *angles);
 
+      /*************************************************************************
+      * @brief Fit constants of any layer stack and polarization, one angle
+      * (radians) per frame. The constants come from the process-wide cache of
+      * optical_model.h, and a call that reproduces the current constants and
+      * height grid keeps the solvers and height basis already built.
+      *************************************************************************/
+      int CalculateConstants(const OpticalStack &stack, const double *angles);
+
+      /*************************************************************************
+      * @brief Fits every pixel on the calling thread with the selected solver
+      *************************************************************************/
       int RunFit(void);
 
+#ifdef SAIM_WITH_TBB
+      /**Defined with the rest of the TBB path in saim_model_tbb.cpp*/
       int ParforRunFit(void);
-      
+#endif
+
+      /*************************************************************************
+      * @brief Fits on a std::thread work-stealing pool instead of TBB, in
+      * tiles of the grain size rounded up to whole TilePixels. Every runner
+      * seeds the same TilePixels tiles (FitTask::SeedTile), so results are
+      * bit-identical to RunFit and ParforRunFit; fit_benchmark checks it.
+      *************************************************************************/
       int ThreadedRunFit(void);
 
+      /*************************************************************************
+      * @brief ParforRunFit in builds with TBB, ThreadedRunFit otherwise
+      *************************************************************************/
+      int ParallelRunFit(void);
+
+      /*************************************************************************
+      * @brief Worker threads for ThreadedRunFit, 0 for one per logical
+      * processor, and whether they are pinned across the NUMA nodes
+      *************************************************************************/
+      int SetThreadCount(int threads);
+      int SetThreadPinning(bool);
+
+      /*************************************************************************
+      * @brief Pixels (blocks in warm start mode) finished by the running (or
+      * last) ThreadedRunFit, may be polled from another thread
+      *************************************************************************/
+      int GetProgress(int *done, int *total) const;
+
+      /*************************************************************************
+      * @brief Tiles the last ThreadedRunFit was split into and how many of
+      * them were moved between workers by steals
+      *************************************************************************/
+      int GetScheduling(int *tiles, int *stolen) const;
+
       std::vector<cv::Mat> GetImages(void);
 
+      /*************************************************************************
+      * @brief Recomputes R2, d and SNR (in that order in stats) of the
+      * registered stack for existing A, B and H maps, e.g. the pages of a
+      * saved fit, without fitting. The maps are CV_32F of the stack's shape,
+      * pixels with a non-finite H get zeros. Call after InitializeBuffers and
+      * CalculateConstants, the model's outputs are left alone.
+      *************************************************************************/
+      int RecomputeStatistics(const cv::Mat &A, const cv::Mat &B, const cv::Mat &H, std::vector<cv::Mat> &stats);
+
+      /*************************************************************************
+      * @brief Buffers and solver state of one worker thread, built on the
+      * thread's first range and reused for every range after it so the fit
+      * bodies never touch the allocator. Dropped by CalculateConstants and
+      * ReleaseBuffers, which invalidate the solvers, and the pool workers'
+      * by SetThreadCount and SetThreadPinning, which restart the workers.
+      *************************************************************************/
+      struct FitScratch
+      {
+         FitScratch();
+         ~FitScratch();
+         int Prepare(const CPUModel *model);
+
+         double *xvec, *fvec, *jvec, *starts;
+         unsigned short *tile;
+         int *gather;
+         unsigned char *solved;
+         std::vector<PixelTrace> trace;
+         GridInitializer *init;
+         BatchLMSolver *batch;
+         FloatLMSolver *floatBatch;
+         VarProSolver *varpro;
+
+      private:
+         FitScratch(const FitScratch &) = delete;
+         FitScratch &operator=(const FitScratch &) = delete;
+      };
+
       struct FitTask
       {
       public:
          FitTask(CPUModel *, int, int, int);
          ~FitTask();
-         volatile void operator()(const tbb::blocked_range<int> &index) const;
          void operator()(int);
 
+         /*************************************************************************
+         * @brief Fits work items [first, last) with the selected solver using
+         * the calling thread's scratch. Items are pixels, or blocks when the
+         * warm start is active.
+         *************************************************************************/
+         void Fit(int first, int last, FitScratch &scratch) const;
+
+         /*************************************************************************
+         * @brief Runs MKL's trust region solver on one pixel from xvec
+         * @param cycles Out: RCI cycles of the solve
+         * @return The stop criterion, 0 if the solver failed
+         *************************************************************************/
+         int MklSolve(int pixel, const unsigned short *data, double *xvec, double *fvec, double *jvec, int *iterations,
+            int *cycles) const;
+
+         /*************************************************************************
+         * @brief Fits the range one pixel at a time with MKL's trust region
+         * solver
+         *************************************************************************/
+         void MklFit(int first, int last, FitScratch &scratch) const;
+
+         /*************************************************************************
+         * @brief Fits the range BatchLMSolver::Lanes() pixels at a time
+         *************************************************************************/
+         void BatchFit(int first, int last, FitScratch &scratch) const;
+
+         /*************************************************************************
+         * @brief Fits the range FloatLMSolver::Lanes() pixels at a time and
+         * polishes the ones float could not converge with BatchLMSolver
+         *************************************************************************/
+         void FloatFit(int first, int last, FitScratch &scratch) const;
+
+         /*************************************************************************
+         * @brief Fits the range with the variable projection solver
+         *************************************************************************/
+         void VarProFit(int first, int last, FitScratch &scratch) const;
+
+         /*************************************************************************
+         * @brief Loads and seeds the tile of TilePixels work items holding
+         * item. Tiles sit at absolute multiples of TilePixels, whatever range
+         * a runner hands out, so the seeding GEMM of a pixel has the same rows
+         * in RunFit, ThreadedRunFit and ParforRunFit and the fits match to
+         * the bit. A range starting or ending inside a tile seeds all of it.
+         * @return The tile's first work item
+         *************************************************************************/
+         int SeedTile(int item, FitScratch &scratch, const unsigned short **tileData) const;
+
+         /*************************************************************************
+         * @brief Fits one block of the spatial warm start
+         *************************************************************************/
+         void WarmFit(int block, FitScratch &scratch) const;
+
+         /*************************************************************************
+         * @brief Seed of a block pixel: the mean H of its converged neighbours
+         * and the least squares A and B of the pixel's frames at that H, or
+         * start if no neighbour is solved yet or start has the lower cost
+         * @return true if xvec holds the warm seed
+         *************************************************************************/
+         bool WarmSeed(const unsigned short *data, int x, int y, int x0, int y0, const unsigned char *solved,
+            const double *start, double *xvec) const;
+
+         /*************************************************************************
+         * @brief Appends a pixel's record to the thread's trace
+         *************************************************************************/
+         void Trace(FitScratch &scratch, int pixel, int iterations, int cycles, int stopCrit, int64_t nanoseconds) const;
+
          extern friend void objective(MKL_INT *n, MKL_INT *m, double *, double *, void *);
 
       private:
@@ -98,6 +455,8 @@ namespace cpu_model
          MKL_INT l_counter{ 0 };
          MKL_INT l_fitInfo[6];
          double l_eps[6] = { 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001 };
+         //Steps and cost decreases of the float solver stop at float resolution
+         double l_floatEps[6] = { 0.000000001, 0.000000001, 0.000000001, 0.001, 0.001, 0.000000001 };
          double l_jeps{ 0.000000001 };
       };
 
@@ -105,6 +464,7 @@ namespace cpu_model
       * @brief Calculates the function value at the current xvec
       *************************************************************************/
       int CalculateFunction(int, double *, double *);
+      int CalculateFunction(const unsigned short *, double *, double *);
 
       /*************************************************************************
       * @brief Calculates the Jacobian value at the current xvec
@@ -112,15 +472,232 @@ namespace cpu_model
       int CalculateJacobian(int, double *, double *);
 
    private:
+      /*************************************************************************
+      * @brief Computes R2, d and SNR from the final residual and stores the
+      * pixel's results in the output images
+      *************************************************************************/
+      void StoreResults(int pixel, const unsigned short *data, const double *xvec, const double *fvec, int stopCrit, int iterations);
+
+      /*************************************************************************
+      * @brief sin and cos of phi * H for count frames from first, with libm
+      * or the fast kernel. The model loops work through the frames in chunks
+      * of SinCosChunk so the phases fit in a stack buffer.
+      *************************************************************************/
+      void PhaseSinCos(int first, int count, double H, double *sinv, double *cosv) const;
+
+      /**Frame count of the compiled kernels to dispatch to, 0 for the generic loops*/
+      int KernelFrames(void) const;
+
+      /*************************************************************************
+      * @brief Residuals and Jacobian for N frames, or for _n frames when N is 0
+      *************************************************************************/
+      template <int N>
+      void FunctionKernel(const unsigned short *data, const double *xvec, double *fvec) const;
+      template <int N>
+      void JacobianKernel(const double *xvec, double *jvec) const;
+
+      /*************************************************************************
+      * @brief R2, d and SNR of a pixel from its final residuals in one pass,
+      * FrameStatistics of fit_statistics.h for the kernel's frame count
+      *************************************************************************/
+      void Statistics(const unsigned short *data, const double *fvec, double B, double *stats) const;
+
+      /*************************************************************************
+      * @brief Starting (A, B, H) for count consecutive pixels, from the grid
+      * search when an initializer is given, otherwise from the guesses
+      *************************************************************************/
+      void StartingPoints(GridInitializer *init, const unsigned short *data, int count, double *xvec);
+
+      /*************************************************************************
+      * @brief Pointer to the frames of count pixels from first. Points into
+      * _data, or into tile after gathering the pixels from the raw frames
+      * when running with lazy tiles.
+      *************************************************************************/
+      const unsigned short *LoadTile(int first, int count, unsigned short *tile);
+
+      /*************************************************************************
+      * @brief Frames of the pixels at work positions [first, first + count).
+      * Without classification positions are pixels and this is LoadTile,
+      * otherwise the fit-worthy pixels are gathered into tile.
+      *************************************************************************/
+      const unsigned short *LoadWork(int first, int count, unsigned short *tile);
+
+      /*************************************************************************
+      * @brief Gathers the frames of count arbitrary pixels into tile
+      *************************************************************************/
+      void GatherPixels(const int *pixels, int count, unsigned short *tile);
+
+      /**True when the fit runs in warm start blocks*/
+      bool WarmActive(void) const
+      {
+         return _warmStart != WarmStartOrder::WARM_START_OFF && _solver != SolverType::SOLVER_VARPRO &&
+            _solver != SolverType::SOLVER_FLOAT_LM;
+      }
+
+      /**Work items of the fit, blocks in warm start mode, otherwise pixels*/
+      int WorkItems(void) const;
+
+      /**Pixels the solvers have to work through*/
+      int WorkCount(void) const { return Classifying() ? (int)_fitIndex.size() : _m; }
+
+      /**Pixel index of a work position*/
+      int PixelAt(int position) const { return Classifying() ? _fitIndex[position] : position; }
+
+      /**True when a pre-pass decides which pixels are fit*/
+      bool Classifying(void) const { return _classify || _series; }
+
+      /*************************************************************************
+      * @brief Time series test of a fit-worthy pixel against the frames it
+      * was last fit on, which are replaced when it has to be fit again
+      *************************************************************************/
+      PixelClass SeriesClass(int pixel, const unsigned short *data);
+
+      /*************************************************************************
+      * @brief Replaces xvec with the pixel's previous timepoint solution if
+      * that converged and fits the current frames better
+      *************************************************************************/
+      void SeriesStart(int pixel, const unsigned short *data, double *xvec) const;
+
+      /*************************************************************************
+      * @brief Candidate start at the given height with A and B solved by
+      * linear least squares, replaces xvec if it has the lower cost
+      * @return true if xvec was replaced
+      *************************************************************************/
+      bool SeedFromHeight(const unsigned short *data, double height, double *xvec) const;
+
+      /*************************************************************************
+      * @brief Classifies the pixels of one tile and writes the outputs of
+      * the skipped ones
+      *************************************************************************/
+      void ClassifyTile(int tile, unsigned short *buffer);
+
+      /*************************************************************************
+      * @brief Classifies every pixel on the pool and compacts the index list
+      * of fit-worthy pixels, does nothing without a classifier or time series
+      *************************************************************************/
+      void ClassifyParallel(void);
+      void CompactFitIndex(void);
+
+      /*************************************************************************
+      * @brief Cache-blocked gather of count pixels from first out of the raw
+      * frames into pixel-major order
+      *************************************************************************/
+      void TransposeBlock(int first, int count, unsigned short *dst);
+
+      static const int TilePixels = GridInitializer::TilePixels;
+      static const int AutoTunePixels = 16384;
+      static const int WarmBlock = 32;
+      static const int SinCosChunk = 64;
+
+#ifdef SAIM_WITH_TBB
+      /**Per-thread scratch and partitioner state of the TBB path*/
+      struct TbbState;
+
+      /*************************************************************************
+      * @brief parallel_for of the task over [first, last) with the selected
+      * partitioner
+      *************************************************************************/
+      void ParallelFit(const FitTask &task, int first, int last, int grain);
+
+      /*************************************************************************
+      * @brief Merges or drops the traces of the TBB threads' scratch, and
+      * frees the TBB state
+      *************************************************************************/
+      void MergeTbbTraces(bool keep);
+      void DropTbbState(void);
+
+      /**ForEachTile on the TBB threads' scratch*/
+      void TbbForEachTile(int tiles, const std::function<void(FitScratch &scratch, int tile)> &body);
+#endif
+
+      /*************************************************************************
+      * @brief Grain size actually used for the current solver
+      *************************************************************************/
+      int SolverGrain(int grain) const;
+
+      /*************************************************************************
+      * @brief Merges the trace of every thread's scratch into the
+      * diagnostics, or drops them for fits that are not part of the results
+      *************************************************************************/
+      void MergeTraces(bool keep);
+
+      /*************************************************************************
+      * @brief Runs body(worker, item) on the pool with a scratch slot for
+      * every worker
+      *************************************************************************/
+      void RunOnPool(int items, const std::function<void(int worker, int item)> &body);
+
+      /*************************************************************************
+      * @brief Runs body(scratch, tile) over the image's tiles of TilePixels on
+      * the threads the build fits on: TBB's with SAIM_WITH_TBB, so the passes
+      * around ParforRunFit stay in its arena, and the pool's otherwise
+      *************************************************************************/
+      void ForEachTile(const std::function<void(FitScratch &scratch, int tile)> &body);
+
+      /*************************************************************************
+      * @brief Scratch of a pool worker inside RunOnPool, built on first use by
+      * the worker's own thread so its buffers are first touched on the
+      * worker's NUMA node
+      *************************************************************************/
+      FitScratch &WorkerScratch(int worker);
+
+      /*************************************************************************
+      * @brief Frees the scratch of every thread, the solvers in it are built
+      * on the current constants
+      *************************************************************************/
+      void DropScratch(void);
+      void DropWorkerScratch(void);
+
+      /*************************************************************************
+      * @brief Scratch of RunFit, built on first use
+      *************************************************************************/
+      FitScratch &SerialScratch(void);
+
       std::vector<cv::Mat> _rawImgs, _outputImgs;
       volatile int _n;
       volatile int _m;
-      int _grainSize, _nGrains, _emptyPixels;
-      bool _initialized;
+      int _grainSize{ 1 }, _nGrains, _emptyPixels;
+      bool _initialized{ false };
       size_t _datasz, _fnsz, _xsz, _jacsz;
-      unsigned short  *_data;
-      double *_constvec;
+      const unsigned short *_data{ nullptr };
+      const unsigned short *_external{ nullptr };
+      int _externalShape[3]{ 0, 0, 0 };
+      double *_constvec{ nullptr };
       double _guesses[3]{ 0.8, 1.0, 6.0 };
+      double _eps[6]{ 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001 };
+      int _maxIterations{ 1000 };
+      SolverType _solver{ SolverType::SOLVER_MKL_TRNLSP };
+      SimdLevel _simd{ DetectSimdLevel() };
+      double _heightRange[3]{ 0.0, 300.0, 2.0 };
+      double _basisRange[3]{ 0.0, 0.0, 0.0 };
+      HeightBasis *_basis{ nullptr };
+      bool _gridStart{ true };
+      bool _lazyTiles{ false };
+      bool _fastSinCos{ false };
+      bool _frameKernels{ true };
+#ifdef SAIM_WITH_TBB
+      PartitionerType _partitioner{ PartitionerType::PARTITIONER_AUTO };
+      TbbState *_tbb{ nullptr };
+#endif
+      FitScratch *_serialScratch{ nullptr };
+      WorkStealingPool _pool;
+      std::vector<FitScratch *> _workerScratch;
+      std::atomic<int> _pixelsDone{ 0 };
+      int _schedule[2]{ 0, 0 };                //tiles and stolen tiles of the last ThreadedRunFit
+      bool _classify{ false };
+      double _classThresholds[3]{ 0.0, 0.0, 0.0 };
+      int _saturation{ 65535 };
+      std::vector<unsigned char> _classes;
+      std::vector<int> _fitIndex;
+      int _classCounts[4]{ 0, 0, 0, 0 };
+      bool _series{ false };
+      bool _seriesPrevious{ false };
+      double _seriesThreshold{ 2.0 };
+      unsigned short *_seriesFrames{ nullptr };
+      WarmStartOrder _warmStart{ WarmStartOrder::WARM_START_OFF };
+      std::vector<int> _warmOrder;
+      std::vector<int> _iterations;
+      FitDiagnostics _diagnostics;
    };
 }
 
@@ -0,0 +1,223 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+//The TBB fit path: ParforRunFit, the partitioners and the grain size
+//auto-tune. Builds without SAIM_WITH_TBB get none of it and fit on the
+//std::thread pool.
+#ifdef SAIM_WITH_TBB
+
+#include "saim_model_cpu.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include <tbb/tbb.h>
+#include <opencv2/core/core.hpp>
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Scratch of every TBB thread, built on the thread's first range, and
+   * the affinity partitioner's record of the previous fit's thread mapping
+   ****************************************************************************/
+   struct CPUModel::TbbState
+   {
+      tbb::enumerable_thread_specific<FitScratch> scratch;
+      tbb::affinity_partitioner affinity;
+   };
+
+   int CPUModel::SetPartitioner(PartitionerType partitioner)
+   {
+      _partitioner = partitioner;
+      return 0;
+   }
+
+   int CPUModel::ParforRunFit(void)
+   {
+      std::chrono::high_resolution_clock::time_point earlier, later;
+      std::chrono::duration<double> timeTaken;
+      earlier = std::chrono::high_resolution_clock::now();
+      FitTask task(this, _n, 0, 1);
+      _diagnostics.BeginFit(_outputImgs[0].rows, _outputImgs[0].cols);
+      ClassifyParallel();
+      ParallelFit(task, 0, WorkItems(), SolverGrain(_grainSize));
+      //The range bodies keep MKL's per-thread buffers alive between ranges
+      MKL_Free_Buffers();
+      MergeTraces(true);
+      later = std::chrono::high_resolution_clock::now();
+      timeTaken = later - earlier;
+      std::cout << "Took " << std::chrono::duration_cast<std::chrono::milliseconds>(timeTaken).count() << std::endl;
+      return 0;
+   }
+
+   int CPUModel::AutoTuneGrainSize(double *pixelsPerSecond)
+   {
+      if (pixelsPerSecond != nullptr)
+         *pixelsPerSecond = 0.0;
+      if (!_initialized || _basis == nullptr)
+         return 1;
+      const int candidates[] = { 1, 4, 8, 16, 32, 64, 128, 256, 512, 1024 };
+      //Warm start blocks are always handed out one at a time
+      if (WarmActive())
+         return 0;
+      const int threads = tbb::this_task_arena::max_concurrency();
+
+      //The sample is classified like a fit but without the time series test,
+      //which would replace the frames the next fit compares against. The
+      //classes the next fit starts from are put back afterwards.
+      std::vector<unsigned char> classes(_classes);
+      std::vector<int> fitIndex(_fitIndex);
+      int classCounts[4];
+      memcpy(classCounts, _classCounts, sizeof(classCounts));
+      const bool series = _series;
+      _series = false;
+      ClassifyParallel();
+      const int sample = WorkCount() < AutoTunePixels ? WorkCount() : AutoTunePixels;
+      const int first = (WorkCount() - sample) / 2;
+
+      //The sampled pixels are fit over and over, their outputs and iteration
+      //counts are restored after every pass so each pass does the same work
+      //and the next fit (a time series starts from them) sees them untouched
+      std::vector<float> outputs((size_t)sample * 7);
+      std::vector<int> iterations(sample);
+      for (int i = 0; i < sample; i++)
+      {
+         int pixel = PixelAt(first + i);
+         for (int k = 0; k < 7; k++)
+            outputs[(size_t)i * 7 + k] = *(_outputImgs[k].ptr<float>() + pixel);
+         iterations[i] = _iterations[pixel];
+      }
+      auto restore = [&]()
+      {
+         for (int i = 0; i < sample; i++)
+         {
+            int pixel = PixelAt(first + i);
+            for (int k = 0; k < 7; k++)
+               *(_outputImgs[k].ptr<float>() + pixel) = outputs[(size_t)i * 7 + k];
+            _iterations[pixel] = iterations[i];
+         }
+      };
+      FitTask task(this, _n, 0, 1);
+
+      //Untimed pass so every thread has built its scratch
+      ParallelFit(task, first, first + sample, SolverGrain(candidates[0]));
+      restore();
+      double bestRate{ 0.0 };
+      int bestGrain{ _grainSize }, lastGrain{ 0 };
+      for (int grain : candidates)
+      {
+         int solverGrain = SolverGrain(grain);
+         if (solverGrain == lastGrain)
+            continue;
+         //Stop before there are too few ranges to keep every thread busy
+         if (lastGrain != 0 && sample / solverGrain < 4 * threads)
+            break;
+         lastGrain = solverGrain;
+         auto earlier = std::chrono::high_resolution_clock::now();
+         ParallelFit(task, first, first + sample, solverGrain);
+         std::chrono::duration<double> timeTaken = std::chrono::high_resolution_clock::now() - earlier;
+         restore();
+         double rate = sample / timeTaken.count();
+         if (rate > bestRate)
+         {
+            bestRate = rate;
+            bestGrain = solverGrain;
+         }
+      }
+      MKL_Free_Buffers();
+      MergeTraces(false);
+
+      _series = series;
+      _classes.swap(classes);
+      _fitIndex.swap(fitIndex);
+      memcpy(_classCounts, classCounts, sizeof(classCounts));
+      if (pixelsPerSecond != nullptr)
+         *pixelsPerSecond = bestRate;
+      return SetGrainSize(bestGrain);
+   }
+
+   void CPUModel::ParallelFit(const FitTask &task, int first, int last, int grain)
+   {
+      if (_tbb == nullptr)
+         _tbb = new TbbState();
+      tbb::enumerable_thread_specific<FitScratch> &scratch = _tbb->scratch;
+      auto body = [&task, &scratch](const tbb::blocked_range<int> &range)
+      {
+         task.Fit(range.begin(), range.end(), scratch.local());
+      };
+      tbb::blocked_range<int> range(first, last, grain);
+      switch (_partitioner)
+      {
+      case PartitionerType::PARTITIONER_SIMPLE:
+         tbb::parallel_for(range, body, tbb::simple_partitioner());
+         break;
+      case PartitionerType::PARTITIONER_AFFINITY:
+         tbb::parallel_for(range, body, _tbb->affinity);
+         break;
+      default:
+         tbb::parallel_for(range, body, tbb::auto_partitioner());
+         break;
+      }
+   }
+
+   void CPUModel::TbbForEachTile(int tiles, const std::function<void(FitScratch &scratch, int tile)> &body)
+   {
+      if (_tbb == nullptr)
+         _tbb = new TbbState();
+      tbb::enumerable_thread_specific<FitScratch> &scratch = _tbb->scratch;
+      tbb::parallel_for(0, tiles, [&body, &scratch](int tile) { body(scratch.local(), tile); });
+   }
+
+   void CPUModel::MergeTbbTraces(bool keep)
+   {
+      if (_tbb == nullptr)
+         return;
+      for (FitScratch &scratch : _tbb->scratch)
+      {
+         if (keep)
+            _diagnostics.Merge(scratch.trace);
+         else
+            scratch.trace.clear();
+      }
+   }
+
+   void CPUModel::DropTbbState(void)
+   {
+      delete _tbb;
+      _tbb = nullptr;
+   }
+}
+
+#endif //SAIM_WITH_TBB
@@ -0,0 +1,110 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "simd_level.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace cpu_model
+{
+   static void CpuId(unsigned leaf, unsigned sub, unsigned regs[4])
+   {
+#if defined(_MSC_VER)
+      int r[4];
+      __cpuidex(r, (int)leaf, (int)sub);
+      for (int i = 0; i < 4; i++)
+         regs[i] = (unsigned)r[i];
+#else
+      __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+   }
+
+   //Register state the OS saves on a context switch (XCR0)
+   static unsigned long long EnabledState(void)
+   {
+#if defined(_MSC_VER)
+      return _xgetbv(0);
+#else
+      unsigned lo, hi;
+      __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+      return ((unsigned long long)hi << 32) | lo;
+#endif
+   }
+
+   static SimdLevel Probe(void)
+   {
+      unsigned regs[4];
+      CpuId(0, 0, regs);
+      if (regs[0] < 7)
+         return SimdLevel::SIMD_SCALAR;
+      CpuId(1, 0, regs);
+      const unsigned fma = 1u << 12, osxsave = 1u << 27, avx = 1u << 28;
+      if ((regs[2] & (fma | osxsave | avx)) != (fma | osxsave | avx))
+         return SimdLevel::SIMD_SCALAR;
+      //SSE and AVX state for AVX2, plus the opmask and upper ZMM state for AVX-512
+      const unsigned long long state = EnabledState();
+      if ((state & 0x6) != 0x6)
+         return SimdLevel::SIMD_SCALAR;
+      CpuId(7, 0, regs);
+      if (!(regs[1] & (1u << 5)))
+         return SimdLevel::SIMD_SCALAR;
+      const unsigned avx512 = (1u << 16) | (1u << 17) | (1u << 28) | (1u << 30) | (1u << 31);
+      if ((regs[1] & avx512) != avx512 || (state & 0xE6) != 0xE6)
+         return SimdLevel::SIMD_AVX2;
+      return SimdLevel::SIMD_AVX512;
+   }
+
+   SimdLevel DetectSimdLevel(void)
+   {
+      static const SimdLevel level = Probe();
+      return level;
+   }
+
+   const char *SimdLevelName(SimdLevel level)
+   {
+      switch (level)
+      {
+      case SimdLevel::SIMD_AVX512:
+         return "avx512";
+      case SimdLevel::SIMD_AVX2:
+         return "avx2";
+      default:
+         return "scalar";
+      }
+   }
+}
@@ -0,0 +1,73 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef SIMD_LEVEL_H
+#define SIMD_LEVEL_H
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Vector instruction sets the batched solver and the sincos kernel
+   * have separate builds for. Everything else is compiled for the baseline,
+   * so one binary runs on any x64 CPU and uses the widest set the CPU and
+   * the OS support.
+   ****************************************************************************/
+   enum class SimdLevel
+   {
+      SIMD_SCALAR,      //SSE2 baseline, one double per lane loop iteration
+      SIMD_AVX2,        //AVX2 + FMA, 4 doubles per register
+      SIMD_AVX512       //AVX-512 F/CD/BW/DQ/VL, 8 doubles per register
+   };
+
+   /*************************************************************************
+   * @brief Widest level the CPU supports and the OS saves the registers of,
+   * read once with CPUID and XGETBV
+   *************************************************************************/
+   SimdLevel DetectSimdLevel(void);
+
+   /*************************************************************************
+   * @brief Name of the level for logs and benchmark output
+   *************************************************************************/
+   const char *SimdLevelName(SimdLevel level);
+
+   /*************************************************************************
+   * @brief Doubles per vector register at the level
+   *************************************************************************/
+   inline constexpr int SimdDoubleLanes(SimdLevel level)
+   {
+      return level == SimdLevel::SIMD_AVX512 ? 8 : level == SimdLevel::SIMD_AVX2 ? 4 : 1;
+   }
+}
+
+#endif //SIMD_LEVEL_H
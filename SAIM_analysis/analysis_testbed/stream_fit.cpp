@@ -0,0 +1,175 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "stream_fit.h"
+
+#include <opencv2/core/core.hpp>
+
+namespace cpu_model
+{
+   StreamingFit::StreamingFit(CPUModel *model, TiffStackReader *reader) :
+      _model(model), _reader(reader), _bandRows(64) {}
+
+   StreamingFit::~StreamingFit() {}
+
+   int StreamingFit::SetBandRows(int rows)
+   {
+      if (rows < 1)
+         return 1;
+      _bandRows = rows;
+      return 0;
+   }
+
+   int StreamingFit::SetConstants(double wavelength, double dOx, double nB, double nOx, double nSi, const double *angles)
+   {
+      return SetConstants(SingleOxideStack(wavelength, dOx, nB, nOx, nSi), angles);
+   }
+
+   int StreamingFit::SetConstants(const OpticalStack &stack, const double *angles)
+   {
+      _optics = stack;
+      _angles.assign(angles, angles + _reader->Frames());
+      return 0;
+   }
+
+   int StreamingFit::Run(const BandSink &sink)
+   {
+      if ((int)_angles.size() != _reader->Frames() || _reader->Frames() == 0)
+         return 1;
+      std::vector<cv::Mat> band;
+      for (int first = 0; first < _reader->Rows(); first += _bandRows)
+      {
+         int rows = _reader->Rows() - first < _bandRows ? _reader->Rows() - first : _bandRows;
+         if (_reader->ReadBand(first, rows, band))
+         {
+            _model->ReleaseBuffers();
+            return 1;
+         }
+         if (first == 0)
+         {
+            _model->RegisterImages(band);
+            _model->SetLazyTiles(true);
+            if (_model->InitializeBuffers())
+               return 1;
+            _model->CalculateConstants(_optics, _angles.data());
+         }
+         else if (_model->UpdateImages(band))
+         {
+            _model->ReleaseBuffers();
+            return 1;
+         }
+         _model->ParallelRunFit();
+         std::vector<cv::Mat> outputs = _model->GetImages();
+         if (sink(first, outputs))
+         {
+            _model->ReleaseBuffers();
+            return 1;
+         }
+      }
+      _model->ReleaseBuffers();
+      return 0;
+   }
+
+   SeriesFit::SeriesFit(CPUModel *model, TiffStackReader *reader) :
+      _model(model), _reader(reader), _frames(0), _threshold(2.0) {}
+
+   SeriesFit::~SeriesFit() {}
+
+   int SeriesFit::SetFramesPerTimepoint(int frames)
+   {
+      if (frames < 1 || _reader->Frames() % frames != 0)
+         return 1;
+      _frames = frames;
+      return 0;
+   }
+
+   int SeriesFit::SetChangeThreshold(double threshold)
+   {
+      if (threshold < 0.0)
+         return 1;
+      _threshold = threshold;
+      return 0;
+   }
+
+   int SeriesFit::SetConstants(double wavelength, double dOx, double nB, double nOx, double nSi, const double *angles)
+   {
+      return SetConstants(SingleOxideStack(wavelength, dOx, nB, nOx, nSi), angles);
+   }
+
+   int SeriesFit::SetConstants(const OpticalStack &stack, const double *angles)
+   {
+      if (_frames < 1)
+         return 1;
+      _optics = stack;
+      _angles.assign(angles, angles + _frames);
+      return 0;
+   }
+
+   int SeriesFit::Run(const TimepointSink &sink)
+   {
+      if (_frames < 1 || (int)_angles.size() != _frames)
+         return 1;
+      std::vector<cv::Mat> stack;
+      for (int t = 0; t < Timepoints(); t++)
+      {
+         if (_reader->ReadPages(t * _frames, _frames, stack))
+         {
+            _model->ReleaseBuffers();
+            return 1;
+         }
+         if (t == 0)
+         {
+            _model->RegisterImages(stack);
+            _model->SetTimeSeries(true, _threshold);
+            if (_model->InitializeBuffers())
+               return 1;
+            _model->CalculateConstants(_optics, _angles.data());
+         }
+         else if (_model->UpdateImages(stack))
+         {
+            _model->ReleaseBuffers();
+            return 1;
+         }
+         _model->ParallelRunFit();
+         std::vector<cv::Mat> outputs = _model->GetImages();
+         if (sink(t, outputs))
+         {
+            _model->ReleaseBuffers();
+            return 1;
+         }
+      }
+      _model->ReleaseBuffers();
+      return 0;
+   }
+}
@@ -0,0 +1,143 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef STREAM_FIT_H
+#define STREAM_FIT_H
+
+#include <functional>
+#include <vector>
+
+#include "optical_model.h"
+#include "saim_model_cpu.h"
+#include "tiff_stack_reader.h"
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Fits a stack that does not fit in memory one row band at a time.
+   *
+   * Each band is read from every page, swapped into the model with
+   * UpdateImages and fit from lazily gathered tiles, then handed to the sink
+   * before the next band overwrites it. Peak memory is set by the band height,
+   * not by the stack size.
+   ****************************************************************************/
+   class StreamingFit
+   {
+   public:
+      /**Receives the seven output images of the band starting at firstRow,
+      returns nonzero to stop the fit*/
+      typedef std::function<int(int firstRow, std::vector<cv::Mat> &outputs)> BandSink;
+
+      /*************************************************************************
+      * @brief The model's solver and start settings are used as they are,
+      * both objects must outlive the fit
+      *************************************************************************/
+      StreamingFit(CPUModel *model, TiffStackReader *reader);
+      ~StreamingFit();
+
+      int SetBandRows(int rows);
+
+      int SetConstants(double wavelength, double dOx, double nB, double nOx, double nSi, const double *angles);
+      int SetConstants(const OpticalStack &stack, const double *angles);
+
+      /*************************************************************************
+      * @brief Fits every band in order, the model is released afterwards
+      *************************************************************************/
+      int Run(const BandSink &sink);
+
+   private:
+      CPUModel *_model;
+      TiffStackReader *_reader;
+      int _bandRows;
+      OpticalStack _optics;
+      std::vector<double> _angles;
+   };
+
+   /****************************************************************************
+   * @brief Fits a looped time-lapse acquisition, a stack of timepoints that
+   * each repeat the same angle sequence, one timepoint at a time.
+   *
+   * The model runs in its time series mode, so each timepoint after the
+   * first refits only the pixels that changed and starts them from their
+   * previous solution. Every timepoint's seven output images go to the sink
+   * as soon as they are fit, e.g. to write a (T, param, Y, X) hyperstack.
+   ****************************************************************************/
+   class SeriesFit
+   {
+   public:
+      /**Receives the seven output images of timepoint t, returns nonzero to
+      stop the fit*/
+      typedef std::function<int(int t, std::vector<cv::Mat> &outputs)> TimepointSink;
+
+      /*************************************************************************
+      * @brief The model's solver and start settings are used as they are,
+      * both objects must outlive the fit
+      *************************************************************************/
+      SeriesFit(CPUModel *model, TiffStackReader *reader);
+      ~SeriesFit();
+
+      /*************************************************************************
+      * @brief Frames of one timepoint, the stack must hold a whole number of
+      * timepoints
+      *************************************************************************/
+      int SetFramesPerTimepoint(int frames);
+
+      /*************************************************************************
+      * @brief Change a pixel's frames need before it is fit again, see
+      * CPUModel::SetTimeSeries
+      *************************************************************************/
+      int SetChangeThreshold(double threshold);
+
+      /**Angles of one timepoint's frames*/
+      int SetConstants(double wavelength, double dOx, double nB, double nOx, double nSi, const double *angles);
+      int SetConstants(const OpticalStack &stack, const double *angles);
+
+      int Timepoints() const { return _frames > 0 ? _reader->Frames() / _frames : 0; }
+
+      /*************************************************************************
+      * @brief Fits every timepoint in order, the model is released afterwards
+      *************************************************************************/
+      int Run(const TimepointSink &sink);
+
+   private:
+      CPUModel *_model;
+      TiffStackReader *_reader;
+      int _frames;
+      double _threshold;
+      OpticalStack _optics;
+      std::vector<double> _angles;
+   };
+}
+
+#endif //STREAM_FIT_H
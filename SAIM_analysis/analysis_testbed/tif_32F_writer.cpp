@@ -33,11 +33,352 @@
 //////////////////////////////////////////////////////////////////////////////*/
 
 #include "tiff_32F_writer.h"
+#include <cstring>
 #include <opencv2/core/core.hpp>
 #include <libtiff/tiffio.h>
 
 namespace tw32f
 {
-   Tiff32FWriter::Tiff32FWriter() {};
-   Tiff32FWriter::~Tiff32FWriter() {};
+   //Target strip size, large enough to keep libtiff's per strip overhead low
+   static const int StripBytes = 256 * 1024;
+
+   Tiff32FWriter::Tiff32FWriter() : _tif(nullptr), _width(0), _height(0), _pages(0), _rowsPerStrip(0),
+      _page(0), _pageRows(0), _holdLimit(512ull << 20), _holding(0), _stripRows(0), _spool(nullptr), _failed(false), _queueDepth(0),
+      _threaded(false), _stopping(false) {};
+
+   Tiff32FWriter::~Tiff32FWriter()
+   {
+      Close();
+   };
+
+   int Tiff32FWriter::Open(const std::string &path, int width, int height, int pages, bool bigTiff)
+   {
+      if (_tif != nullptr || width < 1 || height < 1 || pages < 1)
+         return 1;
+      //Leave room below 4 GB for the directories and strip tables
+      unsigned long long bytes = (unsigned long long)width * height * pages * sizeof(float);
+      bigTiff = bigTiff || bytes > 0xF0000000ull;
+      _tif = TIFFOpen(path.c_str(), bigTiff ? "w8" : "w");
+      if (_tif == nullptr)
+         return 1;
+      _width = width;
+      _height = height;
+      _pages = pages;
+      _rowsPerStrip = StripBytes / (width * (int)sizeof(float));
+      _rowsPerStrip = _rowsPerStrip < 1 ? 1 : _rowsPerStrip > height ? height : _rowsPerStrip;
+      _strip.resize((size_t)_rowsPerStrip * width);
+      _spooled.assign(pages, 0);
+      _held.assign(pages, std::vector<float>());
+      _holding = 0;
+      _page = 0;
+      _pageRows = 0;
+      _stripRows = 0;
+      _failed = false;
+      _description.clear();
+      return StartPage();
+   }
+
+   int Tiff32FWriter::SetPageNames(const std::vector<std::string> &names)
+   {
+      if (_tif == nullptr || _pageRows > 0 || _page > 0)
+         return 1;
+      _names = names;
+      if (!_names.empty())
+         TIFFSetField(_tif, TIFFTAG_PAGENAME, _names[0].c_str());
+      return 0;
+   }
+
+   int Tiff32FWriter::SetHyperstack(int channels, int frames)
+   {
+      if (_tif == nullptr || _pageRows > 0 || _page > 0 || channels < 1 || frames < 1 || channels * frames != _pages)
+         return 1;
+      _description = "ImageJ=1.11a\nimages=" + std::to_string(_pages) + "\nchannels=" + std::to_string(channels) +
+         "\nframes=" + std::to_string(frames) + "\nhyperstack=true\nmode=grayscale\n";
+      TIFFSetField(_tif, TIFFTAG_IMAGEDESCRIPTION, _description.c_str());
+      return 0;
+   }
+
+   int Tiff32FWriter::SetHoldMemory(size_t bytes)
+   {
+      if (_tif == nullptr || _pageRows > 0 || _page > 0)
+         return 1;
+      _holdLimit = bytes;
+      return 0;
+   }
+
+   int Tiff32FWriter::StartThread(int queueDepth)
+   {
+      if (_tif == nullptr || _threaded || queueDepth < 1)
+         return 1;
+      _queueDepth = queueDepth;
+      _stopping = false;
+      _threaded = true;
+      _writer = std::thread(&Tiff32FWriter::WriterLoop, this);
+      return 0;
+   }
+
+   int Tiff32FWriter::WriteBand(int firstRow, const std::vector<cv::Mat> &pages)
+   {
+      if (_tif == nullptr || (int)pages.size() != _pages)
+         return 1;
+      if (!_threaded)
+         return Write(firstRow, pages);
+      return Enqueue(firstRow, -1, pages);
+   }
+
+   int Tiff32FWriter::WritePages(int firstPage, const std::vector<cv::Mat> &pages)
+   {
+      if (_tif == nullptr || pages.empty() || firstPage < 0 || firstPage + (int)pages.size() > _pages)
+         return 1;
+      if (!_threaded)
+         return WriteWhole(firstPage, pages);
+      return Enqueue(0, firstPage, pages);
+   }
+
+   int Tiff32FWriter::Enqueue(int firstRow, int firstPage, const std::vector<cv::Mat> &pages)
+   {
+      //The caller reuses its buffers for the next band, so the queue holds copies
+      Band band;
+      band.firstRow = firstRow;
+      band.firstPage = firstPage;
+      for (size_t i = 0; i < pages.size(); i++)
+         band.pages.push_back(pages[i].clone());
+      std::unique_lock<std::mutex> lock(_queueLock);
+      _queueChanged.wait(lock, [this] { return _queue.size() < (size_t)_queueDepth; });
+      _queue.push_back(std::move(band));
+      _queueChanged.notify_all();
+      return _failed ? 1 : 0;
+   }
+
+   int Tiff32FWriter::Close()
+   {
+      if (_threaded)
+      {
+         {
+            std::lock_guard<std::mutex> lock(_queueLock);
+            _stopping = true;
+         }
+         _queueChanged.notify_all();
+         _writer.join();
+         _threaded = false;
+      }
+      if (_tif == nullptr)
+         return 0;
+      //Pages that never got all their rows are padded with zeros
+      while (_page < _pages)
+      {
+         if (_pageRows < _height)
+         {
+            std::vector<float> zeros(_width, 0.0f);
+            for (int r = _pageRows; r < _height; r++)
+               WriteRows(zeros.data(), 1);
+         }
+         FinishPage();
+      }
+      TIFFClose(_tif);
+      _tif = nullptr;
+      _held.clear();
+      _holding = 0;
+      if (_spool != nullptr)
+      {
+         fclose(_spool);
+         _spool = nullptr;
+      }
+      return _failed ? 1 : 0;
+   }
+
+   int Tiff32FWriter::Write(int firstRow, const std::vector<cv::Mat> &pages)
+   {
+      int rows = pages[0].rows;
+      if (firstRow < 0 || firstRow + rows > _height)
+      {
+         _failed = true;
+         return 1;
+      }
+      const size_t rowBytes = (size_t)_width * sizeof(float);
+      for (int i = 0; i < _pages; i++)
+      {
+         if (pages[i].rows != rows || pages[i].cols != _width || pages[i].type() != CV_32F)
+         {
+            _failed = true;
+            return 1;
+         }
+         if (i < _page)
+            continue;
+         if (i == _page)
+         {
+            if (firstRow != _pageRows)
+            {
+               _failed = true;
+               return 1;
+            }
+            WriteRows(pages[i].ptr<float>(), rows);
+            if (_pageRows == _height)
+               FinishPage();
+            continue;
+         }
+         if (firstRow != _spooled[i])
+         {
+            _failed = true;
+            return 1;
+         }
+         //A page is held in memory as a whole or not at all, decided by its first band
+         const size_t pageBytes = (size_t)_height * rowBytes;
+         if (firstRow == 0 && _holding + pageBytes <= _holdLimit)
+         {
+            _held[i].reserve((size_t)_height * _width);
+            _holding += pageBytes;
+         }
+         if (_held[i].capacity() > 0)
+         {
+            _held[i].insert(_held[i].end(), pages[i].ptr<float>(), pages[i].ptr<float>() + (size_t)rows * _width);
+            _spooled[i] += rows;
+            continue;
+         }
+         if (_spool == nullptr)
+            _spool = tmpfile();
+         long long offset = ((long long)(i - 1) * _height + firstRow) * (long long)rowBytes;
+#ifdef _WIN32
+         bool ok = _spool != nullptr && _fseeki64(_spool, offset, SEEK_SET) == 0;
+#else
+         bool ok = _spool != nullptr && fseeko(_spool, offset, SEEK_SET) == 0;
+#endif
+         if (!ok || fwrite(pages[i].ptr<float>(), rowBytes, rows, _spool) != (size_t)rows)
+         {
+            _failed = true;
+            return 1;
+         }
+         _spooled[i] += rows;
+      }
+      return _failed ? 1 : 0;
+   }
+
+   int Tiff32FWriter::WriteWhole(int firstPage, const std::vector<cv::Mat> &pages)
+   {
+      if (firstPage != _page || _pageRows != 0)
+      {
+         _failed = true;
+         return 1;
+      }
+      for (size_t i = 0; i < pages.size(); i++)
+      {
+         if (pages[i].rows != _height || pages[i].cols != _width || pages[i].type() != CV_32F || !pages[i].isContinuous())
+         {
+            _failed = true;
+            return 1;
+         }
+         WriteRows(pages[i].ptr<float>(), _height);
+         FinishPage();
+      }
+      return _failed ? 1 : 0;
+   }
+
+   int Tiff32FWriter::WriteRows(const float *rows, int count)
+   {
+      while (count > 0)
+      {
+         int take = _rowsPerStrip - _stripRows < count ? _rowsPerStrip - _stripRows : count;
+         memcpy(_strip.data() + (size_t)_stripRows * _width, rows, (size_t)take * _width * sizeof(float));
+         _stripRows += take;
+         _pageRows += take;
+         rows += (size_t)take * _width;
+         count -= take;
+         if (_stripRows == _rowsPerStrip || _pageRows == _height)
+         {
+            uint32_t strip = (_pageRows - 1) / _rowsPerStrip;
+            if (TIFFWriteEncodedStrip(_tif, strip, _strip.data(), (tmsize_t)_stripRows * _width * sizeof(float)) < 0)
+               _failed = true;
+            _stripRows = 0;
+         }
+      }
+      return _failed ? 1 : 0;
+   }
+
+   int Tiff32FWriter::StartPage()
+   {
+      TIFFSetField(_tif, TIFFTAG_IMAGEWIDTH, (uint32_t)_width);
+      TIFFSetField(_tif, TIFFTAG_IMAGELENGTH, (uint32_t)_height);
+      TIFFSetField(_tif, TIFFTAG_BITSPERSAMPLE, 32);
+      TIFFSetField(_tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+      TIFFSetField(_tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+      TIFFSetField(_tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+      TIFFSetField(_tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+      TIFFSetField(_tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+      TIFFSetField(_tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)_rowsPerStrip);
+      TIFFSetField(_tif, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+      TIFFSetField(_tif, TIFFTAG_PAGENUMBER, (uint16_t)_page, (uint16_t)_pages);
+      if (_page < (int)_names.size())
+         TIFFSetField(_tif, TIFFTAG_PAGENAME, _names[_page].c_str());
+      if (_page == 0 && !_description.empty())
+         TIFFSetField(_tif, TIFFTAG_IMAGEDESCRIPTION, _description.c_str());
+      _pageRows = 0;
+      _stripRows = 0;
+      return 0;
+   }
+
+   int Tiff32FWriter::FinishPage()
+   {
+      if (!TIFFWriteDirectory(_tif))
+         _failed = true;
+      _page++;
+      if (_page == _pages)
+         return _failed ? 1 : 0;
+      StartPage();
+
+      //Rows that arrived before this page came up are drained from memory or the spool
+      if (_held[_page].capacity() > 0)
+      {
+         WriteRows(_held[_page].data(), _spooled[_page]);
+         _holding -= (size_t)_height * _width * sizeof(float);
+         std::vector<float>().swap(_held[_page]);
+         if (_pageRows == _height)
+            return FinishPage();
+      }
+      else if (_spooled[_page] > 0)
+      {
+         const size_t rowBytes = (size_t)_width * sizeof(float);
+         long long offset = (long long)(_page - 1) * _height * (long long)rowBytes;
+#ifdef _WIN32
+         bool ok = _fseeki64(_spool, offset, SEEK_SET) == 0;
+#else
+         bool ok = fseeko(_spool, offset, SEEK_SET) == 0;
+#endif
+         std::vector<float> rows((size_t)_rowsPerStrip * _width);
+         int remaining = _spooled[_page];
+         while (ok && remaining > 0)
+         {
+            int count = remaining < _rowsPerStrip ? remaining : _rowsPerStrip;
+            ok = fread(rows.data(), rowBytes, count, _spool) == (size_t)count;
+            if (ok)
+               WriteRows(rows.data(), count);
+            remaining -= count;
+         }
+         if (!ok)
+            _failed = true;
+         if (_pageRows == _height)
+            return FinishPage();
+      }
+      return _failed ? 1 : 0;
+   }
+
+   void Tiff32FWriter::WriterLoop()
+   {
+      while (true)
+      {
+         Band band;
+         {
+            std::unique_lock<std::mutex> lock(_queueLock);
+            _queueChanged.wait(lock, [this] { return !_queue.empty() || _stopping; });
+            if (_queue.empty())
+               return;
+            band = std::move(_queue.front());
+            _queue.pop_front();
+         }
+         _queueChanged.notify_all();
+         if (band.firstPage < 0)
+            Write(band.firstRow, band.pages);
+         else
+            WriteWhole(band.firstPage, band.pages);
+      }
+   }
 }
\ No newline at end of file
@@ -35,13 +35,135 @@
 #ifndef TIFF_32F_WRITER_H
 #define TIFF_32F_WRITER_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <libtiff/tiffio.h>
+
+namespace cv
+{
+   class Mat;
+};
+
 namespace tw32f
 {
+   /****************************************************************************
+   * @brief Writes float32 images as the pages of one multi-page TIFF, a strip
+   * at a time.
+   *
+   * Bands of rows can be handed over for all pages at once as they come out
+   * of the fit. The page libtiff is currently writing takes its rows straight
+   * into strips, a TIFF page has to be finished before the next is started,
+   * so rows for later pages are held until their page comes up. They are
+   * held in memory while the whole pages fit in SetHoldMemory's budget
+   * (512 MB by default, 21 pages of 2048 x 3072), pages past it wait in a
+   * tmpfile spool and go through the disk twice. Whole images go straight
+   * through without holding anything. With StartThread the encoding and
+   * disk writes move to a background thread and WriteBand only copies the
+   * band into a bounded queue.
+   ****************************************************************************/
    class Tiff32FWriter
    {
    public:
       Tiff32FWriter();
       ~Tiff32FWriter();
+
+      /*************************************************************************
+      * @brief Creates the file
+      * @param bigTiff Always write BigTIFF, otherwise BigTIFF is only used
+      * when the pages would not fit in a classic TIFF
+      *************************************************************************/
+      int Open(const std::string &path, int width, int height, int pages, bool bigTiff = false);
+
+      /*************************************************************************
+      * @brief Optional names stored in each page's PageName tag, must be set
+      * before the first write
+      *************************************************************************/
+      int SetPageNames(const std::vector<std::string> &names);
+
+      /*************************************************************************
+      * @brief Tags the file as an ImageJ hyperstack of channels x frames
+      * pages, channel fastest, e.g. the fit maps of each timepoint of a time
+      * series. Must be set before the first write.
+      *************************************************************************/
+      int SetHyperstack(int channels, int frames);
+
+      /*************************************************************************
+      * @brief Memory for the rows of pages after the one being written, must
+      * be set before the first write. Pages that do not fit are spooled to a
+      * temporary file.
+      *************************************************************************/
+      int SetHoldMemory(size_t bytes);
+
+      /*************************************************************************
+      * @brief Moves the writes to a background thread, at most queueDepth
+      * bands are held before WriteBand blocks
+      *************************************************************************/
+      int StartThread(int queueDepth = 4);
+
+      /*************************************************************************
+      * @brief Writes rows [firstRow, firstRow + rows) of every page, bands of
+      * each page must arrive in row order
+      * @param pages One CV_32F image per page, all with the same rows
+      *************************************************************************/
+      int WriteBand(int firstRow, const std::vector<cv::Mat> &pages);
+
+      /*************************************************************************
+      * @brief Writes whole images as the next pages, starting at firstPage,
+      * which must be the page being written. Cannot be mixed with bands.
+      *************************************************************************/
+      int WritePages(int firstPage, const std::vector<cv::Mat> &pages);
+
+      /*************************************************************************
+      * @brief Flushes everything, joins the thread and finishes the file.
+      * Returns nonzero if any write failed.
+      *************************************************************************/
+      int Close();
+
+   private:
+      Tiff32FWriter(const Tiff32FWriter &) = delete;
+      Tiff32FWriter &operator=(const Tiff32FWriter &) = delete;
+
+      struct Band
+      {
+         int firstRow;
+         int firstPage;                //-1 for a band of every page
+         std::vector<cv::Mat> pages;
+      };
+
+      int Enqueue(int firstRow, int firstPage, const std::vector<cv::Mat> &pages);
+      int Write(int firstRow, const std::vector<cv::Mat> &pages);
+      int WriteWhole(int firstPage, const std::vector<cv::Mat> &pages);
+      int WriteRows(const float *rows, int count);
+      int StartPage();
+      int FinishPage();
+      void WriterLoop();
+
+      TIFF *_tif;
+      int _width, _height, _pages, _rowsPerStrip;
+      std::vector<std::string> _names;
+      std::string _description;
+      int _page;                       //page being written
+      int _pageRows;                   //rows of the current page written
+      std::vector<int> _spooled;       //rows of each page held back
+      std::vector<std::vector<float>> _held;   //rows held in memory, empty for spooled pages
+      size_t _holdLimit, _holding;
+      std::vector<float> _strip;
+      int _stripRows;
+      FILE *_spool;
+      std::atomic<bool> _failed;
+
+      std::thread _writer;
+      std::mutex _queueLock;
+      std::condition_variable _queueChanged;
+      std::deque<Band> _queue;
+      int _queueDepth;
+      bool _threaded, _stopping;
    };
 }
 
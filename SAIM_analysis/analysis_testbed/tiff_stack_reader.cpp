@@ -0,0 +1,200 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "tiff_stack_reader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <opencv2/core/core.hpp>
+
+namespace cpu_model
+{
+   TiffStackReader::TiffStackReader() : _tif(nullptr), _rows(0), _cols(0) {}
+
+   TiffStackReader::~TiffStackReader()
+   {
+      Close();
+   }
+
+   int TiffStackReader::Open(const std::string &path)
+   {
+      Close();
+      //No memory mapping, a mapped stack would count against the resident set
+      _tif = TIFFOpen(path.c_str(), "rm");
+      if (_tif == nullptr)
+         return 1;
+      do
+      {
+         uint32_t width{ 0 }, height{ 0 };
+         uint16_t bits{ 0 }, samples{ 1 };
+         TIFFGetField(_tif, TIFFTAG_IMAGEWIDTH, &width);
+         TIFFGetField(_tif, TIFFTAG_IMAGELENGTH, &height);
+         TIFFGetFieldDefaulted(_tif, TIFFTAG_BITSPERSAMPLE, &bits);
+         TIFFGetFieldDefaulted(_tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+         if (_pages.empty())
+         {
+            _rows = (int)height;
+            _cols = (int)width;
+         }
+         if (bits != 16 || samples != 1 || TIFFIsTiled(_tif) ||
+            (int)height != _rows || (int)width != _cols)
+         {
+            Close();
+            return 1;
+         }
+         _pages.push_back(TIFFCurrentDirOffset(_tif));
+      } while (TIFFReadDirectory(_tif));
+      _strips.resize(_pages.size());
+      _stripIndex.assign(_pages.size(), -1);
+      return 0;
+   }
+
+   void TiffStackReader::Close()
+   {
+      if (_tif != nullptr)
+      {
+         TIFFClose(_tif);
+         _tif = nullptr;
+      }
+      _pages.clear();
+      _strips.clear();
+      _stripIndex.clear();
+      _rows = 0;
+      _cols = 0;
+   }
+
+   int TiffStackReader::ReadBand(int firstRow, int rows, std::vector<cv::Mat> &band)
+   {
+      if (_tif == nullptr || firstRow < 0 || rows < 1 || firstRow + rows > _rows)
+         return 1;
+      band.resize(_pages.size());
+      for (size_t i = 0; i < _pages.size(); i++)
+      {
+         if (ReadRows((int)i, firstRow, rows, band[i]))
+            return 1;
+      }
+      return 0;
+   }
+
+   int TiffStackReader::ReadPages(int firstPage, int pages, std::vector<cv::Mat> &stack)
+   {
+      if (_tif == nullptr || firstPage < 0 || pages < 1 || firstPage + pages > (int)_pages.size())
+         return 1;
+      stack.resize(pages);
+      for (int i = 0; i < pages; i++)
+      {
+         if (ReadRows(firstPage + i, 0, _rows, stack[i]))
+            return 1;
+      }
+      return 0;
+   }
+
+   int TiffStackReader::ReadRows(int page, int firstRow, int rows, cv::Mat &dst)
+   {
+      dst.create(rows, _cols, CV_16U);
+      if (!TIFFSetSubDirectory(_tif, _pages[page]))
+         return 1;
+      uint32_t rowsPerStrip{ 0 };
+      uint16_t compression{ COMPRESSION_NONE };
+      TIFFGetFieldDefaulted(_tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+      TIFFGetFieldDefaulted(_tif, TIFFTAG_COMPRESSION, &compression);
+      if (rowsPerStrip == 0 || rowsPerStrip > (uint32_t)_rows)
+         rowsPerStrip = _rows;
+      if (compression == COMPRESSION_NONE)
+         return ReadRawRows(firstRow, rows, (int)rowsPerStrip, dst);
+      return ReadStripRows(page, firstRow, rows, (int)rowsPerStrip, dst);
+   }
+
+   int TiffStackReader::ReadRawRows(int firstRow, int rows, int rowsPerStrip, cv::Mat &dst)
+   {
+      const uint64_t rowBytes = (uint64_t)_cols * sizeof(unsigned short);
+      thandle_t handle = TIFFClientdata(_tif);
+      int row = firstRow;
+      while (row < firstRow + rows)
+      {
+         uint32_t strip = TIFFComputeStrip(_tif, row, 0);
+         int stripFirst = strip * rowsPerStrip;
+         int stripEnd = stripFirst + rowsPerStrip;
+         int last = stripEnd < firstRow + rows ? stripEnd : firstRow + rows;
+         uint64_t offset = (row - stripFirst) * rowBytes, bytes = (last - row) * rowBytes;
+         //A strip too short for its rows is truncated, decoding it would fail too
+         if (offset + bytes > TIFFGetStrileByteCount(_tif, strip))
+            return 1;
+         if (TIFFGetSeekProc(_tif)(handle, TIFFGetStrileOffset(_tif, strip) + offset, SEEK_SET) == (toff_t)-1)
+            return 1;
+         if (TIFFGetReadProc(_tif)(handle, dst.ptr<unsigned short>(row - firstRow), (tmsize_t)bytes) != (tmsize_t)bytes)
+            return 1;
+         row = last;
+      }
+      if (TIFFIsByteSwapped(_tif))
+      {
+         for (int r = 0; r < rows; r++)
+            TIFFSwabArrayOfShort(dst.ptr<uint16_t>(r), _cols);
+      }
+      return 0;
+   }
+
+   int TiffStackReader::ReadStripRows(int page, int firstRow, int rows, int rowsPerStrip, cv::Mat &dst)
+   {
+      const size_t rowBytes = (size_t)_cols * sizeof(unsigned short);
+      std::vector<unsigned char> &buffer = _strips[page];
+      int row = firstRow;
+      while (row < firstRow + rows)
+      {
+         uint32_t strip = TIFFComputeStrip(_tif, row, 0);
+         int stripFirst = strip * rowsPerStrip;
+         if (_stripIndex[page] != (int)strip)
+         {
+            buffer.resize(TIFFStripSize(_tif));
+            _stripIndex[page] = -1;
+            if (TIFFReadEncodedStrip(_tif, strip, buffer.data(), buffer.size()) < 0)
+               return 1;
+            _stripIndex[page] = (int)strip;
+         }
+         int stripEnd = stripFirst + rowsPerStrip < _rows ? stripFirst + rowsPerStrip : _rows;
+         int last = stripEnd < firstRow + rows ? stripEnd : firstRow + rows;
+         memcpy(dst.ptr<unsigned short>(row - firstRow), buffer.data() + (row - stripFirst) * rowBytes,
+            (last - row) * rowBytes);
+         row = last;
+         //A band ending inside the strip leaves it for the next band, once
+         //a band reaches its end no later band needs it
+         if (last == stripEnd)
+         {
+            std::vector<unsigned char>().swap(buffer);
+            _stripIndex[page] = -1;
+         }
+      }
+      return 0;
+   }
+}
@@ -0,0 +1,118 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef TIFF_STACK_READER_H
+#define TIFF_STACK_READER_H
+
+#include <string>
+#include <vector>
+#include <libtiff/tiffio.h>
+
+namespace cv
+{
+   class Mat;
+};
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Reads row bands out of every page of a 16 bit multi-page TIFF
+   * without holding the whole stack.
+   *
+   * Open walks the page chain once to record each page's directory offset,
+   * ReadBand then jumps straight to each page. Uncompressed pages are read
+   * straight from the file a band's rows at a time, so a page written as a
+   * single strip (Micro-Manager, ImageJ) costs no more than a striped one.
+   * Compressed pages decode each strip overlapping the band once; a strip
+   * the band ends inside is kept, one per page, until a later band has used
+   * its remaining rows. Memory use is the band plus, for compressed stacks,
+   * one decoded strip per page, which for compressed single strip pages is
+   * the whole stack. Needs libtiff 4.1 or later.
+   ****************************************************************************/
+   class TiffStackReader
+   {
+   public:
+      TiffStackReader();
+      ~TiffStackReader();
+
+      /*************************************************************************
+      * @brief Opens the stack, fails unless every page is a stripped, single
+      * channel, 16 bit image of the same size
+      *************************************************************************/
+      int Open(const std::string &path);
+
+      void Close();
+
+      int Frames() const { return (int)_pages.size(); }
+      int Rows() const { return _rows; }
+      int Cols() const { return _cols; }
+
+      /*************************************************************************
+      * @brief Reads rows [firstRow, firstRow + rows) of every page
+      * @param band Out: one CV_16U image per page, reused when the shape
+      * matches the previous call
+      *************************************************************************/
+      int ReadBand(int firstRow, int rows, std::vector<cv::Mat> &band);
+
+      /*************************************************************************
+      * @brief Reads whole pages [firstPage, firstPage + pages), e.g. one
+      * timepoint of a looped acquisition
+      * @param stack Out: one CV_16U image per page, reused like ReadBand's
+      *************************************************************************/
+      int ReadPages(int firstPage, int pages, std::vector<cv::Mat> &stack);
+
+   private:
+      TiffStackReader(const TiffStackReader &) = delete;
+      TiffStackReader &operator=(const TiffStackReader &) = delete;
+
+      //Decodes rows [firstRow, firstRow + rows) of one page into dst
+      int ReadRows(int page, int firstRow, int rows, cv::Mat &dst);
+
+      //Reads the rows of the current, uncompressed page from the file
+      int ReadRawRows(int firstRow, int rows, int rowsPerStrip, cv::Mat &dst);
+
+      //Copies the rows of the current, compressed page out of its decoded
+      //strips, decoding each strip only if the page's kept one is different
+      int ReadStripRows(int page, int firstRow, int rows, int rowsPerStrip, cv::Mat &dst);
+
+      TIFF *_tif;
+      std::vector<uint64_t> _pages;
+      int _rows, _cols;
+      //The last decoded strip of each page and its index, -1 for none
+      std::vector<std::vector<unsigned char>> _strips;
+      std::vector<int> _stripIndex;
+   };
+}
+
+#endif //TIFF_STACK_READER_H
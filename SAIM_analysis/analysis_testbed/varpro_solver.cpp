@@ -0,0 +1,176 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "varpro_solver.h"
+
+#include <cmath>
+#include <mkl.h>
+
+namespace cpu_model
+{
+   VarProSolver::VarProSolver(const HeightBasis *basis) : _basis(basis), _n(basis->Frames())
+   {
+      _data = (double *)mkl_malloc(3 * _n * sizeof(double), 64);
+      _shape = _data + _n;
+      _slope = _shape + _n;
+   }
+
+   VarProSolver::~VarProSolver()
+   {
+      mkl_free(_data);
+   }
+
+   void VarProSolver::SetTolerances(const double *eps, int iterations)
+   {
+      for (int i = 0; i < 6; i++)
+         _eps[i] = eps[i];
+      _maxIterations = iterations;
+   }
+
+   int VarProSolver::Solve(const unsigned short *pixel, double *xvec, double *fvec, int *stopCrit, int *iterations)
+   {
+      const double n = (double)_n;
+      double sy{ 0.0 }, syy{ 0.0 };
+      for (int i = 0; i < _n; i++)
+      {
+         _data[i] = (double)pixel[i];
+         sy += _data[i];
+         syy += _data[i] * _data[i];
+      }
+
+      //Coarse scan, residual sum of squares of the linear fit at each height
+      int best{ 0 };
+      double bestCost{ HUGE_VAL };
+      for (int j = 0; j < _basis->Points(); j++)
+      {
+         const double *curve = _basis->Curve(j);
+         double ss{ _basis->Sum(j) }, sss{ _basis->SumSq(j) }, ssy{ 0.0 };
+#pragma omp simd reduction(+:ssy)
+         for (int i = 0; i < _n; i++)
+            ssy += curve[i] * _data[i];
+         double det = n * sss - ss * ss;
+         double A = (n * ssy - ss * sy) / det;
+         double B = (sy - A * ss) / n;
+         double cost = syy - A * ssy - B * sy;
+         if (cost < bestCost)
+         {
+            bestCost = cost;
+            best = j;
+         }
+      }
+
+      //Gauss-Newton on the projected residual
+      double H{ _basis->Height(best) }, prevH{ H }, prevCost{ HUGE_VAL };
+      double A{ 0.0 }, B{ 0.0 };
+      int stop{ 0 }, iter{ 0 };
+      while (stop == 0)
+      {
+         _basis->Evaluate(H, _shape, _slope);
+         double ss{ 0.0 }, sss{ 0.0 }, ssy{ 0.0 }, sd{ 0.0 }, ssd{ 0.0 }, sdd{ 0.0 }, sdy{ 0.0 };
+         for (int i = 0; i < _n; i++)
+         {
+            ss += _shape[i];
+            sss += _shape[i] * _shape[i];
+            ssy += _shape[i] * _data[i];
+            sd += _slope[i];
+            ssd += _shape[i] * _slope[i];
+            sdd += _slope[i] * _slope[i];
+            sdy += _slope[i] * _data[i];
+         }
+         double det = n * sss - ss * ss;
+         A = (n * ssy - ss * sy) / det;
+         B = (sy - A * ss) / n;
+         double cost = syy - A * ssy - B * sy;
+         if (cost > prevCost)
+         {
+            //Overshot, back off towards the last accepted height
+            H = 0.5 * (H + prevH);
+            if (fabs(H - prevH) < _eps[3])
+            {
+               H = prevH;
+               stop = 5;
+            }
+            else if (++iter >= _maxIterations)
+               stop = 1;
+            continue;
+         }
+         if (sqrt(fmax(cost, 0.0)) < _eps[1])
+         {
+            stop = 3;
+            break;
+         }
+         //J = P(A * s'), J'F = A * s'F because F is orthogonal to s and 1
+         double proj = (n * ssd * ssd - 2.0 * ss * ssd * sd + sss * sd * sd) / det;
+         double jtj = A * A * (sdd - proj);
+         if (sqrt(fmax(jtj, 0.0)) < _eps[2])
+         {
+            stop = 4;
+            break;
+         }
+         double jtf = A * (sdy - A * ssd - B * sd);
+         double step = jtf / jtj;
+         if (step > _basis->Step())
+            step = _basis->Step();
+         else if (step < -_basis->Step())
+            step = -_basis->Step();
+         prevH = H;
+         prevCost = cost;
+         H += step;
+         iter++;
+         if (fabs(step) < _eps[3])
+            stop = 5;
+         else if (iter >= _maxIterations)
+            stop = 1;
+      }
+
+      _basis->Evaluate(H, _shape, _slope);
+      double ss{ 0.0 }, sss{ 0.0 }, ssy{ 0.0 };
+      for (int i = 0; i < _n; i++)
+      {
+         ss += _shape[i];
+         sss += _shape[i] * _shape[i];
+         ssy += _shape[i] * _data[i];
+      }
+      A = (n * ssy - ss * sy) / (n * sss - ss * ss);
+      B = (sy - A * ss) / n;
+      for (int i = 0; i < _n; i++)
+         fvec[i] = _data[i] - (A * _shape[i] + B);
+      xvec[0] = A;
+      xvec[1] = B;
+      xvec[2] = H;
+      *stopCrit = stop;
+      *iterations = iter;
+      return 0;
+   }
+}
@@ -0,0 +1,92 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef VARPRO_SOLVER_H
+#define VARPRO_SOLVER_H
+
+#include "height_basis.h"
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief Variable projection fit of the SAIM model.
+   *
+   * For a fixed H the model is linear in A and B, so they are solved in
+   * closed form and only H is searched. The search scans the HeightBasis grid
+   * (one dot product per grid point, no trig) and then polishes the best
+   * point with Gauss-Newton steps on the projected residual. Stop criteria
+   * use the dtrnlsp_get codes:
+   *    1 - iteration limit reached
+   *    3 - ||F(x)|| < eps[1]
+   *    4 - the projected Jacobian ||P J_H|| < eps[2]
+   *    5 - |dH| < eps[3]
+   ****************************************************************************/
+   class VarProSolver
+   {
+   public:
+      /*************************************************************************
+      * @brief Sets up the solver, the basis must outlive the solver
+      *************************************************************************/
+      VarProSolver(const HeightBasis *basis);
+      ~VarProSolver();
+
+      /*************************************************************************
+      * @brief Sets the stop tolerances (6 values, same order as dtrnlsp) and
+      * the iteration limit of the polishing step
+      *************************************************************************/
+      void SetTolerances(const double *eps, int iterations);
+
+      /*************************************************************************
+      * @brief Fits one pixel
+      * @param pixel The frames of the pixel
+      * @param xvec Out: (A, B, H)
+      * @param fvec Out: residual (data - model)
+      * @param stopCrit Out: stop criterion
+      * @param iterations Out: number of Gauss-Newton iterations
+      *************************************************************************/
+      int Solve(const unsigned short *pixel, double *xvec, double *fvec, int *stopCrit, int *iterations);
+
+   private:
+      VarProSolver(const VarProSolver &) = delete;
+      VarProSolver &operator=(const VarProSolver &) = delete;
+
+      const HeightBasis *_basis;
+      int _n;
+      int _maxIterations{ 100 };
+      double _eps[6]{ 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001, 0.000000001 };
+      double *_data, *_shape, *_slope;
+   };
+}
+
+#endif //VARPRO_SOLVER_H
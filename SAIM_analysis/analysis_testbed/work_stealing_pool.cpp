@@ -0,0 +1,298 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#include "work_stealing_pool.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cpu_model
+{
+   WorkStealingPool::WorkStealingPool() : _workers(0), _pin(true), _queues(nullptr), _completed(0), _stolen(0),
+      _body(nullptr), _generation(0), _running(0), _stop(false)
+   {
+      SetWorkers(0);
+   }
+
+   WorkStealingPool::~WorkStealingPool()
+   {
+      Stop();
+      delete[] _queues;
+   }
+
+   int WorkStealingPool::SetWorkers(int workers)
+   {
+      if (workers < 0)
+         return 1;
+      if (workers == 0)
+         workers = std::thread::hardware_concurrency();
+      Stop();
+      _workers = workers < 1 ? 1 : workers;
+      delete[] _queues;
+      _queues = new Queue[_workers];
+      return 0;
+   }
+
+   int WorkStealingPool::SetPinning(bool pin)
+   {
+      if (pin != _pin)
+         Stop();
+      _pin = pin;
+      return 0;
+   }
+
+   int WorkStealingPool::Run(int items, const std::function<void(int worker, int item)> &body)
+   {
+      if (items < 0)
+         return 1;
+      if (_threads.empty())
+         Start();
+      _completed = 0;
+      _stolen = 0;
+      for (int w = 0; w < _workers; w++)
+      {
+         _queues[w].begin = (int)((long long)items * w / _workers);
+         _queues[w].end = (int)((long long)items * (w + 1) / _workers);
+      }
+      std::unique_lock<std::mutex> lock(_lock);
+      _body = &body;
+      _running = _workers;
+      _generation++;
+      _wake.notify_all();
+      _done.wait(lock, [this]() { return _running == 0; });
+      _body = nullptr;
+      return 0;
+   }
+
+   void WorkStealingPool::Start()
+   {
+      if (_pin && _processors.empty())
+         _processors = ProcessorOrder();
+      _stop = false;
+      for (int w = 0; w < _workers; w++)
+         _threads.push_back(std::thread(&WorkStealingPool::Loop, this, w, _generation));
+   }
+
+   void WorkStealingPool::Stop()
+   {
+      if (_threads.empty())
+         return;
+      {
+         std::lock_guard<std::mutex> lock(_lock);
+         _stop = true;
+      }
+      _wake.notify_all();
+      for (size_t t = 0; t < _threads.size(); t++)
+         _threads[t].join();
+      _threads.clear();
+   }
+
+   void WorkStealingPool::Loop(int worker, unsigned long long seen)
+   {
+      if (_pin)
+         Pin(worker);
+      for (;;)
+      {
+         const std::function<void(int, int)> *body;
+         {
+            std::unique_lock<std::mutex> lock(_lock);
+            _wake.wait(lock, [this, seen]() { return _stop || _generation != seen; });
+            if (_stop)
+               return;
+            seen = _generation;
+            body = _body;
+         }
+         Work(worker, *body);
+         std::lock_guard<std::mutex> lock(_lock);
+         if (--_running == 0)
+            _done.notify_one();
+      }
+   }
+
+   void WorkStealingPool::Work(int worker, const std::function<void(int, int)> &body)
+   {
+      int item;
+      while (Take(worker, &item) || Steal(worker, &item))
+      {
+         body(worker, item);
+         _completed.fetch_add(1, std::memory_order_relaxed);
+      }
+   }
+
+   bool WorkStealingPool::Take(int worker, int *item)
+   {
+      Queue &queue = _queues[worker];
+      std::lock_guard<std::mutex> lock(queue.lock);
+      if (queue.begin == queue.end)
+         return false;
+      *item = queue.begin++;
+      return true;
+   }
+
+   bool WorkStealingPool::Steal(int thief, int *item)
+   {
+      for (int i = 1; i < _workers; i++)
+      {
+         Queue &victim = _queues[(thief + i) % _workers];
+         int begin, end;
+         {
+            std::lock_guard<std::mutex> lock(victim.lock);
+            int remaining = victim.end - victim.begin;
+            if (remaining == 0)
+               continue;
+            end = victim.end;
+            begin = victim.end - (remaining + 1) / 2;
+            victim.end = begin;
+         }
+         _stolen.fetch_add(end - begin, std::memory_order_relaxed);
+         *item = begin;
+         Queue &own = _queues[thief];
+         std::lock_guard<std::mutex> lock(own.lock);
+         own.begin = begin + 1;
+         own.end = end;
+         return true;
+      }
+      return false;
+   }
+
+   void WorkStealingPool::Pin(int worker)
+   {
+      if (_processors.empty())
+         return;
+      int processor = _processors[worker % _processors.size()];
+#ifdef _WIN32
+      GROUP_AFFINITY affinity{};
+      affinity.Group = (WORD)(processor / 64);
+      affinity.Mask = (KAFFINITY)1 << (processor % 64);
+      SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#else
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(processor, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#endif
+   }
+
+   std::vector<int> WorkStealingPool::ProcessorOrder()
+   {
+      std::vector<std::vector<int>> nodes;
+#ifdef _WIN32
+      ULONG highest{ 0 };
+      GetNumaHighestNodeNumber(&highest);
+      for (USHORT node = 0; node <= highest; node++)
+      {
+         GROUP_AFFINITY affinity{};
+         if (!GetNumaNodeProcessorMaskEx(node, &affinity))
+            continue;
+         std::vector<int> processors;
+         for (int bit = 0; bit < 64; bit++)
+         {
+            if (affinity.Mask & ((KAFFINITY)1 << bit))
+               processors.push_back(affinity.Group * 64 + bit);
+         }
+         if (!processors.empty())
+            nodes.push_back(processors);
+      }
+#else
+      cpu_set_t allowed;
+      CPU_ZERO(&allowed);
+      sched_getaffinity(0, sizeof(cpu_set_t), &allowed);
+      for (int node = 0; ; node++)
+      {
+         char path[64];
+         snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+         FILE *file = fopen(path, "r");
+         if (file == nullptr)
+            break;
+         //cpulist is a comma separated list of ranges, e.g. 0-7,16-23
+         std::vector<int> processors;
+         int first, last;
+         while (fscanf(file, "%d", &first) == 1)
+         {
+            last = first;
+            int separator = fgetc(file);
+            if (separator == '-')
+            {
+               if (fscanf(file, "%d", &last) != 1)
+                  break;
+               separator = fgetc(file);
+            }
+            for (int p = first; p <= last && p < CPU_SETSIZE; p++)
+            {
+               if (CPU_ISSET(p, &allowed))
+                  processors.push_back(p);
+            }
+            if (separator != ',')
+               break;
+         }
+         fclose(file);
+         if (!processors.empty())
+            nodes.push_back(processors);
+      }
+      if (nodes.empty())
+      {
+         std::vector<int> processors;
+         for (int p = 0; p < CPU_SETSIZE; p++)
+         {
+            if (CPU_ISSET(p, &allowed))
+               processors.push_back(p);
+         }
+         nodes.push_back(processors);
+      }
+#endif
+      //Round-robin over the nodes so any worker count spreads evenly
+      std::vector<int> order;
+      for (size_t k = 0; ; k++)
+      {
+         bool any = false;
+         for (size_t n = 0; n < nodes.size(); n++)
+         {
+            if (k < nodes[n].size())
+            {
+               order.push_back(nodes[n][k]);
+               any = true;
+            }
+         }
+         if (!any)
+            break;
+      }
+      return order;
+   }
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cpu_model
+{
+   /****************************************************************************
+   * @brief std::thread work-stealing scheduler over a range of work items.
+   *
+   * Every worker starts with a contiguous block of the items and takes them
+   * from the front. A worker that runs dry steals the back half of another
+   * worker's remaining block, so neighbouring items stay on one thread and
+   * uneven items still balance. Workers can be pinned one per logical
+   * processor, spread round-robin over the NUMA nodes, so memory a worker
+   * touches first is allocated on its own node. The worker threads are
+   * started by the first Run and wait between runs, so a worker keeps its
+   * processor, and whatever it allocated, from one Run to the next. Needs
+   * nothing beyond the standard library and the OS.
+   ****************************************************************************/
+   class WorkStealingPool
+   {
+   public:
+      WorkStealingPool();
+      ~WorkStealingPool();
+
+      /*************************************************************************
+      * @brief Number of worker threads, 0 for one per logical processor.
+      * Running workers are stopped, the next Run starts the new set.
+      *************************************************************************/
+      int SetWorkers(int workers);
+
+      /*************************************************************************
+      * @brief Running workers are stopped, the next Run starts them pinned or
+      * free
+      *************************************************************************/
+      int SetPinning(bool);
+
+      int Workers() const { return _workers; }
+
+      /*************************************************************************
+      * @brief Runs body(worker, item) for every item in [0, items) on the
+      * worker threads and returns when all are done. The calling thread only
+      * waits. Calls for one worker are never concurrent and always come from
+      * the same thread until the workers are restarted. Not reentrant, body
+      * must not call Run.
+      *************************************************************************/
+      int Run(int items, const std::function<void(int worker, int item)> &body);
+
+      /**Items finished so far in the current or last Run, safe to poll from
+      another thread*/
+      int Completed() const { return _completed.load(std::memory_order_relaxed); }
+
+      /**Items that were moved between workers by steals in the last Run*/
+      int Stolen() const { return _stolen.load(std::memory_order_relaxed); }
+
+   private:
+      WorkStealingPool(const WorkStealingPool &) = delete;
+      WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+      struct Queue
+      {
+         std::mutex lock;
+         int begin, end;
+         char pad[64];        //keeps neighbouring queues off one cache line
+      };
+
+      void Start();
+      void Stop();
+      /**A worker's thread, waits for each Run after the generation it was
+      started at*/
+      void Loop(int worker, unsigned long long seen);
+      void Work(int worker, const std::function<void(int, int)> &body);
+      bool Take(int worker, int *item);
+      bool Steal(int thief, int *item);
+      void Pin(int worker);
+
+      /*************************************************************************
+      * @brief Logical processors in pinning order, alternating between NUMA
+      * nodes, restricted to the processors the process may run on
+      *************************************************************************/
+      static std::vector<int> ProcessorOrder();
+
+      int _workers;
+      bool _pin;
+      Queue *_queues;
+      std::vector<int> _processors;
+      std::atomic<int> _completed, _stolen;
+
+      std::vector<std::thread> _threads;
+      std::mutex _lock;
+      std::condition_variable _wake, _done;
+      const std::function<void(int, int)> *_body;
+      unsigned long long _generation;   //bumped by every Run to wake the workers
+      int _running;                     //workers still busy with this Run
+      bool _stop;
+   };
+}
+
+#endif //WORK_STEALING_POOL_H
\ No newline at end of file
@@ -0,0 +1,559 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef SAIM_WITH_TBB
+#include <tbb/tbb.h>
+#endif
+#include <opencv2/core/core.hpp>
+
+#include "saim_model_cpu.h"
+#include "synthetic_stack.h"
+
+using cpu_model::CPUModel;
+
+//Optics of the testbed
+static const cpu_model::SyntheticOptics Optics{ 560.0, 1910.5, 1.34, 1.463, 4.3638 };
+
+//Ways of running the fit
+enum class RunMode
+{
+   RUN_SERIAL,
+   RUN_PARFOR,
+   RUN_THREADED
+};
+
+//Mode of the cases that are not about the scheduler
+#ifdef SAIM_WITH_TBB
+static const RunMode ParallelMode = RunMode::RUN_PARFOR;
+#else
+static const RunMode ParallelMode = RunMode::RUN_THREADED;
+#endif
+
+//One benchmarked configuration of the model
+struct BenchCase
+{
+   RunMode mode;
+   CPUModel::SolverType solver;
+   CPUModel::WarmStartOrder warmStart;
+   bool fastSinCos;
+   //Tune the grain size on the case's arena before the timed runs
+   bool autoGrain;
+   //Instruction set build of the lane solvers
+   cpu_model::SimdLevel simd;
+};
+
+//Fit quality against the ground truth maps
+struct Accuracy
+{
+   double converged;          //fraction of pixels with stopCrit > 1
+   double hRmse, hBias, hMedianAbs, hWithin5;
+   double aRelRmse, bRmse;
+   double hVsDoubleRms, hVsDoubleMax;   //against the double batched fit
+};
+
+static const char *ModeName(RunMode mode)
+{
+   switch (mode)
+   {
+   case RunMode::RUN_SERIAL:
+      return "serial";
+   case RunMode::RUN_PARFOR:
+      return "parfor";
+   default:
+      return "threaded";
+   }
+}
+
+static const char *SolverName(CPUModel::SolverType solver)
+{
+   switch (solver)
+   {
+   case CPUModel::SolverType::SOLVER_BATCHED_LM:
+      return "batched_lm";
+   case CPUModel::SolverType::SOLVER_VARPRO:
+      return "varpro";
+   case CPUModel::SolverType::SOLVER_FLOAT_LM:
+      return "float_lm";
+   default:
+      return "mkl_trnlsp";
+   }
+}
+
+static int RunOnce(CPUModel &model, RunMode mode, int threads)
+{
+   switch (mode)
+   {
+   case RunMode::RUN_SERIAL:
+      return model.RunFit();
+#ifdef SAIM_WITH_TBB
+   case RunMode::RUN_PARFOR:
+   {
+      int result{ 0 };
+      tbb::task_arena arena(threads);
+      arena.execute([&model, &result]() { result = model.ParforRunFit(); });
+      return result;
+   }
+#endif
+   default:
+      model.SetThreadCount(threads);
+      return model.ThreadedRunFit();
+   }
+}
+
+static Accuracy Compare(const std::vector<cv::Mat> &outputs, const cpu_model::SyntheticStack &truth,
+   const cv::Mat &reference)
+{
+   Accuracy accuracy{};
+   const int pixels = truth.H.rows * truth.H.cols;
+   const float *A = outputs[0].ptr<float>(), *B = outputs[1].ptr<float>(), *H = outputs[2].ptr<float>(),
+      *stopCrit = outputs[3].ptr<float>(), *referenceH = reference.ptr<float>();
+   const float *trueA = truth.A.ptr<float>(), *trueB = truth.B.ptr<float>(), *trueH = truth.H.ptr<float>();
+   std::vector<double> absErrors;
+   absErrors.reserve(pixels);
+   for (int p = 0; p < pixels; p++)
+   {
+      if (stopCrit[p] > 1.0f)
+         accuracy.converged++;
+      double error = (double)H[p] - trueH[p];
+      if (!std::isfinite(error))
+         error = trueH[p];
+      accuracy.hRmse += error * error;
+      accuracy.hBias += error;
+      absErrors.push_back(fabs(error));
+      if (fabs(error) <= 5.0)
+         accuracy.hWithin5++;
+      double aError = ((double)A[p] - trueA[p]) / trueA[p];
+      double bError = (double)B[p] - trueB[p];
+      accuracy.aRelRmse += aError * aError;
+      accuracy.bRmse += bError * bError;
+      double difference = fabs((double)H[p] - referenceH[p]);
+      if (std::isfinite(difference))
+      {
+         accuracy.hVsDoubleRms += difference * difference;
+         accuracy.hVsDoubleMax = difference > accuracy.hVsDoubleMax ? difference : accuracy.hVsDoubleMax;
+      }
+   }
+   std::nth_element(absErrors.begin(), absErrors.begin() + pixels / 2, absErrors.end());
+   accuracy.hMedianAbs = absErrors[pixels / 2];
+   accuracy.converged /= pixels;
+   accuracy.hWithin5 /= pixels;
+   accuracy.hBias /= pixels;
+   accuracy.hRmse = sqrt(accuracy.hRmse / pixels);
+   accuracy.aRelRmse = sqrt(accuracy.aRelRmse / pixels);
+   accuracy.bRmse = sqrt(accuracy.bRmse / pixels);
+   accuracy.hVsDoubleRms = sqrt(accuracy.hVsDoubleRms / pixels);
+   return accuracy;
+}
+
+//Pixels with any output differing in any bit between two fits of the same
+//stack
+static int DifferingPixels(const std::vector<cv::Mat> &outputs, const std::vector<cv::Mat> &reference)
+{
+   const int pixels = outputs[0].rows * outputs[0].cols;
+   int differing{ 0 };
+   for (int p = 0; p < pixels; p++)
+   {
+      for (size_t k = 0; k < outputs.size(); k++)
+      {
+         if (memcmp(outputs[k].ptr<float>() + p, reference[k].ptr<float>() + p, sizeof(float)) != 0)
+         {
+            differing++;
+            break;
+         }
+      }
+   }
+   return differing;
+}
+
+//Fraction of pixels that stopped on the same criterion in both fits
+static double SameStopCrit(const cv::Mat &stopCrit, const cv::Mat &reference)
+{
+   const int pixels = stopCrit.rows * stopCrit.cols;
+   const float *mine = stopCrit.ptr<float>(), *theirs = reference.ptr<float>();
+   int same{ 0 };
+   for (int p = 0; p < pixels; p++)
+      same += mine[p] == theirs[p];
+   return (double)same / pixels;
+}
+
+//Untimed run so every thread has built its scratch, then the median of the
+//timed runs
+template <typename Run>
+static double MedianSeconds(int repeats, Run run)
+{
+   run();
+   std::vector<double> seconds;
+   for (int r = 0; r < repeats; r++)
+   {
+      auto earlier = std::chrono::steady_clock::now();
+      run();
+      std::chrono::duration<double> taken = std::chrono::steady_clock::now() - earlier;
+      seconds.push_back(taken.count());
+   }
+   std::sort(seconds.begin(), seconds.end());
+   return seconds[seconds.size() / 2];
+}
+
+static std::vector<int> ParseCounts(const std::string &list)
+{
+   std::vector<int> counts;
+   size_t start = 0;
+   while (start < list.size())
+   {
+      size_t end = list.find(',', start);
+      if (end == std::string::npos)
+         end = list.size();
+      int count = atoi(list.substr(start, end - start).c_str());
+      if (count > 0)
+         counts.push_back(count);
+      start = end + 1;
+   }
+   return counts;
+}
+
+//Times the frame count kernels against the generic loops, model and
+//Jacobian evaluations of every pixel at its true parameters and a serial
+//MKL fit, for each frame count
+static int KernelBenchmark(int rows, int cols, unsigned int seed, int repeats, const std::vector<int> &frameCounts,
+   const std::string &outPath)
+{
+   std::ofstream out(outPath);
+   if (!out)
+   {
+      std::cerr << "Could not create " << outPath << std::endl;
+      return 1;
+   }
+   out << "frames,kernel,rows,cols,seed,repeats,eval_seconds,evals_per_second,fit_seconds,pixels_per_second,"
+      "eval_speedup,fit_speedup" << std::endl;
+
+   const int pixels = rows * cols;
+   for (int frames : frameCounts)
+   {
+      cpu_model::SyntheticStack stack;
+      if (cpu_model::MakeSyntheticStack(rows, cols, frames, seed, Optics, stack))
+      {
+         std::cerr << "Could not simulate a " << rows << " x " << cols << " x " << frames << " stack" << std::endl;
+         return 1;
+      }
+      const float *trueA = stack.A.ptr<float>(), *trueB = stack.B.ptr<float>(), *trueH = stack.H.ptr<float>();
+      double genericEval{ 0.0 }, genericFit{ 0.0 };
+      for (bool fixed : { false, true })
+      {
+         CPUModel model;
+         model.RegisterImages(stack.frames);
+         model.SetFrameKernels(fixed);
+         if (model.InitializeBuffers())
+         {
+            std::cerr << "Could not allocate the model buffers" << std::endl;
+            return 1;
+         }
+         model.CalculateConstants(Optics.wavelength, Optics.dOx, Optics.nB, Optics.nOx, Optics.nSi, stack.angles.data());
+
+         std::vector<double> xvec(3), fvec(frames), jvec(3 * frames);
+         double evalSeconds = MedianSeconds(repeats, [&]()
+         {
+            for (int p = 0; p < pixels; p++)
+            {
+               xvec[0] = trueA[p];
+               xvec[1] = trueB[p];
+               xvec[2] = trueH[p];
+               model.CalculateFunction(p, xvec.data(), fvec.data());
+               model.CalculateJacobian(p, xvec.data(), jvec.data());
+            }
+         });
+         double fitSeconds = MedianSeconds(repeats, [&model]() { model.RunFit(); });
+         model.ReleaseBuffers();
+         if (!fixed)
+         {
+            genericEval = evalSeconds;
+            genericFit = fitSeconds;
+         }
+
+         const char *kernel = fixed ? "fixed" : "generic";
+         out << frames << "," << kernel << "," << rows << "," << cols << "," << seed << "," << repeats << "," <<
+            evalSeconds << "," << pixels / evalSeconds << "," << fitSeconds << "," << pixels / fitSeconds << "," <<
+            genericEval / evalSeconds << "," << genericFit / fitSeconds << std::endl;
+         std::cout << frames << " frames " << kernel << ": " << (int)(pixels / evalSeconds) << " evaluations/s, " <<
+            (int)(pixels / fitSeconds) << " pixels/s" << std::endl;
+      }
+   }
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   int rows{ 256 }, cols{ 256 }, frames{ 31 }, repeats{ 3 };
+   unsigned int seed{ 1 };
+   std::string outPath{ "fit_benchmark.csv" };
+   std::vector<int> threads, kernelFrames;
+   for (int i = 1; i + 1 < argc; i += 2)
+   {
+      std::string option(argv[i]);
+      if (option == "--rows")
+         rows = atoi(argv[i + 1]);
+      else if (option == "--cols")
+         cols = atoi(argv[i + 1]);
+      else if (option == "--frames")
+         frames = atoi(argv[i + 1]);
+      else if (option == "--seed")
+         seed = (unsigned int)strtoul(argv[i + 1], nullptr, 10);
+      else if (option == "--repeats")
+         repeats = atoi(argv[i + 1]);
+      else if (option == "--threads")
+         threads = ParseCounts(argv[i + 1]);
+      else if (option == "--kernels")
+         kernelFrames = ParseCounts(argv[i + 1]);
+      else if (option == "--out")
+         outPath = argv[i + 1];
+      else
+      {
+         std::cerr << "Unknown option " << option << std::endl <<
+            "Usage: fit_benchmark [--rows N] [--cols N] [--frames N] [--seed N] [--repeats N] "
+            "[--threads 1,2,4] [--kernels 16,31,32,64] [--out file.csv]" << std::endl;
+         return 1;
+      }
+   }
+   if (repeats < 1)
+      repeats = 1;
+   //"--kernels" compares the frame count kernels instead of the solvers
+   if (!kernelFrames.empty())
+      return KernelBenchmark(rows, cols, seed, repeats, kernelFrames, outPath);
+   //Default to doubling up to every logical processor
+   if (threads.empty())
+   {
+      int hardware = (int)std::thread::hardware_concurrency();
+      if (hardware < 1)
+         hardware = 1;
+      for (int t = 1; t < hardware; t *= 2)
+         threads.push_back(t);
+      threads.push_back(hardware);
+   }
+
+   cpu_model::SyntheticStack stack;
+   if (cpu_model::MakeSyntheticStack(rows, cols, frames, seed, Optics, stack))
+   {
+      std::cerr << "Could not simulate a " << rows << " x " << cols << " x " << frames << " stack" << std::endl;
+      return 1;
+   }
+
+   std::ofstream out(outPath);
+   if (!out)
+   {
+      std::cerr << "Could not create " << outPath << std::endl;
+      return 1;
+   }
+   out << "mode,solver,warm_start,sincos,simd,threads,rows,cols,frames,seed,repeats,seconds,pixels_per_second,speedup,"
+      "converged,h_rmse_nm,h_bias_nm,h_median_abs_nm,h_within_5nm,a_rel_rmse,b_rmse,h_vs_double_rms_nm,"
+      "h_vs_double_max_nm,grain,differs_from_serial,vs_serial_mkl,stopcrit_vs_serial_mkl" << std::endl;
+
+   const CPUModel::SolverType solvers[] = { CPUModel::SolverType::SOLVER_MKL_TRNLSP,
+      CPUModel::SolverType::SOLVER_BATCHED_LM, CPUModel::SolverType::SOLVER_VARPRO,
+      CPUModel::SolverType::SOLVER_FLOAT_LM };
+
+   //The double batched fit is the reference the reduced precision paths are
+   //held to
+   cv::Mat reference;
+   {
+      CPUModel model;
+      model.RegisterImages(stack.frames);
+      model.SetSolver(CPUModel::SolverType::SOLVER_BATCHED_LM);
+      if (model.InitializeBuffers())
+      {
+         std::cerr << "Could not allocate the model buffers" << std::endl;
+         return 1;
+      }
+      model.CalculateConstants(Optics.wavelength, Optics.dOx, Optics.nB, Optics.nOx, Optics.nSi, stack.angles.data());
+      if (model.ParallelRunFit())
+      {
+         std::cerr << "The reference fit failed" << std::endl;
+         return 1;
+      }
+      reference = model.GetImages()[2].clone();
+      model.ReleaseBuffers();
+   }
+
+   const cpu_model::SimdLevel widest = cpu_model::DetectSimdLevel();
+   std::vector<BenchCase> cases;
+   for (RunMode mode : { RunMode::RUN_SERIAL, RunMode::RUN_PARFOR, RunMode::RUN_THREADED })
+   {
+#ifndef SAIM_WITH_TBB
+      if (mode == RunMode::RUN_PARFOR)
+         continue;
+#endif
+      for (CPUModel::SolverType solver : solvers)
+         cases.push_back(BenchCase{ mode, solver, CPUModel::WarmStartOrder::WARM_START_OFF, false, false, widest });
+   }
+   //The variable projection solver has no warm start
+   cases.push_back(BenchCase{ ParallelMode, solvers[0], CPUModel::WarmStartOrder::WARM_START_HILBERT, false, false, widest });
+   cases.push_back(BenchCase{ ParallelMode, solvers[1], CPUModel::WarmStartOrder::WARM_START_HILBERT, false, false, widest });
+   //The MKL solver evaluates the model and Jacobian through the sincos kernel
+   cases.push_back(BenchCase{ ParallelMode, solvers[0], CPUModel::WarmStartOrder::WARM_START_OFF, true, false, widest });
+#ifdef SAIM_WITH_TBB
+   //Grain size picked by AutoTuneGrainSize for each thread count
+   cases.push_back(BenchCase{ RunMode::RUN_PARFOR, solvers[1], CPUModel::WarmStartOrder::WARM_START_OFF, false, true, widest });
+#endif
+   //The narrower instruction set builds of the lane solvers, serial so the
+   //rates compare per core
+   for (cpu_model::SimdLevel simd : { cpu_model::SimdLevel::SIMD_SCALAR, cpu_model::SimdLevel::SIMD_AVX2 })
+   {
+      if (simd >= widest)
+         continue;
+      cases.push_back(BenchCase{ RunMode::RUN_SERIAL, solvers[1], CPUModel::WarmStartOrder::WARM_START_OFF, false, false, simd });
+      cases.push_back(BenchCase{ RunMode::RUN_SERIAL, solvers[3], CPUModel::WarmStartOrder::WARM_START_OFF, false, false, simd });
+   }
+
+   //Maps of each solver's serial fit. The parallel runners seed the same
+   //tiles, so with the same starts they have to reproduce them to the bit.
+   std::map<CPUModel::SolverType, std::vector<cv::Mat>> serialMaps;
+   //Rate and stop criteria of the serial MKL fit, which every case is
+   //compared with. The serial cases run first and MKL is the first solver.
+   double mklRate{ 0.0 };
+   cv::Mat mklStopCrit;
+
+   const int pixels = rows * cols;
+   for (const BenchCase &bench : cases)
+   {
+      double baseRate{ 0.0 };
+      for (int t : threads)
+      {
+         //A serial fit only has one thread to scale over
+         if (bench.mode == RunMode::RUN_SERIAL && t != threads.front())
+            break;
+         int used = bench.mode == RunMode::RUN_SERIAL ? 1 : t;
+
+         CPUModel model;
+         model.RegisterImages(stack.frames);
+         model.SetSolver(bench.solver);
+         model.SetWarmStart(bench.warmStart);
+         model.SetFastSinCos(bench.fastSinCos);
+         model.SetSimdLevel(bench.simd);
+         if (model.InitializeBuffers())
+         {
+            std::cerr << "Could not allocate the model buffers" << std::endl;
+            return 1;
+         }
+         model.CalculateConstants(Optics.wavelength, Optics.dOx, Optics.nB, Optics.nOx, Optics.nSi, stack.angles.data());
+
+         int failed{ 0 };
+#ifdef SAIM_WITH_TBB
+         if (bench.autoGrain)
+         {
+            tbb::task_arena arena(used);
+            arena.execute([&model, &failed]() { failed |= model.AutoTuneGrainSize(); });
+         }
+#endif
+         double median = MedianSeconds(repeats, [&model, &bench, used, &failed]() { failed |= RunOnce(model, bench.mode, used); });
+         const char *warm = bench.warmStart == CPUModel::WarmStartOrder::WARM_START_OFF ? "off" : "hilbert";
+         const char *sincos = bench.fastSinCos ? "fast" : "libm";
+         const char *simd = cpu_model::SimdLevelName(bench.simd);
+         //A failed fit has no meaningful time or accuracy, it is reported and left out of the CSV
+         if (failed)
+         {
+            model.ReleaseBuffers();
+            std::cerr << ModeName(bench.mode) << " " << SolverName(bench.solver) << " warm " << warm << " " << sincos << " " << simd << ", " <<
+               used << " threads: the fit failed, no row written" << std::endl;
+            continue;
+         }
+         double rate = pixels / median;
+         if (baseRate == 0.0)
+            baseRate = rate;
+         Accuracy accuracy = Compare(model.GetImages(), stack, reference);
+         //-1 when there is no serial fit with the same starts to compare with
+         int differing{ -1 };
+         if (bench.warmStart == CPUModel::WarmStartOrder::WARM_START_OFF && !bench.fastSinCos)
+         {
+            std::vector<cv::Mat> maps = model.GetImages();
+            if (bench.mode == RunMode::RUN_SERIAL && bench.simd == widest)
+            {
+               for (cv::Mat &map : maps)
+                  serialMaps[bench.solver].push_back(map.clone());
+               if (bench.solver == CPUModel::SolverType::SOLVER_MKL_TRNLSP)
+               {
+                  mklRate = rate;
+                  mklStopCrit = maps[3].clone();
+               }
+            }
+            else if (serialMaps.count(bench.solver) != 0)
+               differing = DifferingPixels(maps, serialMaps[bench.solver]);
+         }
+         double sameStopCrit = mklRate > 0.0 ? SameStopCrit(model.GetImages()[3], mklStopCrit) : 0.0;
+         model.ReleaseBuffers();
+
+         out << ModeName(bench.mode) << "," << SolverName(bench.solver) << "," << warm << "," << sincos << "," <<
+            simd << "," << used << "," <<
+            rows << "," << cols << "," << frames << "," << seed << "," << repeats << "," << median << "," <<
+            rate << "," << rate / baseRate << "," << accuracy.converged << "," << accuracy.hRmse << "," <<
+            accuracy.hBias << "," << accuracy.hMedianAbs << "," << accuracy.hWithin5 << "," <<
+            accuracy.aRelRmse << "," << accuracy.bRmse << "," << accuracy.hVsDoubleRms << "," <<
+            accuracy.hVsDoubleMax << "," << model.GetGrainSize() << ",";
+         if (differing >= 0)
+            out << differing;
+         out << ",";
+         if (mklRate > 0.0)
+            out << rate / mklRate << "," << sameStopCrit;
+         else
+            out << ",";
+         out << std::endl;
+         std::cout << ModeName(bench.mode) << " " << SolverName(bench.solver) << " warm " << warm << " " << sincos << " " <<
+            simd << ", " << used << " threads, grain " << model.GetGrainSize() << ": " << (int)rate << " pixels/s, H rmse " << accuracy.hRmse << " nm";
+         if (bench.mode == RunMode::RUN_THREADED)
+         {
+            int tiles, stolen;
+            model.GetScheduling(&tiles, &stolen);
+            std::cout << ", " << stolen << " of " << tiles << " tiles stolen";
+         }
+         if (differing == 0)
+            std::cout << ", bit-identical to serial";
+         else if (differing > 0)
+            std::cout << ", " << differing << " pixels differ from serial";
+         if (mklRate > 0.0 && bench.solver != CPUModel::SolverType::SOLVER_MKL_TRNLSP)
+            std::cout << ", " << rate / mklRate << "x serial MKL, stopCrit agrees on " << 100.0 * sameStopCrit << "%";
+         std::cout << std::endl;
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,144 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#include "synthetic_stack.h"
+#include "saim_model_cpu.h"
+
+#include <cmath>
+#include <random>
+
+namespace cpu_model
+{
+   //Half the sweep of the testbed's linangles, degrees
+   static const double SweepDegrees = 39.911025;
+
+   //std::mt19937's sequence is fixed by the standard but the distributions
+   //are not, so the noise is drawn here to give the same stack everywhere
+
+   //A uniform deviate in (0, 1) from one draw of the generator
+   static double Uniform(std::mt19937 &generator)
+   {
+      return (generator() + 0.5) * (1.0 / 4294967296.0);
+   }
+
+   //A Poisson deviate, by inversion for small means and otherwise by
+   //Hormann's transformed rejection with squeeze (PTRS)
+   static int Poisson(double mean, std::mt19937 &generator)
+   {
+      if (mean < 10.0)
+      {
+         double p = exp(-mean), sum = p, u = Uniform(generator);
+         int k{ 0 };
+         while (u > sum && k < 1000)
+         {
+            k++;
+            p *= mean / k;
+            sum += p;
+         }
+         return k;
+      }
+      const double root = sqrt(mean), logMean = log(mean);
+      const double b = 0.931 + 2.53 * root, a = -0.059 + 0.02483 * b;
+      const double inverseAlpha = 1.1239 + 1.1328 / (b - 3.4), vr = 0.9277 - 3.6224 / (b - 2.0);
+      while (true)
+      {
+         double u = Uniform(generator) - 0.5, v = Uniform(generator);
+         double us = 0.5 - fabs(u);
+         double k = floor((2.0 * a / us + b) * u + mean + 0.43);
+         if (us >= 0.07 && v <= vr)
+            return (int)k;
+         if (k < 0.0 || (us < 0.013 && v > us))
+            continue;
+         if (log(v * inverseAlpha / (a / (us * us) + b)) <= -mean + k * logMean - lgamma(k + 1.0))
+            return (int)k;
+      }
+   }
+
+   int MakeSyntheticStack(int rows, int cols, int frames, unsigned int seed, const SyntheticOptics &optics,
+      SyntheticStack &stack)
+   {
+      if (rows < 1 || cols < 1 || frames < 3)
+         return 1;
+      stack.angles.resize(frames);
+      for (int j = 0; j < frames; j++)
+         stack.angles[j] = (-SweepDegrees + j * 2.0 * SweepDegrees / (frames - 1)) * CV_PI / 180.0;
+
+      //A one pixel model evaluates the forward model for every pixel
+      std::vector<cv::Mat> probe;
+      for (int j = 0; j < frames; j++)
+         probe.push_back(cv::Mat(1, 1, CV_16U, cv::Scalar(0)));
+      CPUModel model;
+      model.RegisterImages(probe);
+      if (model.InitializeBuffers())
+         return 1;
+      model.CalculateConstants(optics.wavelength, optics.dOx, optics.nB, optics.nOx, optics.nSi, stack.angles.data());
+
+      stack.A = cv::Mat(rows, cols, CV_32F);
+      stack.B = cv::Mat(rows, cols, CV_32F);
+      stack.H = cv::Mat(rows, cols, CV_32F);
+      stack.frames.clear();
+      for (int j = 0; j < frames; j++)
+         stack.frames.push_back(cv::Mat(rows, cols, CV_16U));
+
+      std::mt19937 generator(seed);
+      std::vector<unsigned short> zeros(frames, 0);
+      std::vector<double> fvec(frames);
+      for (int y = 0; y < rows; y++)
+      {
+         for (int x = 0; x < cols; x++)
+         {
+            double u = (x + 0.5) / cols, v = (y + 0.5) / rows;
+            double xvec[3];
+            xvec[0] = 1000.0 + 1000.0 * u;
+            xvec[1] = 200.0 + 200.0 * v;
+            xvec[2] = 65.0 + 45.0 * sin(3.0 * CV_PI * u) * cos(2.0 * CV_PI * v);
+            *stack.A.ptr<float>(y, x) = (float)xvec[0];
+            *stack.B.ptr<float>(y, x) = (float)xvec[1];
+            *stack.H.ptr<float>(y, x) = (float)xvec[2];
+            //With all-zero data the residual is minus the model
+            model.CalculateFunction(zeros.data(), xvec, fvec.data());
+            for (int j = 0; j < frames; j++)
+            {
+               int count{ 0 };
+               if (-fvec[j] > 0.0)
+                  count = Poisson(-fvec[j], generator);
+               *stack.frames[j].ptr<unsigned short>(y, x) = (unsigned short)(count < 65535 ? count : 65535);
+            }
+         }
+      }
+      model.ReleaseBuffers();
+      return 0;
+   }
+}
@@ -0,0 +1,77 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+#ifndef SYNTHETIC_STACK_H
+#define SYNTHETIC_STACK_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace cpu_model
+{
+   /**Optical constants, in the units of CPUModel::CalculateConstants*/
+   struct SyntheticOptics
+   {
+      double wavelength, dOx, nB, nOx, nSi;
+   };
+
+   /****************************************************************************
+   * @brief A simulated SAIM acquisition and the maps it was made from.
+   *
+   * The frames are drawn from the forward model of CPUModel itself, using
+   * the constants of CalculateConstants and the model of CalculateFunction,
+   * so a fit of the stack should recover the maps up to the shot noise.
+   * Heights are smooth hills inside the default height grid, A and B vary
+   * slowly across the image, and every frame value is a Poisson sample of
+   * the model. The same seed gives the same stack with every compiler and
+   * standard library, up to the last bit of their sin and log.
+   ****************************************************************************/
+   struct SyntheticStack
+   {
+      std::vector<cv::Mat> frames;     //CV_16U, one per angle
+      cv::Mat A, B, H;                 //CV_32F ground truth
+      std::vector<double> angles;      //radians, one per frame
+   };
+
+   /*************************************************************************
+   * @brief Simulates a rows x cols stack of frames angles spread evenly over
+   * the testbed's +-39.9 degree sweep (the testbed's angles for 31 frames)
+   *************************************************************************/
+   int MakeSyntheticStack(int rows, int cols, int frames, unsigned int seed, const SyntheticOptics &optics,
+      SyntheticStack &stack);
+}
+
+#endif //SYNTHETIC_STACK_H
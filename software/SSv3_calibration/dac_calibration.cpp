@@ -0,0 +1,259 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#include "dac_calibration.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace SSV3
+{
+   static const double Pi = 3.14159265358979323846;
+   //Sequences are converted in blocks small enough to stay in L1
+   static const int BlockSize = 256;
+
+   DacCalibration::DacCalibration()
+      : _coefficients{ 4.032903e-8, 4.231488e-3, 0 }
+   {
+   }
+
+   DacCalibration::DacCalibration(const std::vector<double> &coefficients)
+      : DacCalibration()
+   {
+      SetCoefficients(coefficients);
+   }
+
+   int DacCalibration::SetCoefficients(const std::vector<double> &coefficients)
+   {
+      if (coefficients.empty())
+         return 1;
+      for (double c : coefficients)
+      {
+         if (!std::isfinite(c))
+            return 1;
+      }
+      _coefficients = coefficients;
+      return 0;
+   }
+
+   double DacCalibration::DacToDeg(double dac) const
+   {
+      double deg = _coefficients[0];
+      for (size_t k = 1; k < _coefficients.size(); k++)
+         deg = deg * dac + _coefficients[k];
+      return deg;
+   }
+
+   double DacCalibration::Derivative(double dac) const
+   {
+      double slope = 0.0;
+      int order = Order();
+      for (int k = 0; k < order; k++)
+         slope = slope * dac + (order - k) * _coefficients[k];
+      return slope;
+   }
+
+   double DacCalibration::DegToDac(double deg) const
+   {
+      int order = Order();
+      //Drop vanishing leading terms so a quadratic with a == 0 is linear
+      int lead = 0;
+      while (lead < order && _coefficients[lead] == 0.0)
+         lead++;
+      double dac = NAN;
+      if (order - lead == 1)
+         dac = (deg - _coefficients[order]) / _coefficients[order - 1];
+      else if (order - lead == 2)
+      {
+         double a = _coefficients[order - 2], b = _coefficients[order - 1], c = _coefficients[order];
+         dac = (sqrt(4 * a * (deg - c) + b * b) - b) / (2 * a);
+      }
+      else if (order - lead > 2)
+      {
+         //Bracketed Newton, falls back to bisection when a step leaves the bracket
+         double lo = 0.0, hi = DAC_MAX;
+         double fLo = DacToDeg(lo) - deg, fHi = DacToDeg(hi) - deg;
+         if (fLo * fHi > 0.0)
+            dac = fabs(fLo) < fabs(fHi) ? lo : hi;
+         else
+         {
+            dac = lo - fLo * (hi - lo) / (fHi - fLo);
+            for (int i = 0; i < 100; i++)
+            {
+               double f = DacToDeg(dac) - deg;
+               if (f == 0.0)
+                  break;
+               if ((f < 0.0) == (fLo < 0.0))
+                  lo = dac;
+               else
+                  hi = dac;
+               double slope = Derivative(dac);
+               double next = slope != 0.0 ? dac - f / slope : lo;
+               if (!(next > lo && next < hi))
+                  next = 0.5 * (lo + hi);
+               if (fabs(next - dac) < 1e-6)
+               {
+                  dac = next;
+                  break;
+               }
+               dac = next;
+            }
+         }
+      }
+      if (std::isnan(dac))
+         return 0.0;
+      return std::min(std::max(dac, 0.0), (double)DAC_MAX);
+   }
+
+   void DacCalibration::DacToDeg(const double *dac, double *deg, int count) const
+   {
+      //Horner's rule with the coefficients outermost, so each pass over the
+      //block is a multiply-add the compiler can vectorize
+      double acc[BlockSize];
+      for (int start = 0; start < count; start += BlockSize)
+      {
+         int n = std::min(BlockSize, count - start);
+         const double *x = dac + start;
+         for (int i = 0; i < n; i++)
+            acc[i] = _coefficients[0];
+         for (size_t k = 1; k < _coefficients.size(); k++)
+         {
+            double c = _coefficients[k];
+            for (int i = 0; i < n; i++)
+               acc[i] = acc[i] * x[i] + c;
+         }
+         std::copy(acc, acc + n, deg + start);
+      }
+   }
+
+   void DacCalibration::DacToRad(const double *dac, double *rad, int count) const
+   {
+      DacToDeg(dac, rad, count);
+      for (int i = 0; i < count; i++)
+         rad[i] *= Pi / 180.0;
+   }
+
+   void DacCalibration::DegToDac(const double *deg, double *dac, int count) const
+   {
+      for (int i = 0; i < count; i++)
+         dac[i] = DegToDac(deg[i]);
+   }
+
+   int DacCalibration::Fit(const double *dac, const double *deg, int count, int order, bool throughOrigin)
+   {
+      int first = throughOrigin ? 1 : 0;
+      int terms = order + 1 - first;
+      if (order < 0 || terms < 1 || count < terms)
+         return 1;
+
+      //Normal equations in powers of dac / DAC_MAX, which keeps the matrix
+      //well conditioned for the higher orders
+      std::vector<double> ata(terms * terms, 0.0), atb(terms, 0.0), row(terms);
+      for (int i = 0; i < count; i++)
+      {
+         double x = dac[i] / DAC_MAX;
+         double p = first ? x : 1.0;
+         for (int j = 0; j < terms; j++)
+         {
+            row[j] = p;
+            p *= x;
+         }
+         for (int j = 0; j < terms; j++)
+         {
+            atb[j] += row[j] * deg[i];
+            for (int k = 0; k < terms; k++)
+               ata[j * terms + k] += row[j] * row[k];
+         }
+      }
+
+      //Gaussian elimination with partial pivoting
+      for (int col = 0; col < terms; col++)
+      {
+         int pivot = col;
+         for (int r = col + 1; r < terms; r++)
+         {
+            if (fabs(ata[r * terms + col]) > fabs(ata[pivot * terms + col]))
+               pivot = r;
+         }
+         if (!(fabs(ata[pivot * terms + col]) > 1e-12 * fabs(ata[0])))
+            return 1;
+         if (pivot != col)
+         {
+            for (int k = 0; k < terms; k++)
+               std::swap(ata[col * terms + k], ata[pivot * terms + k]);
+            std::swap(atb[col], atb[pivot]);
+         }
+         for (int r = col + 1; r < terms; r++)
+         {
+            double f = ata[r * terms + col] / ata[col * terms + col];
+            for (int k = col; k < terms; k++)
+               ata[r * terms + k] -= f * ata[col * terms + k];
+            atb[r] -= f * atb[col];
+         }
+      }
+      std::vector<double> solution(terms);
+      for (int r = terms - 1; r >= 0; r--)
+      {
+         double s = atb[r];
+         for (int k = r + 1; k < terms; k++)
+            s -= ata[r * terms + k] * solution[k];
+         solution[r] = s / ata[r * terms + r];
+      }
+
+      //Back to DAC units, highest order first
+      std::vector<double> coefficients(order + 1, 0.0);
+      for (int j = 0; j < terms; j++)
+      {
+         int power = j + first;
+         coefficients[order - power] = solution[j] / pow((double)DAC_MAX, power);
+      }
+      return SetCoefficients(coefficients);
+   }
+
+   double DacCalibration::Refract(double deg, double fromIndex, double toIndex)
+   {
+      double s = sin(deg * Pi / 180.0) * fromIndex / toIndex;
+      if (fabs(s) > 1.0)
+         return NAN;
+      return asin(s) * 180.0 / Pi;
+   }
+
+   void DacCalibration::Refract(const double *deg, double *out, int count, double fromIndex, double toIndex)
+   {
+      for (int i = 0; i < count; i++)
+         out[i] = Refract(deg[i], fromIndex, toIndex);
+   }
+}
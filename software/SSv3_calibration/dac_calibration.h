@@ -0,0 +1,110 @@
+/**/////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//                                                                            //
+//  Copyright(c) 2018, Marshall Colville mjc449@cornell.edu                   //
+//  All rights reserved.                                                      //
+//                                                                            //
+//  Redistribution and use in source and binary forms, with or without        //
+//  modification, are permitted provided that the following conditions are    //
+//  met :                                                                     //
+//                                                                            //
+//  1. Redistributions of source code must retain the above copyright notice, //
+//  this list of conditions and the following disclaimer.                     //
+//  2. Redistributions in binary form must reproduce the above copyright      //
+//  notice, this list of conditions and the following disclaimer in the       //
+//  documentation and/or other materials provided with the distribution.      //
+//                                                                            //
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS       //
+//  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED //
+//  TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A           //
+//  PARTICULAR PURPOSE ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT OWNER   //
+//  OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,  //
+//  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,       //
+//  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR        //
+//  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF    //
+//  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING      //
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS        //
+//  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.              //
+//                                                                            //
+//  The views and conclusions contained in the software and documentation are //
+//  those of the authors and should not be interpreted as representing        //
+//  official policies, either expressed or implied, of the SAIMScannerV3      //
+//  project, the Paszek Research Group, or Cornell University.                //
+//////////////////////////////////////////////////////////////////////////////*/
+
+
+
+#ifndef DAC_CALIBRATION_H
+#define DAC_CALIBRATION_H
+
+#include <vector>
+
+namespace SSV3
+{
+   /****************************************************************************
+   * @brief Conversion between the scan mirror's DAC codes and the excitation
+   * angle, shared by the control panel, which writes angles to the scanner,
+   * and the analysis software, which needs the angle of every frame.
+   *
+   * The calibration is a polynomial in the DAC code with the coefficients
+   * stored highest order first, the order calibrationConstants are written
+   * to the control panel's .cfg files, so the usual quadratic is
+   * { a, b, c } with deg = a x^2 + b x + c. Any order can be used.
+   ****************************************************************************/
+   class DacCalibration
+   {
+   public:
+      static const int DAC_MAX = 0xFFFF;
+
+      /**The control panel's factory quadratic*/
+      DacCalibration();
+      explicit DacCalibration(const std::vector<double> &coefficients);
+
+      /*************************************************************************
+      * @brief Replaces the polynomial, highest order first. Returns 1 and
+      * keeps the old one if the list is empty or holds a non-finite value.
+      *************************************************************************/
+      int SetCoefficients(const std::vector<double> &coefficients);
+      const std::vector<double> &Coefficients(void) const { return _coefficients; }
+      int Order(void) const { return (int)_coefficients.size() - 1; }
+
+      double DacToDeg(double dac) const;
+
+      /*************************************************************************
+      * @brief Inverse of DacToDeg over the DAC range, clamped to 0..DAC_MAX.
+      * Closed form up to quadratics, a bracketed Newton search above.
+      *************************************************************************/
+      double DegToDac(double deg) const;
+
+      /*************************************************************************
+      * @brief Whole sequences at once, e.g. every frame of a scan. Input and
+      * output may be the same array.
+      *************************************************************************/
+      void DacToDeg(const double *dac, double *deg, int count) const;
+      void DacToRad(const double *dac, double *rad, int count) const;
+      void DegToDac(const double *deg, double *dac, int count) const;
+
+      /*************************************************************************
+      * @brief Least squares fit of measured (DAC, angle) pairs by a
+      * polynomial of the given order, optionally without a constant term.
+      * Returns 1 and keeps the old polynomial if there are fewer points than
+      * terms or the points cannot determine them.
+      *************************************************************************/
+      int Fit(const double *dac, const double *deg, int count, int order, bool throughOrigin);
+
+      /*************************************************************************
+      * @brief Snell's law, the angle in a medium of index toIndex of a ray at
+      * deg in fromIndex. NaN past the critical angle. Calibration angles are
+      * measured in a target of a different index than the sample's medium.
+      *************************************************************************/
+      static double Refract(double deg, double fromIndex, double toIndex);
+      static void Refract(const double *deg, double *out, int count, double fromIndex, double toIndex);
+
+   private:
+      std::vector<double> _coefficients;
+
+      double Derivative(double dac) const;
+   };
+}
+
+#endif //DAC_CALIBRATION_H
@@ -568,20 +568,24 @@ void CalibratorDevice::on_deleteButton_clicked()
 
 void CalibratorDevice::LinearFit()
 {
-   double ax{}, ay{}, num{}, denom{}, sampleAngle{};
+   double sampleAngle{};
    std::vector<double> x, y;
    _correctedSeries->clear();
    for (auto i : _dataPoints)
    {
-      sampleAngle = CV_2PI * i.second / 360.0;
-      sampleAngle = sin(sampleAngle) * _targetN / _sampleN;
-      sampleAngle = asin(sampleAngle);
-      sampleAngle = sampleAngle * 360.0 / CV_2PI;
+      //Angles are measured in the target, the scan needs them in the sample
+      sampleAngle = SSV3::DacCalibration::Refract(i.second, _targetN, _sampleN);
+      if (std::isnan(sampleAngle))
+         continue;
       x.emplace_back(i.first);
       y.emplace_back(sampleAngle);
       _correctedSeries->append(QPointF(i.first, sampleAngle));
    }
-   _linConst = std::inner_product(x.begin(), x.end(), y.begin(), 0.0) / std::inner_product(x.begin(), x.end(), x.begin(), 0.0);
+   SSV3::DacCalibration fit;
+   if (fit.Fit(x.data(), y.data(), (int)x.size(), 1, true) == 0)
+      _linConst = fit.Coefficients()[0];
+   else
+      _linConst = 0;
    sampleAngle = _linConst * (double)0x6FFF;
    _fitSeries->replace(1, 0x6FFF, sampleAngle);
    _fitValueLabel->setText(QString("%1").arg(_linConst, 5, 'g'));
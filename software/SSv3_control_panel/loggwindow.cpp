@@ -309,10 +309,8 @@ void LoggWindow::on_recordSettingsButton_clicked()
          << ", " << (int)_mainWindow->_yCenter << ")"
          << "\n>>    Phase - " << (int)_mainWindow->_phase
          << "\n>>    Frequency - " << (double)_mainWindow->_frequency * 1100 / 0x2e23
-         << "\n>>    Dac to deg conversion values: C1="
-         << _mainWindow->_calibrationFactor[0]
-         << " C2=" << _mainWindow->_calibrationFactor[1]
-         << " C3=" << _mainWindow->_calibrationFactor[2]
+         << "\n>>    Dac to deg conversion values: "
+         << _mainWindow->CalibrationString()
          << "\n";
    }
    else
@@ -368,11 +368,11 @@ void cp::SaveSettings(fs::path p)
       return;
    }
    _configPath = p;
-   fileStream << "# SSv3 control panel configuration\n"
-      << "calibrationConstants=" << _calibrationFactor[0] << "\n"
-      << "calibrationConstants=" << _calibrationFactor[1] << "\n"
-      << "calibrationConstants=" << _calibrationFactor[2] << "\n"
-      << "xCenter=" << (int)_xCenter << "\n"
+   fileStream << "# SSv3 control panel configuration\n";
+   fileStream.precision(10);
+   for (double c : _calibration.Coefficients())
+      fileStream << "calibrationConstants=" << c << "\n";
+   fileStream << "xCenter=" << (int)_xCenter << "\n"
       << "yCenter=" << (int)_yCenter << "\n"
       << "tirRadius=" << (int)_tirRadius << "\n"
       << "phase=" << (int)_phase << "\n"
@@ -423,7 +423,8 @@ void cp::LoadSettings()
    on_centerParkButton_clicked();
    bool adv = ui.advancedScanGroup->isEnabled();
    ui.advancedScanGroup->setEnabled(true);
-   _calibrationFactor = vm["calibrationConstants"].as<std::vector<double>>();
+   if (vm.count("calibrationConstants"))
+      _calibration.SetCoefficients(vm["calibrationConstants"].as<std::vector<double>>());
    ui.xCenterSpin->setValue(vm["xCenter"].as<unsigned short>());
    ui.yCenterSpin->setValue(vm["yCenter"].as<unsigned short>());
    ui.tirSpin->setValue(vm["tirRadius"].as<unsigned short>());
@@ -1443,28 +1444,25 @@ void SSv3ControlPanel::on_newSequenceButton_clicked()
 
 int SSv3ControlPanel::DegToDac(double val)
 {
-   double dac;
-   if (_calibrationFactor[0] != 0)
-   {
-      dac = sqrt(4 * _calibrationFactor[0] * (val - _calibrationFactor[2]) + _calibrationFactor[1] * _calibrationFactor[1]);
-      dac -= _calibrationFactor[1];
-      dac /= 2 * _calibrationFactor[0];
-   }
-   else
-      dac = (val - _calibrationFactor[2]) / _calibrationFactor[1];
-   //quick check that dac is valid
-   dac = dac < 0 ? 0 : dac;
-   return (unsigned short)dac;
+   return (unsigned short)_calibration.DegToDac(val);
 }
 
 double SSv3ControlPanel::DacToDeg(int val)
 {
-   double dac = (double)val;
-   double deg = _calibrationFactor[0] * dac * dac + _calibrationFactor[1] * dac + _calibrationFactor[2];
+   double deg = _calibration.DacToDeg((double)val);
    deg = std::round(deg * 100.0) / 100.0;
    return deg;
 }
 
+std::string SSv3ControlPanel::CalibrationString()
+{
+   std::ostringstream str;
+   const std::vector<double> &c = _calibration.Coefficients();
+   for (size_t i = 0; i < c.size(); i++)
+      str << (i ? " C" : "C") << i + 1 << "=" << c[i];
+   return str.str();
+}
+
 void SSv3ControlPanel::on_degreesButton_clicked()
 {
    _dontUpdate = true;
@@ -2175,20 +2173,23 @@ void SSv3ControlPanel::on_frequencySpin_valueChanged()
 
 void SSv3ControlPanel::on_setCalibrationButton_clicked()
 {
-   SetCalibrationValuesDialog dialog(this, _calibrationFactor);
+   //The dialog edits a quadratic, a higher order calibration shows its lowest three terms
+   std::vector<double> quad(3, 0.0);
+   const std::vector<double> &c = _calibration.Coefficients();
+   for (size_t i = 0; i < 3 && i < c.size(); i++)
+      quad[2 - i] = c[c.size() - 1 - i];
+   SetCalibrationValuesDialog dialog(this, quad);
    if (dialog.exec())
    {
-      _calibrationFactor[0] = dialog._quadValue->text().toDouble();
-      _calibrationFactor[1] = dialog._linValue->text().toDouble();
-      _calibrationFactor[2] = dialog._constValue->text().toDouble();
+      _calibration.SetCoefficients({ dialog._quadValue->text().toDouble(),
+         dialog._linValue->text().toDouble(), dialog._constValue->text().toDouble() });
       if (ui.degreesButton->isChecked())
          on_degreesButton_clicked();
    }
    if (_log != nullptr)
    {
-      _log->_textBoxStream << "\n>>Deg to DAC conversion constants changed: C1="
-         << _calibrationFactor[0] << " C2=" << _calibrationFactor[1]
-         << " C3=" << _calibrationFactor[2] << "\n";
+      _log->_textBoxStream << "\n>>Deg to DAC conversion constants changed: "
+         << CalibrationString() << "\n";
    }
 }
 
@@ -2210,14 +2211,12 @@ void SSv3ControlPanel::on_calibrateButton_clicked()
 
 void SSv3ControlPanel::on_calibration_sent(double val)
 {
-   _calibrationFactor[0] = 0;
-   _calibrationFactor[1] = val;
-   _calibrationFactor[2] = 0;
+   _calibration.SetCoefficients({ 0, val, 0 });
    if (ui.degreesButton->isChecked())
       on_degreesButton_clicked();
    if (_log != nullptr)
    {
-      _log->_textBoxStream << "\n>>Deg to DAC conversion constants changed: C1=" << _calibrationFactor[0] << " C2=" << _calibrationFactor[1] << " C3=" << _calibrationFactor[2] << "\n";
+      _log->_textBoxStream << "\n>>Deg to DAC conversion constants changed: " << CalibrationString() << "\n";
    }
 }
 
@@ -44,6 +44,7 @@
 #include "boost/filesystem.hpp"
 
 #include "SSv3_driver\SAIMScannerV3.h"
+#include "SSv3_calibration\dac_calibration.h"
 #include "loggwindow.h"
 
 
@@ -84,7 +85,7 @@ private:
    std::vector<int> _previousProfile = std::vector<int>(8, 0);
    bool _loopOnOff{ false };
    unsigned short _loopTo{};
-   std::vector<double> _calibrationFactor{ 4.032903e-8, 4.231488e-3, 0 };
+   SSV3::DacCalibration _calibration;
    double _parkLocation[2]{ 0.0, 0.0 };
    bool _demoMode{ false };
    unsigned short _xCenter{ 0x7FFF }, _yCenter{ 0x7FFF }, _tirRadius{ 0x3D00 }, _phase{ 0x0400 }, _frequency{ 0x29F1 }, _yScale{ 0x7FFF };
@@ -113,6 +114,7 @@ private:
    void UpdateProfile(int, std::vector<int>);
    int DegToDac(double);
    double DacToDeg(int);
+   std::string CalibrationString();
    void SetLocationPark();
    void LoadSettings();
    void SaveSettings(boost::filesystem::path);